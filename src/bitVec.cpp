@@ -56,6 +56,15 @@ void BitVec::push_back_with_len(const uint64_t x, const uint64_t len){
   size_ += len;
 }
 
+void BitVec::append(const BitVec& bv){
+  for (size_t i = 0; i + S_BLOCK <= bv.size_; i += S_BLOCK){
+    push_back_with_len(bv.B_[i / S_BLOCK], S_BLOCK);
+  }
+  if (bv.size_ % S_BLOCK != 0){
+    push_back_with_len(bv.B_[bv.size_ / S_BLOCK], bv.size_ % S_BLOCK);
+  }
+}
+
 void BitVec::setBit(const uint64_t pos, const uint8_t b){
   if (b == 0) return;
   B_[pos / S_BLOCK] = 1LLU << (pos % S_BLOCK);
@@ -78,13 +87,34 @@ uint64_t BitVec::getBits(const uint64_t pos, const uint64_t len) const{
 
 void BitVec::save(ostream& os) const {
   os.write((const char*)&size_, sizeof(size_));
-  os.write((const char*)&B_[0],  sizeof(B_[0])*B_.size());
+  os.write((const char*)B_.data(),  sizeof(B_[0])*B_.size());
 }
 
 void BitVec::load(istream& ifs) {
-  ifs.read((char*)&size_, sizeof(size_));
+  B_.clear();
+  size_ = 0;
+  uint64_t size = 0;
+  if (!readU64(ifs, size) || size > ~(uint64_t)0 - S_BLOCK ||
+      !hasBytesLeft(ifs, (size + S_BLOCK - 1) / S_BLOCK * sizeof(uint64_t))){
+    ifs.setstate(ios::failbit);
+    return;
+  }
+  size_ = size;
   B_.resize((size_ + S_BLOCK - 1) / S_BLOCK);
-  ifs.read((char*)&B_[0],  sizeof(B_[0])*B_.size());
+  if (!B_.empty()){
+    ifs.read((char*)&B_[0],  sizeof(B_[0])*B_.size());
+  }
+}
+
+bool BitVec::view(const char*& p, const char* end) {
+  uint64_t size = 0;
+  if (!viewU64(p, end, size)) return false;
+  const uint64_t blockNum = (size + S_BLOCK - 1) / S_BLOCK;
+  if (blockNum > (uint64_t)(end - p) / sizeof(uint64_t)) return false;
+  size_ = size;
+  B_.setView((const uint64_t*)p, blockNum);
+  p += blockNum * sizeof(uint64_t);
+  return true;
 }
 
 size_t BitVec::size() const {
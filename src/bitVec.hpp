@@ -24,6 +24,7 @@
 #include <vector>
 #include <iostream>
 #include "uxUtil.hpp"
+#include "uxArray.hpp"
 
 namespace ux {
 
@@ -40,12 +41,14 @@ public:
 
   void push_back(const uint8_t b);
   void push_back_with_len(const uint64_t x, const uint64_t len);
+  void append(const BitVec& bv);
 
   void setBit(const uint64_t pos, const uint8_t b);
   uint8_t getBit(const uint64_t pos) const;
   uint64_t getBits(const uint64_t pos, const uint64_t len) const;
   void save(std::ostream& os) const;
   void load(std::istream& is);
+  bool view(const char*& p, const char* end);
   size_t size() const;
   void clear();
   void print() const;
@@ -54,7 +57,7 @@ public:
 
 private:
   size_t size_;
-  std::vector<uint64_t> B_;
+  Array<uint64_t> B_;
 };
 
 }
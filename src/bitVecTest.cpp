@@ -141,3 +141,11 @@ TEST(bitvec, vacuum){
 
 
 
+
+TEST(bitvec, checksum){
+  // XXH64 test vectors
+  ASSERT_EQ(0xEF46DB3751D8E999ULL, checksum64("", 0));
+  ASSERT_EQ(0x44BC2CF5AD770999ULL, checksum64("abc", 3));
+  string s = "Nobody inspects the spammish repetition";
+  ASSERT_EQ(0xFBCEA83C8A378BF1ULL, checksum64(s.c_str(), s.size()));
+}
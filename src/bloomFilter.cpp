@@ -0,0 +1,131 @@
+/* 
+ *  Copyright (c) 2010 Daisuke Okanohara
+ * 
+ *   Redistribution and use in source and binary forms, with or without
+ *   modification, are permitted provided that the following conditions
+ *   are met:
+ * 
+ *   1. Redistributions of source code must retain the above Copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *   2. Redistributions in binary form must reproduce the above Copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ *   3. Neither the name of the authors nor the names of its contributors
+ *      may be used to endorse or promote products derived from this
+ *      software without specific prior written permission.
+ */
+
+#include <cmath>
+#include "bloomFilter.hpp"
+
+using namespace std;
+
+namespace ux {
+
+static const uint64_t BLOOM_WORDS = BLOOM_BLOCK / 64;
+
+BloomFilter::BloomFilter() : blockNum_(0), hashNum_(0) {
+}
+
+BloomFilter::~BloomFilter() {
+}
+
+void BloomFilter::build(const vector<uint64_t>& hashes, const uint64_t bitsPerKey){
+  init(hashes.size(), bitsPerKey);
+  for (size_t i = 0; i < hashes.size(); ++i){
+    add(hashes[i]);
+  }
+}
+
+void BloomFilter::init(const uint64_t keyNum, const uint64_t bitsPerKey){
+  clear();
+  if (keyNum == 0 || bitsPerKey == 0) return;
+
+  blockNum_ = (keyNum * bitsPerKey + BLOOM_BLOCK - 1) / BLOOM_BLOCK;
+  hashNum_  = (uint64_t)(bitsPerKey * log(2.0) + 0.5);
+  if (hashNum_ < 1)  hashNum_ = 1;
+  if (hashNum_ > 16) hashNum_ = 16;
+  B_.resize(blockNum_ * BLOOM_WORDS);
+}
+
+void BloomFilter::add(const uint64_t hash){
+  if (blockNum_ == 0) return;
+  uint64_t* block = &B_[((hash >> 32) % blockNum_) * BLOOM_WORDS];
+  uint64_t h2 = hash * 0x9e3779b97f4a7c15LLU;
+  uint32_t a  = (uint32_t)h2;
+  uint32_t b  = (uint32_t)(h2 >> 32) | 1;
+  for (uint64_t j = 0; j < hashNum_; ++j, a += b){
+    uint32_t pos = a & (BLOOM_BLOCK - 1);
+    block[pos / 64] |= 1LLU << (pos % 64);
+  }
+}
+
+bool BloomFilter::mayContain(const uint64_t hash) const{
+  if (blockNum_ == 0) return true;
+  const uint64_t* block = &B_[((hash >> 32) % blockNum_) * BLOOM_WORDS];
+  uint64_t h2 = hash * 0x9e3779b97f4a7c15LLU;
+  uint32_t a  = (uint32_t)h2;
+  uint32_t b  = (uint32_t)(h2 >> 32) | 1;
+  for (uint64_t j = 0; j < hashNum_; ++j, a += b){
+    uint32_t pos = a & (BLOOM_BLOCK - 1);
+    if (((block[pos / 64] >> (pos % 64)) & 1LLU) == 0){
+      return false;
+    }
+  }
+  return true;
+}
+
+void BloomFilter::save(ostream& os) const{
+  os.write((const char*)&blockNum_, sizeof(blockNum_));
+  os.write((const char*)&hashNum_,  sizeof(hashNum_));
+  os.write((const char*)B_.data(), sizeof(B_[0]) * B_.size());
+}
+
+bool BloomFilter::view(const char*& p, const char* end){
+  uint64_t blockNum = 0;
+  uint64_t hashNum  = 0;
+  if (!viewU64(p, end, blockNum) || !viewU64(p, end, hashNum) ||
+      blockNum > (uint64_t)(end - p) / (BLOOM_WORDS * sizeof(uint64_t))){
+    return false;
+  }
+  blockNum_ = blockNum;
+  hashNum_  = hashNum;
+  B_.setView((const uint64_t*)p, blockNum_ * BLOOM_WORDS);
+  p += blockNum_ * BLOOM_WORDS * sizeof(uint64_t);
+  return true;
+}
+
+size_t BloomFilter::getAllocSize() const{
+  return B_.size() * sizeof(B_[0]);
+}
+
+bool BloomFilter::empty() const{
+  return blockNum_ == 0;
+}
+
+uint64_t BloomFilter::hashNum() const{
+  return hashNum_;
+}
+
+double BloomFilter::falsePositiveRate() const{
+  if (blockNum_ == 0) return 1.0;
+  double sum = 0.0;
+  for (uint64_t i = 0; i < blockNum_; ++i){
+    uint64_t ones = 0;
+    for (uint64_t j = 0; j < BLOOM_WORDS; ++j){
+      ones += popCount(B_[i * BLOOM_WORDS + j]);
+    }
+    sum += pow((double)ones / BLOOM_BLOCK, (double)hashNum_);
+  }
+  return sum / blockNum_;
+}
+
+void BloomFilter::clear(){
+  B_.clear();
+  blockNum_ = 0;
+  hashNum_  = 0;
+}
+
+}
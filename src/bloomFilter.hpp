@@ -0,0 +1,64 @@
+/* 
+ *  Copyright (c) 2010 Daisuke Okanohara
+ * 
+ *   Redistribution and use in source and binary forms, with or without
+ *   modification, are permitted provided that the following conditions
+ *   are met:
+ * 
+ *   1. Redistributions of source code must retain the above Copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *   2. Redistributions in binary form must reproduce the above Copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ *   3. Neither the name of the authors nor the names of its contributors
+ *      may be used to endorse or promote products derived from this
+ *      software without specific prior written permission.
+ */
+
+#ifndef BLOOM_FILTER_HPP__
+#define BLOOM_FILTER_HPP__
+
+#include <stdint.h>
+#include <vector>
+#include <iostream>
+#include "uxUtil.hpp"
+#include "uxArray.hpp"
+
+namespace ux {
+
+static const uint64_t BLOOM_BLOCK_SHIFT = 9; // one block fits in a cache line
+static const uint64_t BLOOM_BLOCK       = 1LLU << BLOOM_BLOCK_SHIFT;
+
+/**
+ * Blocked Bloom filter. All bits for a key are set in one block
+ * so that a query touches one cache line.
+ */
+class BloomFilter {
+public:
+  BloomFilter();
+  ~BloomFilter();
+
+  void build(const std::vector<uint64_t>& hashes, uint64_t bitsPerKey);
+  void init(uint64_t keyNum, uint64_t bitsPerKey);
+  void add(uint64_t hash);
+  bool mayContain(uint64_t hash) const;
+  
+  void save(std::ostream& os) const;
+  bool view(const char*& p, const char* end);
+  size_t getAllocSize() const;
+  bool empty() const;
+  uint64_t hashNum() const;
+  double falsePositiveRate() const;
+  void clear();
+
+private:
+  Array<uint64_t> B_;
+  uint64_t blockNum_;
+  uint64_t hashNum_;
+};
+
+}
+
+#endif // BLOOM_FILTER_HPP__
@@ -34,6 +34,7 @@ RSDic::~RSDic() {
 void RSDic::build(BitVec& bv){
   size_ = bv.size();
   swap(bitVec_, bv);
+  L_.clear();
   L_.resize((size_ + L_BLOCK-1) / L_BLOCK);
   size_t sum = 0;
   for (uint64_t il = 0; il < size_; il += L_BLOCK){
@@ -93,13 +94,21 @@ uint64_t RSDic::selectOverL(const uint64_t pos, const uint8_t b, uint64_t& retPo
 
 void RSDic::save(ostream& ofs) const{
   bitVec_.save(ofs);
+  L_.save(ofs);
 }
 
-void RSDic::load(istream& ifs) {
+void RSDic::loadLegacy(istream& ifs) {
+  // the rank directory is not saved in the legacy format
   bitVec_.load(ifs);
   build(bitVec_);
 }
 
+bool RSDic::view(const char*& p, const char* end) {
+  if (!bitVec_.view(p, end) || !L_.view(p, end)) return false;
+  size_ = bitVec_.size();
+  return true;
+}
+
 size_t RSDic::getAllocSize() const {
   return bitVec_.getAllocSize() + sizeof(L_[0]) * L_.size();
 }
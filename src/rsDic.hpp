@@ -38,7 +38,8 @@ public:
   uint64_t select(uint64_t pos, uint8_t b) const;
 
   void save(std::ostream& os) const;
-  void load(std::istream& is);
+  void loadLegacy(std::istream& is);
+  bool view(const char*& p, const char* end);
   size_t getAllocSize() const;
   uint8_t getBit(uint64_t pos) const;
   size_t size() const;
@@ -48,7 +49,7 @@ private:
   uint64_t selectOverL(uint64_t pos, uint8_t b, uint64_t& retPos) const;
   
   BitVec bitVec_;
-  std::vector<uint64_t> L_;
+  Array<uint64_t> L_;
   size_t size_;
 };
 
@@ -22,5 +22,12 @@
 
 #include "uxTrie.hpp"
 #include "uxMap.hpp"
+#include "uxBlobMap.hpp"
+#include "uxPackedMap.hpp"
+#include "uxMultiMap.hpp"
+#include "uxBuilder.hpp"
+#include "uxDynamic.hpp"
+#include "uxHandle.hpp"
+#include "uxSharded.hpp"
 
 #endif // UX_HPP__
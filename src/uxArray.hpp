@@ -0,0 +1,261 @@
+/* 
+ *  Copyright (c) 2010 Daisuke Okanohara
+ * 
+ *   Redistribution and use in source and binary forms, with or without
+ *   modification, are permitted provided that the following conditions
+ *   are met:
+ * 
+ *   1. Redistributions of source code must retain the above Copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *   2. Redistributions in binary form must reproduce the above Copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ *   3. Neither the name of the authors nor the names of its contributors
+ *      may be used to endorse or promote products derived from this
+ *      software without specific prior written permission.
+ */
+
+#ifndef UX_ARRAY_HPP__
+#define UX_ARRAY_HPP__
+
+#include <vector>
+#include <iostream>
+#include <algorithm>
+#include <cassert>
+#include <stdint.h>
+
+namespace ux {
+
+/**
+ * Items in a saved image are aligned to 8 bytes from the beginning of the image.
+ * Integers are stored in the little endian.
+ */
+static const uint64_t IMAGE_ALIGN = 8;
+
+inline uint64_t alignedSize(const uint64_t size){
+  return (size + IMAGE_ALIGN - 1) / IMAGE_ALIGN * IMAGE_ALIGN;
+}
+
+inline bool isLittleEndian(){
+  const uint16_t x = 1;
+  return *(const uint8_t*)&x == 1;
+}
+
+inline void writeU64(std::ostream& os, const uint64_t x){
+  os.write((const char*)&x, sizeof(x));
+}
+
+inline bool readU64(std::istream& is, uint64_t& x){
+  return (bool)is.read((char*)&x, sizeof(x));
+}
+
+/**
+ * Return the number of bytes left in a seekable stream
+ * @param is The stream
+ * @param left The number of bytes from the current position to the end
+ * @return true on success, false if the stream is broken or not seekable
+ */
+inline bool bytesLeft(std::istream& is, uint64_t& left){
+  if (!is) return false;
+  const std::streampos pos = is.tellg();
+  if (pos == std::streampos(-1)) return false;
+  is.seekg(0, std::ios::end);
+  const std::streampos end = is.tellg();
+  is.seekg(pos);
+  if (end == std::streampos(-1) || !is) return false;
+  left = end - pos;
+  return true;
+}
+
+/**
+ * Check that the stream has the given bytes left, before allocating a buffer for them.
+ * A length read from a broken file may be any value.
+ * @param is The stream
+ * @param bytes The number of bytes to be read
+ * @return true if the bytes are left, false otherwise or if the stream is not seekable
+ */
+inline bool hasBytesLeft(std::istream& is, const uint64_t bytes){
+  uint64_t left = 0;
+  return bytesLeft(is, left) && left >= bytes;
+}
+
+/**
+ * Read an integer from an image in memory
+ * @param p The current position, which is advanced
+ * @param end The end of the image
+ * @param x The read integer
+ * @return true on success, false if the image is too short
+ */
+inline bool viewU64(const char*& p, const char* end, uint64_t& x){
+  if ((uint64_t)(end - p) < sizeof(x)) return false;
+  x = *(const uint64_t*)p;
+  p += sizeof(x);
+  return true;
+}
+
+/**
+ * An array that either owns its items in a vector, or points to items 
+ * in an external image (view) such as a memory mapped file.
+ * A view is read only; clear() makes it an empty owned array.
+ */
+template <class T>
+class Array {
+public:
+  Array() : ptr_(NULL), size_(0), isView_(false) {}
+
+  Array(const Array& a) : vec_(a.vec_), ptr_(a.ptr_), size_(a.size_), isView_(a.isView_) {
+    if (!isView_) sync();
+  }
+
+  Array& operator=(const Array& a){
+    if (this != &a){
+      vec_    = a.vec_;
+      ptr_    = a.ptr_;
+      size_   = a.size_;
+      isView_ = a.isView_;
+      if (!isView_) sync();
+    }
+    return *this;
+  }
+
+  const T& operator[](const size_t i) const {
+    return ptr_[i];
+  }
+
+  T& operator[](const size_t i){
+    assert(!isView_);
+    return vec_[i];
+  }
+
+  const T* data() const {
+    return ptr_;
+  }
+
+  size_t size() const {
+    return size_;
+  }
+
+  bool empty() const {
+    return size_ == 0;
+  }
+
+  bool isView() const {
+    return isView_;
+  }
+
+  void push_back(const T& x){
+    assert(!isView_);
+    vec_.push_back(x);
+    sync();
+  }
+
+  void append(const T* p, const size_t num){
+    assert(!isView_);
+    vec_.insert(vec_.end(), p, p + num);
+    sync();
+  }
+
+  void resize(const size_t num, const T& x = T()){
+    assert(!isView_);
+    vec_.resize(num, x);
+    sync();
+  }
+
+  void clear(){
+    std::vector<T>().swap(vec_);
+    isView_ = false;
+    sync();
+  }
+
+  void swap(Array& a){
+    // the buffers of vectors do not move in swap
+    vec_.swap(a.vec_);
+    std::swap(ptr_,    a.ptr_);
+    std::swap(size_,   a.size_);
+    std::swap(isView_, a.isView_);
+  }
+
+  void swap(std::vector<T>& v){
+    if (isView_) clear();
+    vec_.swap(v);
+    sync();
+  }
+
+  /**
+   * Point to items in an external image without copying
+   * @param p The items, which must outlive this array
+   * @param num The number of items
+   */
+  void setView(const T* p, const size_t num){
+    std::vector<T>().swap(vec_);
+    ptr_    = p;
+    size_   = num;
+    isView_ = true;
+  }
+
+  /**
+   * Write the number of items and the items, padded to the alignment
+   */
+  void save(std::ostream& os) const {
+    writeU64(os, size_);
+    const uint64_t bytes = size_ * sizeof(T);
+    os.write((const char*)ptr_, bytes);
+    const char pad[IMAGE_ALIGN] = {0};
+    os.write(pad, alignedSize(bytes) - bytes);
+  }
+
+  /**
+   * Read items written by save()
+   * @return true on success
+   */
+  bool load(std::istream& is){
+    uint64_t num = 0;
+    if (!readU64(is, num)) return false;
+    if (num > ~(uint64_t)0 / sizeof(T) || !hasBytesLeft(is, num * sizeof(T))){
+      is.setstate(std::ios::failbit);
+      return false;
+    }
+    clear();
+    vec_.resize(num);
+    sync();
+    const uint64_t bytes = num * sizeof(T);
+    char pad[IMAGE_ALIGN];
+    is.read((char*)ptr_, bytes);
+    is.read(pad, alignedSize(bytes) - bytes);
+    return !is.fail();
+  }
+
+  /**
+   * Point to items written by save() in an image in memory
+   * @param p The current position in the image, which is advanced
+   * @param end The end of the image
+   * @return true on success, false if the image is too short
+   */
+  bool view(const char*& p, const char* end){
+    uint64_t num = 0;
+    if (!viewU64(p, end, num)) return false;
+    const uint64_t bytes = num * sizeof(T);
+    if (num > (uint64_t)(end - p) / sizeof(T) || alignedSize(bytes) > (uint64_t)(end - p)) return false;
+    setView((const T*)p, num);
+    p += alignedSize(bytes);
+    return true;
+  }
+
+private:
+  void sync(){
+    // keep pointing to the buffer of an emptied vector as std::vector does
+    ptr_  = vec_.capacity() ? &*vec_.begin() : NULL;
+    size_ = vec_.size();
+  }
+
+  std::vector<T> vec_;
+  const T* ptr_;
+  size_t size_;
+  bool isView_;
+};
+
+}
+
+#endif // UX_ARRAY_HPP__
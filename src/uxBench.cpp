@@ -0,0 +1,606 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <time.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <stdint.h>
+#include "cmdline.h"
+#include "uxTrie.hpp"
+#include "uxMap.hpp"
+#include "uxThread.hpp"
+
+using namespace std;
+
+// Benchmark suite for regression checks. Results are written as a flat JSON object
+// of metrics, each of which is the median of repeated runs, and a previous result can be
+// given to compare with.
+
+static const int JSON_VERSION = 1;
+
+double nowSec(){
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+uint64_t nowNsec(){
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// xorshift64*, so that generated key sets do not depend on the platform rand()
+struct Random{
+  uint64_t x;
+  explicit Random(uint64_t seed) : x(seed * 2685821657736338717ULL + 1) {}
+  uint64_t next(){
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    return x * 2685821657736338717ULL;
+  }
+  size_t operator()(size_t n){
+    return (size_t)(next() % n);
+  }
+};
+
+void appendWord(Random& rnd, string& s, size_t minSyllable, size_t maxSyllable){
+  static const char* consonants = "bcdfghjklmnprstvwz";
+  static const char* vowels     = "aeiou";
+  const size_t num = minSyllable + rnd(maxSyllable - minSyllable + 1);
+  for (size_t i = 0; i < num; ++i){
+    s += consonants[rnd(18)];
+    s += vowels[rnd(5)];
+    if (rnd(4) == 0) s += consonants[rnd(18)];
+  }
+}
+
+// keys are sorted and unique
+void generateKeys(const string& type, size_t num, uint64_t seed, vector<string>& keys){
+  static const char* tlds[]    = {"com", "net", "org", "jp", "de", "co.uk"};
+  static const char* schemes[] = {"http://", "https://", "http://www."};
+  Random rnd(seed);
+  keys.clear();
+  // a few extra keys to make up for duplicates
+  for (size_t i = 0; i < num + num / 8 + 16; ++i){
+    string s;
+    if (type == "url"){
+      // a few hosts have many paths
+      Random host(rnd(num / 16 + 1) + seed);
+      s += schemes[host(3)];
+      appendWord(host, s, 1, 4);
+      s += '.';
+      s += tlds[host(6)];
+      const size_t depth = rnd(4);
+      for (size_t d = 0; d < depth; ++d){
+	s += '/';
+	appendWord(rnd, s, 1, 3);
+      }
+      if (rnd(3) == 0){
+	ostringstream os;
+	os << "?id=" << rnd(1000000);
+	s += os.str();
+      }
+    } else if (type == "word"){
+      appendWord(rnd, s, 1, 5);
+    } else if (type == "id"){
+      ostringstream os;
+      os << rnd.next() % 10000000000000ULL;
+      s = os.str();
+    } else if (type == "dna"){
+      static const char* bases = "ACGT";
+      for (size_t j = 0; j < 32; ++j){
+	s += bases[rnd(4)];
+      }
+    } else {
+      return;
+    }
+    keys.push_back(s);
+  }
+  sort(keys.begin(), keys.end());
+  keys.erase(unique(keys.begin(), keys.end()), keys.end());
+  if (keys.size() > num){
+    // drop keys evenly so that the key set is still spread
+    vector<string> picked;
+    for (size_t i = 0; i < num; ++i){
+      picked.push_back(keys[i * keys.size() / num]);
+    }
+    keys.swap(picked);
+  }
+}
+
+int readKeys(const string& fn, vector<string>& keys){
+  ifstream ifs(fn.c_str());
+  if (!ifs){
+    cerr << "cannot open " << fn << endl;
+    return -1;
+  }
+  string key;
+  while (getline(ifs, key)){
+    if (key.size() > 0 && key[key.size()-1] == '\r'){
+      key.erase(key.size()-1);
+    }
+    keys.push_back(key);
+  }
+  sort(keys.begin(), keys.end());
+  keys.erase(unique(keys.begin(), keys.end()), keys.end());
+  return 0;
+}
+
+size_t peakRSS(){
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) != 0) return 0;
+  return (size_t)usage.ru_maxrss * 1024; // in KB on Linux
+}
+
+class Metrics{
+public:
+  void set(const string& name, double value){
+    if (values_.find(name) == values_.end()){
+      names_.push_back(name);
+    }
+    values_[name] = value;
+  }
+
+  // per-call latencies in ns
+  void setLatencies(const string& name, vector<uint64_t>& ns){
+    if (ns.empty()) return;
+    sort(ns.begin(), ns.end());
+    double sum = 0;
+    for (size_t i = 0; i < ns.size(); ++i){
+      sum += ns[i];
+    }
+    set(name + ".mean_ns", sum / ns.size());
+    set(name + ".p50_ns",  percentile(ns, 0.5));
+    set(name + ".p90_ns",  percentile(ns, 0.9));
+    set(name + ".p99_ns",  percentile(ns, 0.99));
+    set(name + ".p999_ns", percentile(ns, 0.999));
+    set(name + ".max_ns",  ns.back());
+  }
+
+  const map<string, double>& values() const {
+    return values_;
+  }
+
+  // the median of each metric over repeated runs
+  void setMedians(const vector<Metrics>& runs){
+    for (size_t i = 0; i < runs[0].names_.size(); ++i){
+      const string& name = runs[0].names_[i];
+      vector<double> vs;
+      for (size_t r = 0; r < runs.size(); ++r){
+	map<string, double>::const_iterator it = runs[r].values_.find(name);
+	if (it != runs[r].values_.end()) vs.push_back(it->second);
+      }
+      sort(vs.begin(), vs.end());
+      const size_t mid = vs.size() / 2;
+      set(name, vs.size() % 2 ? vs[mid] : (vs[mid - 1] + vs[mid]) / 2);
+    }
+  }
+
+  static string quote(const string& s){
+    string ret = "\"";
+    for (size_t i = 0; i < s.size(); ++i){
+      if (s[i] == '"' || s[i] == '\\') ret += '\\';
+      if ((unsigned char)s[i] >= 0x20) ret += s[i];
+    }
+    return ret + "\"";
+  }
+
+  // the values of info are written as they are, so strings must be quoted
+  void writeJSON(ostream& os, const map<string, string>& info) const {
+    os << "{" << endl
+       << "  \"version\": " << JSON_VERSION << "," << endl;
+    for (map<string, string>::const_iterator it = info.begin(); it != info.end(); ++it){
+      os << "  " << quote(it->first) << ": " << it->second << "," << endl;
+    }
+    os << "  \"metrics\": {" << endl;
+    char buf[64];
+    for (size_t i = 0; i < names_.size(); ++i){
+      snprintf(buf, sizeof(buf), "%.10g", values_.find(names_[i])->second);
+      os << "    \"" << names_[i] << "\": " << buf << (i + 1 < names_.size() ? "," : "") << endl;
+    }
+    os << "  }" << endl
+       << "}" << endl;
+  }
+
+  // read the metrics written by writeJSON()
+  int readJSON(const string& fn){
+    ifstream ifs(fn.c_str());
+    if (!ifs){
+      cerr << "cannot open " << fn << endl;
+      return -1;
+    }
+    string line;
+    bool inMetrics = false;
+    while (getline(ifs, line)){
+      if (line.find("\"metrics\"") != string::npos){
+	inMetrics = true;
+	continue;
+      }
+      size_t begin = line.find('"');
+      size_t end   = line.find("\":", begin + 1);
+      if (!inMetrics || begin == string::npos || end == string::npos) continue;
+      set(line.substr(begin + 1, end - begin - 1), strtod(line.c_str() + end + 2, NULL));
+    }
+    return 0;
+  }
+
+private:
+  static double percentile(const vector<uint64_t>& sorted, double p){
+    size_t i = (size_t)(p * sorted.size());
+    return sorted[min(i, sorted.size() - 1)];
+  }
+
+  vector<string> names_;
+  map<string, double> values_;
+};
+
+enum Operation {
+  OP_LOOKUP,
+  OP_LOOKUP_MISS,
+  OP_PREFIX,
+  OP_COMMON_PREFIX,
+  OP_PREDICTIVE,
+  OP_COUNT_PREFIX,
+  OP_DECODE,
+  OP_DECODE_LOOP,
+  OP_DECODE_BATCH,
+  OP_NUM
+};
+
+static const char* OP_NAMES[] = {"lookup", "lookup_miss", "prefix", "common_prefix",
+				 "predictive", "count_prefix", "decode", "decode_loop", "decode_batch"};
+
+struct Queries{
+  vector<string> hits;
+  vector<string> misses;
+  vector<string> prefixes;
+  vector<ux::id_t> ids;
+  vector<vector<ux::id_t> > batches; // the results of predictiveSearch() for prefixes
+};
+
+void makeQueries(const vector<string>& keys, size_t num, uint64_t seed, Queries& q){
+  Random rnd(seed + 1);
+  for (size_t i = 0; i < num; ++i){
+    const string& key = keys[rnd(keys.size())];
+    q.hits.push_back(key);
+    q.misses.push_back(key + '\x01');
+    q.prefixes.push_back(key.substr(0, key.size() == 0 ? 0 : 1 + rnd(key.size())));
+    q.ids.push_back(rnd(keys.size()));
+  }
+}
+
+void makeBatches(const ux::Trie& trie, size_t limit, Queries& q){
+  q.batches.resize(q.prefixes.size());
+  for (size_t i = 0; i < q.prefixes.size(); ++i){
+    trie.predictiveSearch(q.prefixes[i].c_str(), q.prefixes[i].size(), q.batches[i], limit);
+  }
+}
+
+// run one query of op, and return a value not to be optimized out
+size_t runQuery(const ux::Trie& trie, const Queries& q, Operation op, size_t i,
+		vector<ux::id_t>& ids, string& key, vector<size_t>& offsets, size_t limit){
+  size_t retLen = 0;
+  const vector<ux::id_t>& batch = q.batches[i];
+  switch (op){
+  case OP_LOOKUP:
+    return trie.lookup(q.hits[i].c_str(), q.hits[i].size());
+  case OP_LOOKUP_MISS:
+    return trie.lookup(q.misses[i].c_str(), q.misses[i].size());
+  case OP_PREFIX:
+    return trie.prefixSearch(q.hits[i].c_str(), q.hits[i].size(), retLen);
+  case OP_COMMON_PREFIX:
+    return trie.commonPrefixSearch(q.hits[i].c_str(), q.hits[i].size(), ids, limit);
+  case OP_PREDICTIVE:
+    return trie.predictiveSearch(q.prefixes[i].c_str(), q.prefixes[i].size(), ids, limit);
+  case OP_COUNT_PREFIX:
+    return trie.countPrefix(q.prefixes[i].c_str(), q.prefixes[i].size());
+  case OP_DECODE:
+    trie.decodeKey(q.ids[i], key);
+    return key.size();
+  case OP_DECODE_LOOP:
+    for (size_t j = 0; j < batch.size(); ++j){
+      trie.decodeKey(batch[j], key);
+      retLen += key.size();
+    }
+    return retLen;
+  case OP_DECODE_BATCH:
+    trie.decodeKeys(batch.empty() ? NULL : &batch[0], batch.size(), key, offsets);
+    return key.size();
+  default:
+    return 0;
+  }
+}
+
+size_t measureLatency(const ux::Trie& trie, const Queries& q, Operation op, size_t limit,
+		      Metrics& metrics){
+  vector<uint64_t> ns(q.hits.size());
+  vector<ux::id_t> ids;
+  string key;
+  vector<size_t> offsets;
+  size_t dummy = 0;
+  // warm up with the first queries, and then time each query
+  for (size_t i = 0; i < q.hits.size() && i < 1000; ++i){
+    dummy += runQuery(trie, q, op, i, ids, key, offsets, limit);
+  }
+  for (size_t i = 0; i < q.hits.size(); ++i){
+    const uint64_t start = nowNsec();
+    dummy += runQuery(trie, q, op, i, ids, key, offsets, limit);
+    ns[i] = nowNsec() - start;
+  }
+  metrics.setLatencies(OP_NAMES[op], ns);
+  return dummy;
+}
+
+struct LookupTask{
+  const ux::Trie* trie;
+  const Queries* q;
+  size_t begin;
+  size_t num;
+  size_t hitNum;
+  void run(){
+    hitNum = 0;
+    const size_t size = q->hits.size();
+    for (size_t i = 0; i < num; ++i){
+      const string& key = q->hits[(begin + i) % size];
+      hitNum += (trie->lookup(key.c_str(), key.size()) != ux::NOTFOUND);
+    }
+  }
+};
+
+struct UpdateTask{
+  ux::Map<uint64_t>* counts;
+  const Queries* q;
+  size_t begin;
+  size_t num;
+  bool striped;
+  void run(){
+    const size_t size = q->hits.size();
+    for (size_t i = 0; i < num; ++i){
+      const string& key = q->hits[(begin + i) % size];
+      if (striped){
+	counts->add(key.c_str(), key.size(), 1);
+      } else {
+	counts->fetchAdd(key.c_str(), key.size(), 1, NULL, ux::ORDER_RELAXED);
+      }
+    }
+  }
+};
+
+template <class Task>
+double runThroughput(vector<Task>& tasks){
+  const double start = nowSec();
+  ux::runTasks(tasks);
+  const double elapsedTime = nowSec() - start;
+  size_t num = 0;
+  for (size_t i = 0; i < tasks.size(); ++i){
+    num += tasks[i].num;
+  }
+  return elapsedTime > 0 ? num / elapsedTime : 0;
+}
+
+// the number of threads is doubled up to maxThreadNum
+void measureThroughput(const ux::Trie& trie, const vector<string>& keys, const Queries& q,
+		       size_t maxThreadNum, size_t opNum, Metrics& metrics){
+  vector<pair<string, uint64_t> > kvs;
+  for (size_t i = 0; i < keys.size(); ++i){
+    kvs.push_back(make_pair(keys[i], 0));
+  }
+  ux::Map<uint64_t> counts;
+  counts.build(kvs);
+  vector<pair<string, uint64_t> >().swap(kvs);
+  counts.setStripeNum(maxThreadNum * 2);
+
+  for (size_t threadNum = 1; ; threadNum = min(threadNum * 2, maxThreadNum)){
+    ostringstream suffix;
+    suffix << ".t" << threadNum << "_ops";
+
+    vector<LookupTask> lookups(threadNum);
+    for (size_t i = 0; i < threadNum; ++i){
+      lookups[i].trie  = &trie;
+      lookups[i].q     = &q;
+      lookups[i].begin = i * q.hits.size() / threadNum;
+      lookups[i].num   = opNum / threadNum;
+    }
+    metrics.set("throughput.lookup" + suffix.str(), runThroughput(lookups));
+
+    for (int striped = 0; striped < 2; ++striped){
+      vector<UpdateTask> updates(threadNum);
+      for (size_t i = 0; i < threadNum; ++i){
+	updates[i].counts  = &counts;
+	updates[i].q       = &q;
+	updates[i].begin   = i * q.hits.size() / threadNum;
+	updates[i].num     = opNum / threadNum;
+	updates[i].striped = striped;
+      }
+      metrics.set((striped ? "throughput.striped_add" : "throughput.fetch_add") + suffix.str(),
+		  runThroughput(updates));
+    }
+    if (threadNum == maxThreadNum) break;
+  }
+}
+
+int runBench(const vector<string>& keys, const cmdline::parser& p, Metrics& metrics){
+  const string index = p.get<string>("index");
+  const size_t queryNum = p.get<int>("query");
+  size_t keyBytes = 0;
+  for (size_t i = 0; i < keys.size(); ++i){
+    keyBytes += keys[i].size();
+  }
+  metrics.set("keys", keys.size());
+  metrics.set("key_bytes", keyBytes);
+
+  // build from a copy since build() may reorder the list
+  vector<string> keyList(keys);
+  ux::Trie trie;
+  trie.setFilterBitsPerKey(p.get<int>("filter"));
+  trie.setCountIndex(p.exist("count"));
+  trie.setThreadNum(p.get<int>("thread"));
+  double start = nowSec();
+  trie.build(keyList, !p.exist("uncompress"));
+  metrics.set("build_sec", nowSec() - start);
+  vector<string>().swap(keyList);
+  metrics.set("index_bytes", trie.getAllocSize());
+  metrics.set("bits_per_key", keys.empty() ? 0 : trie.getAllocSize() * 8.0 / keys.size());
+
+  int err = 0;
+  start = nowSec();
+  if ((err = trie.save(index.c_str())) != ux::Trie::SUCCESS){
+    cerr << ux::Trie::what(err) << " " << index << endl;
+    return -1;
+  }
+  metrics.set("save_sec", nowSec() - start);
+
+  ux::Trie loaded;
+  start = nowSec();
+  if ((err = loaded.load(index.c_str())) != ux::Trie::SUCCESS){
+    cerr << ux::Trie::what(err) << " " << index << endl;
+    return -1;
+  }
+  metrics.set("load_sec", nowSec() - start);
+  loaded.clear();
+
+  ux::Trie mapped;
+  start = nowSec();
+  if ((err = mapped.map(index.c_str())) != ux::Trie::SUCCESS){
+    cerr << ux::Trie::what(err) << " " << index << endl;
+    return -1;
+  }
+  metrics.set("map_sec", nowSec() - start);
+  mapped.clear();
+  remove(index.c_str());
+
+  if (keys.empty()){
+    metrics.set("peak_rss_bytes", peakRSS());
+    return 0;
+  }
+
+  Queries q;
+  makeQueries(keys, queryNum, p.get<int>("seed"), q);
+  makeBatches(trie, p.get<int>("limit"), q);
+  size_t dummy = 0;
+  for (int op = 0; op < OP_NUM; ++op){
+    // counting without the index visits the whole subtree of a short prefix
+    if (op == OP_COUNT_PREFIX && !p.exist("count")) continue;
+    dummy += measureLatency(trie, q, (Operation)op, p.get<int>("limit"), metrics);
+  }
+  measureThroughput(trie, keys, q, max(p.get<int>("thread"), 1), queryNum * 10, metrics);
+  metrics.set("peak_rss_bytes", peakRSS());
+
+  if (dummy == 777){
+    cerr << "luckey" << endl;
+  }
+  return 0;
+}
+
+static bool endsWith(const string& s, const char* suffix){
+  const size_t len = strlen(suffix);
+  return s.size() >= len && s.compare(s.size() - len, len, suffix) == 0;
+}
+
+// metrics ending with _ops are better if larger, and the others are better if smaller.
+// the sizes of the key set and the maximum latencies, which are single samples, are not compared.
+int compareMetrics(const Metrics& current, const Metrics& base, double tolerance){
+  int regressionNum = 0;
+  const map<string, double>& values = current.values();
+  for (map<string, double>::const_iterator it = values.begin(); it != values.end(); ++it){
+    map<string, double>::const_iterator b = base.values().find(it->first);
+    if (b == base.values().end() || it->first == "keys" || it->first == "key_bytes" ||
+	endsWith(it->first, ".max_ns")) continue;
+    const bool higherIsBetter = endsWith(it->first, "_ops");
+    const double ratio = b->second > 0 ? it->second / b->second : 1;
+    const bool regressed = higherIsBetter ? (ratio < 1 - tolerance) : (ratio > 1 + tolerance);
+    fprintf(stderr, "%-32s %14.6g %14.6g %8.3f%s\n", it->first.c_str(), b->second, it->second,
+	    ratio, regressed ? "  REGRESSED" : "");
+    regressionNum += regressed;
+  }
+  fprintf(stderr, "%d regressions (tolerance %g%%)\n", regressionNum, tolerance * 100);
+  return regressionNum;
+}
+
+int main(int argc, char* argv[]){
+  cmdline::parser p;
+  p.add<string>("keylist",    'k', "key list to benchmark with, one key per line", false);
+  p.add<string>("generate",   'g', "generate keys of url, word, id or dna", false, "url");
+  p.add<int>   ("num",        'n', "the number of generated keys", false, 1000000);
+  p.add<int>   ("seed",       's', "seed of generated keys and queries", false, 1);
+  p.add<int>   ("query",      'q', "the number of queries for each operation", false, 100000);
+  p.add<int>   ("limit",      'l', "limit at commonPrefixSearch and predictiveSearch", false, 10);
+  p.add<int>   ("thread",     't', "the number of threads at build and the maximum at throughput", false, 1);
+  p.add<int>   ("filter",     'f', "bits per key of the Bloom filter for missing keys", false, 0);
+  p.add        ("count",      'x', "build the index for countPrefix");
+  p.add        ("uncompress", 'u', "tail is uncompressed");
+  p.add<string>("index",      'i', "temporary index file for save, load and map", false, "ux_bench.ind");
+  p.add<string>("output",     'o', "output JSON file (default: stdout)", false);
+  p.add<string>("compare",    'c', "JSON file of a previous result to compare with", false);
+  p.add<int>   ("repeat",     'R', "the number of runs. the median of each metric is reported", false, 3);
+  p.add<double>("tolerance",  'r', "relative change reported as a regression", false, 0.5);
+  p.add("help", 'h', "this message");
+  p.set_program_name("ux_bench");
+
+  if (!p.parse(argc, argv) || p.exist("help")){
+    cerr << p.usage() << endl;
+    return -1;
+  }
+
+  vector<string> keys;
+  map<string, string> info;
+  if (p.exist("keylist")){
+    if (readKeys(p.get<string>("keylist"), keys) == -1){
+      return -1;
+    }
+    info["dataset"] = Metrics::quote(p.get<string>("keylist"));
+  } else {
+    const string type = p.get<string>("generate");
+    generateKeys(type, p.get<int>("num"), p.get<int>("seed"), keys);
+    if (keys.empty()){
+      cerr << "unknown key type " << type << endl;
+      return -1;
+    }
+    info["dataset"] = Metrics::quote(type);
+  }
+  const int repeat = max(p.get<int>("repeat"), 1);
+  ostringstream threadNum;
+  threadNum << p.get<int>("thread");
+  info["threads"] = threadNum.str();
+  ostringstream repeatNum;
+  repeatNum << repeat;
+  info["repeat"] = repeatNum.str();
+
+  vector<Metrics> runs(repeat);
+  for (int r = 0; r < repeat; ++r){
+    if (runBench(keys, p, runs[r]) == -1){
+      return -1;
+    }
+  }
+  Metrics metrics;
+  metrics.setMedians(runs);
+
+  if (p.exist("output")){
+    ofstream ofs(p.get<string>("output").c_str());
+    if (!ofs){
+      cerr << "cannot open " << p.get<string>("output") << endl;
+      return -1;
+    }
+    metrics.writeJSON(ofs, info);
+  } else {
+    metrics.writeJSON(cout, info);
+  }
+
+  if (p.exist("compare")){
+    Metrics base;
+    if (base.readJSON(p.get<string>("compare")) == -1){
+      return -1;
+    }
+    return compareMetrics(metrics, base, p.get<double>("tolerance")) == 0 ? 0 : 1;
+  }
+  return 0;
+}
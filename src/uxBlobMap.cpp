@@ -0,0 +1,173 @@
+/* 
+ *  Copyright (c) 2010 Daisuke Okanohara
+ * 
+ *   Redistribution and use in source and binary forms, with or without
+ *   modification, are permitted provided that the following conditions
+ *   are met:
+ * 
+ *   1. Redistributions of source code must retain the above Copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *   2. Redistributions in binary form must reproduce the above Copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ *   3. Neither the name of the authors nor the names of its contributors
+ *      may be used to endorse or promote products derived from this
+ *      software without specific prior written permission.
+ */
+
+#include "uxBlobMap.hpp"
+
+using namespace std;
+
+namespace ux{
+
+BlobMap::BlobMap() : mmap_(NULL){
+}
+
+BlobMap::~BlobMap(){
+  delete mmap_;
+}
+
+void BlobMap::setFilterBitsPerKey(const size_t bitsPerKey){
+  trie_.setFilterBitsPerKey(bitsPerKey);
+}
+
+void BlobMap::build(const std::map<string, string>& m){
+  vector<pair<string, string> > kvs(m.begin(), m.end());
+  build(kvs);
+}
+
+void BlobMap::build(const vector<pair<string, string> >& kvs){
+  vector<id_t> ids;
+  clear();
+  trie_.buildKeys(kvs.begin(), kvs.end(), ids);
+  vector<const string*> values(trie_.size());
+  for (size_t i = 0; i < kvs.size(); ++i){
+    values[ids[i]] = &kvs[i].second;
+  }
+  buildValues(values);
+}
+
+void BlobMap::buildValues(const vector<const string*>& values){
+  vector<char> blob;
+  vector<uint64_t> offsets(1, 0);
+  for (size_t i = 0; i < values.size(); ++i){
+    blob.insert(blob.end(), values[i]->begin(), values[i]->end());
+    offsets.push_back(blob.size());
+  }
+  offsets_.build(offsets);
+  blob_.clear();
+  if (!blob.empty()){
+    blob_.append(&blob[0], blob.size());
+  }
+}
+
+void BlobMap::getValue(const id_t id, const char*& value, size_t& valueLen) const {
+  const uint64_t begin = offsets_[id];
+  value    = blob_.data() + begin;
+  valueLen = offsets_[id + 1] - begin;
+}
+
+int BlobMap::get(const char* str, const size_t len, const char*& value, size_t& valueLen) const {
+  const id_t id = trie_.lookup(str, len);
+  if (id == NOTFOUND){
+    return -1;
+  }
+  getValue(id, value, valueLen);
+  return 0;
+}
+
+int BlobMap::get(const char* str, const size_t len, string& value) const {
+  const char* p = NULL;
+  size_t valueLen = 0;
+  if (get(str, len, p, valueLen) != 0){
+    return -1;
+  }
+  value.assign(p, valueLen);
+  return 0;
+}
+
+int BlobMap::prefixSearch(const char* str, const size_t len, size_t& retLen,
+			  const char*& value, size_t& valueLen) const {
+  const id_t id = trie_.prefixSearch(str, len, retLen);
+  if (id == NOTFOUND){
+    return -1;
+  }
+  getValue(id, value, valueLen);
+  return 0;
+}
+
+const Trie& BlobMap::trie() const {
+  return trie_;
+}
+
+void BlobMap::decodeKey(const id_t id, string& ret) const {
+  trie_.decodeKey(id, ret);
+}
+
+int BlobMap::save(ostream& os) const {
+  if (trie_.save(os) != 0){
+    return -1;
+  }
+  offsets_.save(os);
+  blob_.save(os);
+  return os ? 0 : -1;
+}
+
+int BlobMap::load(istream& is){
+  clear();
+  if (trie_.load(is) != 0 || !offsets_.load(is) || !blob_.load(is) || 
+      !offsets_.isValid(trie_.size(), blob_.size())){
+    clear();
+    return -1;
+  }
+  return 0;
+}
+
+int BlobMap::save(const char* fileName) const {
+  return saveFile(*this, fileName);
+}
+
+int BlobMap::load(const char* fileName){
+  return loadFile(*this, fileName);
+}
+
+int BlobMap::view(const void* ptr, const size_t size){
+  clear();
+  size_t used = 0;
+  if (trie_.view(ptr, size, &used) != 0){
+    return -1;
+  }
+  const char* p   = static_cast<const char*>(ptr) + used;
+  const char* end = static_cast<const char*>(ptr) + size;
+  if (!offsets_.view(p, end) || !blob_.view(p, end) || 
+      !offsets_.isValid(trie_.size(), blob_.size())){
+    clear();
+    return -1;
+  }
+  return 0;
+}
+
+int BlobMap::map(const char* fileName){
+  return mapFile(*this, fileName, mmap_);
+}
+
+size_t BlobMap::size() const {
+  return trie_.size();
+}
+
+size_t BlobMap::getAllocSize() const {
+  return blob_.size() + offsets_.getAllocSize();
+}
+
+void BlobMap::clear(){
+  trie_.clear();
+  offsets_.clear();
+  blob_.clear();
+  delete mmap_;
+  mmap_ = NULL;
+}
+
+}
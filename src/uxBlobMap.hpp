@@ -0,0 +1,197 @@
+/* 
+ *  Copyright (c) 2010 Daisuke Okanohara
+ * 
+ *   Redistribution and use in source and binary forms, with or without
+ *   modification, are permitted provided that the following conditions
+ *   are met:
+ * 
+ *   1. Redistributions of source code must retain the above Copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *   2. Redistributions in binary form must reproduce the above Copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ *   3. Neither the name of the authors nor the names of its contributors
+ *      may be used to endorse or promote products derived from this
+ *      software without specific prior written permission.
+ */
+
+#ifndef UX_BLOB_MAP_HPP__
+#define UX_BLOB_MAP_HPP__
+
+#include <string>
+#include <vector>
+#include <map>
+#include <iostream>
+#include "uxTrie.hpp"
+#include "uxArray.hpp"
+#include "uxMapUtil.hpp"
+
+namespace ux{
+
+/**
+ * Succinct map from keys to variable-length byte strings.
+ * Values are concatenated in one blob in the order of key IDs, and the value of 
+ * the i-th key is blob[offsets[i], offsets[i+1]). Offsets are packed in 
+ * lg2(the blob size) bits each, so that a value is found in O(1) without a select.
+ * Values are returned as pointers into the blob without copying.
+ */
+class BlobMap {
+public:
+  /**
+   * Constructor
+   */
+  BlobMap();
+
+  /**
+   * Destructor
+   */
+  ~BlobMap();
+
+  /**
+   * Use a Bloom filter to reject missing keys in get()
+   * @param bitsPerKey The number of filter bits per key, or 0 to disable the filter
+   */
+  void setFilterBitsPerKey(size_t bitsPerKey);
+
+  /**
+   * Build a map from std::map
+   * @param m A std::map as an input
+   */
+  void build(const std::map<std::string, std::string>& m);
+
+  /**
+   * Build a map from the vector of the pair of a key and a value.
+   * If a key appears more than once, the last value is used.
+   * @param kvs A vector of the pair of a key and a value
+   */
+  void build(const std::vector<std::pair<std::string, std::string> >& kvs);
+
+  /**
+   * Get a value for a given key
+   * @param str the key
+   * @param len the length of str
+   * @param value The beginning of the value in the map, valid until the map is changed
+   * @param valueLen The length of the value
+   * @return 0 on success and -1 if not found
+   */
+  int get(const char* str, size_t len, const char*& value, size_t& valueLen) const;
+
+  /**
+   * Get a value for a given key by copying it
+   * @param str the key
+   * @param len the length of str
+   * @param value The value
+   * @return 0 on success and -1 if not found
+   */
+  int get(const char* str, size_t len, std::string& value) const;
+
+  /**
+   * Return the value of the longest key that matches the prefix of the query
+   * @param str the query
+   * @param len the length of the query
+   * @param retLen The length of the matched key
+   * @param value The beginning of the value in the map
+   * @param valueLen The length of the value
+   * @return 0 if found and -1 if not found
+   */
+  int prefixSearch(const char* str, size_t len, size_t& retLen, 
+		   const char*& value, size_t& valueLen) const;
+
+  /**
+   * Get the value of a key ID given by the trie
+   * @param id The ID of the key
+   * @param value The beginning of the value in the map
+   * @param valueLen The length of the value
+   */
+  void getValue(id_t id, const char*& value, size_t& valueLen) const;
+
+  /**
+   * @return The trie of the keys
+   */
+  const Trie& trie() const;
+
+  /**
+   * Return the key for the given ID
+   * @param id The ID of the key
+   * @param ret The key for the given ID or empty if such ID does not exist
+   */ 
+  void decodeKey(id_t id, std::string& ret) const;
+
+  /**
+   * Save the map in ostream
+   * @param os The ostream as an output 
+   * @return 0 on success, -1 on failure
+   */
+  int save(std::ostream& os) const;
+
+  /**
+   * Load the map from istream
+   * @param is The istream as an input
+   * @return 0 on success, -1 on failure
+   */
+  int load(std::istream& is);
+
+  /**
+   * Save the map in a file
+   * @param fileName The file name
+   * @return 0 on success, -1 on failure
+   */
+  int save(const char* fileName) const;
+
+  /**
+   * Load the map from a file
+   * @param fileName The file name
+   * @return 0 on success, -1 on failure
+   */
+  int load(const char* fileName);
+
+  /**
+   * Use an image saved by save() in memory without copying it.
+   * The image must be aligned to 8 bytes, and must outlive the map.
+   * @param ptr The beginning of the image
+   * @param size The size of the image in bytes
+   * @return 0 on success, -1 on failure
+   */
+  int view(const void* ptr, size_t size);
+
+  /**
+   * Map a file saved by save() into memory, and use it without reading the whole file.
+   * @param fileName The file name
+   * @return 0 on success, -1 on failure
+   */
+  int map(const char* fileName);
+
+  /**
+   * Get the number of keys 
+   * @return the number of keys
+   */
+  size_t size() const;
+
+  /**
+   * Return the size of the values in bytes
+   * @return The size of the blob and the offsets
+   */
+  size_t getAllocSize() const;
+
+  /**
+   * Clear the internal state
+   */
+  void clear();
+
+private:
+  BlobMap(const BlobMap&);
+  BlobMap& operator=(const BlobMap&);
+
+  void buildValues(const std::vector<const std::string*>& values);
+
+  Trie trie_;
+  PackedOffsets offsets_;
+  Array<char> blob_;
+  MMapFile* mmap_;
+};
+
+}
+
+#endif // UX_BLOB_MAP_HPP__
@@ -0,0 +1,583 @@
+/* 
+ *  Copyright (c) 2010 Daisuke Okanohara
+ * 
+ *   Redistribution and use in source and binary forms, with or without
+ *   modification, are permitted provided that the following conditions
+ *   are met:
+ * 
+ *   1. Redistributions of source code must retain the above Copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *   2. Redistributions in binary form must reproduce the above Copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ *   3. Neither the name of the authors nor the names of its contributors
+ *      may be used to endorse or promote products derived from this
+ *      software without specific prior written permission.
+ */
+
+#include <cstring>
+#include <cassert>
+#include <algorithm>
+#include <queue>
+#include "uxBuilder.hpp"
+#include "uxSort.hpp"
+
+using namespace std;
+
+namespace ux{
+
+static const size_t HASH_CHUNK = 1 << 16; // the number of spilled hashes read at once
+
+static bool writeU64(FILE* fp, const uint64_t x){
+  return fwrite(&x, sizeof(x), 1, fp) == 1;
+}
+
+static bool readU64(FILE* fp, uint64_t& x){
+  return fread(&x, sizeof(x), 1, fp) == 1;
+}
+
+static bool writeBytes(FILE* fp, const void* p, const size_t size){
+  return size == 0 || fwrite(p, 1, size, fp) == size;
+}
+
+static bool readBytes(FILE* fp, void* p, const size_t size){
+  return size == 0 || fread(p, 1, size, fp) == size;
+}
+
+static bool writeBits(FILE* fp, const BitVec& bv){
+  vector<uint64_t> blocks((bv.size() + S_BLOCK - 1) / S_BLOCK);
+  for (size_t i = 0; i < blocks.size(); ++i){
+    blocks[i] = bv.lookupBlock(i);
+  }
+  return writeU64(fp, bv.size()) && 
+    writeBytes(fp, blocks.empty() ? NULL : &blocks[0], blocks.size() * sizeof(blocks[0]));
+}
+
+static bool readBits(FILE* fp, BitVec& bv){
+  uint64_t size = 0;
+  if (!readU64(fp, size)) return false;
+  vector<uint64_t> blocks((size + S_BLOCK - 1) / S_BLOCK);
+  if (!readBytes(fp, blocks.empty() ? NULL : &blocks[0], blocks.size() * sizeof(blocks[0]))){
+    return false;
+  }
+  for (uint64_t i = 0; i + S_BLOCK <= size; i += S_BLOCK){
+    bv.push_back_with_len(blocks[i / S_BLOCK], S_BLOCK);
+  }
+  if (size % S_BLOCK != 0){
+    bv.push_back_with_len(blocks.back(), size % S_BLOCK);
+  }
+  return true;
+}
+
+static bool readString(FILE* fp, string& str, const size_t size){
+  str.resize(size);
+  return readBytes(fp, str.empty() ? NULL : &str[0], size);
+}
+
+struct StreamBuilder::Level {
+  Level() : terminalNum(0), spill(NULL) {}
+  ~Level(){
+    if (spill) fclose(spill);
+  }
+  size_t bufferSize() const {
+    return (loud.size() + terminal.size() + tail.size()) / 8 + edges.size() + 
+      tailBuf.size() + tailLens.size() * sizeof(tailLens[0]);
+  }
+  bool write(FILE* fp) const {
+    return writeBits(fp, loud) && writeBits(fp, terminal) && writeBits(fp, tail) &&
+      writeU64(fp, edges.size()) && writeBytes(fp, edges.data(), edges.size()) &&
+      writeU64(fp, tailLens.size()) && 
+      writeBytes(fp, tailLens.empty() ? NULL : &tailLens[0], tailLens.size() * sizeof(tailLens[0])) &&
+      writeBytes(fp, tailBuf.data(), tailBuf.size());
+  }
+  // return 1 if a chunk is read, 0 at the end of the file, and -1 on failure
+  int read(FILE* fp){
+    uint64_t edgeNum = 0;
+    uint64_t tailNum = 0;
+    uint64_t tailSum = 0;
+    if (!readBits(fp, loud)) return 0;
+    if (!readBits(fp, terminal) || !readBits(fp, tail) || 
+	!readU64(fp, edgeNum) || !readString(fp, edges, edgeNum) ||
+	!readU64(fp, tailNum)){
+      return -1;
+    }
+    tailLens.resize(tailNum);
+    if (!readBytes(fp, tailLens.empty() ? NULL : &tailLens[0], tailNum * sizeof(tailLens[0]))){
+      return -1;
+    }
+    for (size_t i = 0; i < tailNum; ++i){
+      tailSum += tailLens[i];
+    }
+    return readString(fp, tailBuf, tailSum) ? 1 : -1;
+  }
+  void clear(){
+    loud.clear();
+    terminal.clear();
+    tail.clear();
+    string().swap(edges);
+    string().swap(tailBuf);
+    vector<uint64_t>().swap(tailLens);
+  }
+  BitVec loud;
+  BitVec terminal;
+  BitVec tail;
+  string edges;
+  string tailBuf;
+  vector<uint64_t> tailLens;
+  uint64_t terminalNum; // including the spilled ones
+  FILE* spill;
+};
+
+// The input of the tail trie, which is the reversed tails in the order of the tail IDs.
+// They are sorted in runs of a bounded size, which are spilled to temporary files, 
+// and the runs are merged into a StreamBuilder of the tail trie.
+class TailSorter {
+public:
+  TailSorter(const size_t memoryLimit, const size_t threadNum) : 
+    memoryLimit_(memoryLimit), threadNum_(threadNum), tailNum_(0) {
+    offsets_.push_back(0);
+  }
+
+  ~TailSorter(){
+    for (size_t i = 0; i < runs_.size(); ++i){
+      fclose(runs_[i]);
+    }
+  }
+
+  int add(const char* str, const size_t len){
+    buf_.append(str, len);
+    reverse(buf_.end() - len, buf_.end());
+    offsets_.push_back(buf_.size());
+    ++tailNum_;
+    if (memoryLimit_ > 0 && buf_.size() + offsets_.size() * RUN_BYTES_PER_TAIL > memoryLimit_){
+      return spill();
+    }
+    return 0;
+  }
+
+  // ids[i] is the ID of the i-th tail in tailTrie
+  int build(Trie& tailTrie, const bool isTailUX, vector<id_t>& ids){
+    sortRun();
+    vector<uint32_t> ordinals(tailNum_); // the rank of the i-th tail in the distinct tails
+    StreamBuilder builder(tailTrie, isTailUX, memoryLimit_);
+    builder.trackIDs();
+    vector<Head> heads(runs_.size() + 1);
+    priority_queue<pair<Head*, size_t>, vector<pair<Head*, size_t> >, HeadGreater> queue;
+    for (size_t r = 0; r < heads.size(); ++r){
+      const int ret = next(r, heads[r]);
+      if (ret < 0) return Trie::FILE_READ_ERROR;
+      if (ret > 0) queue.push(make_pair(&heads[r], r));
+    }
+    string prev;
+    uint64_t distinctNum = 0;
+    while (!queue.empty()){
+      Head& head = *queue.top().first;
+      const size_t r = queue.top().second;
+      queue.pop();
+      if (distinctNum == 0 || head.key != prev){
+	int err = builder.add(head.key);
+	if (err != 0) return err;
+	prev.swap(head.key);
+	++distinctNum;
+      }
+      ordinals[head.index] = distinctNum - 1;
+      const int ret = next(r, head);
+      if (ret < 0) return Trie::FILE_READ_ERROR;
+      if (ret > 0) queue.push(make_pair(&head, r));
+    }
+    vector<id_t> distinctIDs;
+    int err = builder.finish(distinctIDs);
+    if (err != 0) return err;
+    ids.resize(tailNum_);
+    for (size_t i = 0; i < tailNum_; ++i){
+      ids[i] = distinctIDs[ordinals[i]];
+    }
+    return 0;
+  }
+
+private:
+  enum {
+    RUN_BYTES_PER_TAIL = sizeof(uint64_t) + sizeof(IndexedKey) + sizeof(uint32_t)
+  };
+
+  struct Head {
+    string key;
+    uint64_t index;
+  };
+
+  struct HeadGreater {
+    bool operator()(const pair<Head*, size_t>& x, const pair<Head*, size_t>& y) const {
+      const int c = x.first->key.compare(y.first->key);
+      return c > 0 || (c == 0 && x.second > y.second);
+    }
+  };
+
+  // sort the tails in memory. The first index of them is tailNum_ - keys_.size()
+  void sortRun(){
+    const size_t num = offsets_.size() - 1;
+    keys_.resize(num);
+    for (size_t i = 0; i < num; ++i){
+      keys_[i].key.str = buf_.data() + offsets_[i];
+      keys_[i].key.len = offsets_[i+1] - offsets_[i];
+      keys_[i].index   = tailNum_ - num + i;
+    }
+    vector<uint32_t> lcps;
+    radixSortKeys(keys_, lcps, threadNum_);
+    cursor_ = 0;
+  }
+
+  int spill(){
+    sortRun();
+    FILE* fp = tmpfile();
+    if (fp == NULL){
+      return Trie::FILE_OPEN_ERROR;
+    }
+    runs_.push_back(fp);
+    for (size_t i = 0; i < keys_.size(); ++i){
+      if (!writeU64(fp, keys_[i].index) || !writeU64(fp, keys_[i].key.len) ||
+	  !writeBytes(fp, keys_[i].key.str, keys_[i].key.len)){
+	return Trie::FILE_WRITE_ERROR;
+      }
+    }
+    rewind(fp);
+    vector<IndexedKey>().swap(keys_);
+    string().swap(buf_);
+    vector<uint64_t>(1, 0).swap(offsets_);
+    return 0;
+  }
+
+  // read the next tail of the r-th run, where the last run is the one in memory.
+  // return 1 if a tail is read, 0 at the end of the run, and -1 on failure
+  int next(const size_t r, Head& head){
+    if (r == runs_.size()){
+      if (cursor_ == keys_.size()) return 0;
+      const IndexedKey& key = keys_[cursor_++];
+      head.key.assign(key.key.str, key.key.len);
+      head.index = key.index;
+      return 1;
+    }
+    uint64_t len = 0;
+    if (!readU64(runs_[r], head.index)) return 0;
+    return (readU64(runs_[r], len) && head.index < tailNum_ && 
+	    readString(runs_[r], head.key, len)) ? 1 : -1;
+  }
+
+  size_t memoryLimit_;
+  size_t threadNum_;
+  uint64_t tailNum_;
+  string buf_;
+  vector<uint64_t> offsets_;
+  vector<IndexedKey> keys_;
+  size_t cursor_;
+  vector<FILE*> runs_;
+};
+
+StreamBuilder::StreamBuilder(Trie& trie, const bool isTailUX, const size_t memoryLimit) :
+  trie_(trie), isTailUX_(isTailUX), memoryLimit_(memoryLimit), bufferSize_(0),
+  keyNum_(0), err_(0), isTrackingIDs_(false), hashSpill_(NULL) {
+}
+
+void StreamBuilder::trackIDs(){
+  isTrackingIDs_ = true;
+}
+
+StreamBuilder::~StreamBuilder(){
+  for (size_t i = 0; i < levels_.size(); ++i){
+    delete levels_[i];
+  }
+  if (hashSpill_) fclose(hashSpill_);
+}
+
+int StreamBuilder::add(const string& key){
+  return add(key.c_str(), key.size());
+}
+
+int StreamBuilder::add(istream& is){
+  for (string key; getline(is, key); ){
+    if (key.size() > 0 &&
+	key[key.size()-1] == '\r'){
+      key.erase(key.size()-1);
+    }
+    int err = add(key);
+    if (err != 0) return err;
+  }
+  return 0;
+}
+
+int StreamBuilder::add(const char* str, const size_t len){
+  if (err_) return err_;
+  if (keyNum_ == 0){
+    prev_.assign(str, len);
+  } else {
+    // lcp with the previous key
+    const size_t minLen = min(len, prev_.size());
+    size_t lcp = 0;
+    while (lcp < minLen && prev_[lcp] == str[lcp]) ++lcp;
+    if (lcp == len){
+      if (len == prev_.size()) return 0; // duplicated
+      return err_ = Trie::ORDER_ERROR;
+    }
+    if (lcp < prev_.size() && (uint8_t)prev_[lcp] > (uint8_t)str[lcp]){
+      return err_ = Trie::ORDER_ERROR;
+    }
+
+    const size_t depth = open_.size(); // the depth of the node only with prev_
+    if (depth > lcp){
+      finalizeSingle(prev_, depth);
+      while (open_.size() > lcp + 1){
+	finalizeOpen(open_.size() - 1);
+	open_.pop_back();
+      }
+    } else {
+      // the node only with prev_ now has the new key, too
+      OpenNode node;
+      for (size_t d = depth; d < lcp; ++d){
+	node.terminal = false;
+	node.key      = 0;
+	node.edges    = prev_[d];
+	open_.push_back(node);
+      }
+      node.terminal = (prev_.size() == lcp);
+      node.key      = keyNum_ - 1;
+      node.edges.clear();
+      if (!node.terminal){
+	node.edges += prev_[lcp];
+	finalizeSingle(prev_, lcp + 1);
+      }
+      open_.push_back(node);
+    }
+    open_.back().edges += str[lcp];
+    prev_.assign(str, len);
+  }
+  ++keyNum_;
+  if (isTrackingIDs_){
+    keyDepths_.push_back(0);
+    keyRanks_.push_back(0);
+  }
+
+  if (trie_.filterBitsPerKey_ > 0){
+    hashes_.push_back(hash64(str, len));
+  }
+  if (memoryLimit_ > 0 && keyNum_ % 1024 == 0){
+    return err_ = checkMemory();
+  }
+  return 0;
+}
+
+StreamBuilder::Level& StreamBuilder::getLevel(const size_t depth){
+  while (levels_.size() <= depth){
+    levels_.push_back(new Level);
+  }
+  return *levels_[depth];
+}
+
+void StreamBuilder::pushTerminal(const size_t depth, const uint64_t key){
+  Level& level = getLevel(depth);
+  level.terminal.push_back(1);
+  if (isTrackingIDs_){
+    keyDepths_[key] = depth;
+    keyRanks_[key]  = level.terminalNum;
+  }
+  ++level.terminalNum;
+}
+
+void StreamBuilder::finalizeSingle(const string& key, const size_t depth){
+  // key is the last added one
+  Level& level = getLevel(depth);
+  if (depth + 1 < key.size()){
+    level.loud.push_back(1);
+    pushTerminal(depth, keyNum_ - 1);
+    level.tail.push_back(1);
+    level.tailBuf.append(key, depth, key.size() - depth);
+    level.tailLens.push_back(key.size() - depth);
+    return;
+  }
+  level.tail.push_back(0);
+  if (depth == key.size()){
+    pushTerminal(depth, keyNum_ - 1);
+    level.loud.push_back(1);
+    return;
+  }
+  level.terminal.push_back(0);
+  level.edges += key[depth];
+  level.loud.push_back(0);
+  level.loud.push_back(1);
+
+  Level& child = getLevel(depth + 1);
+  child.tail.push_back(0);
+  pushTerminal(depth + 1, keyNum_ - 1);
+  child.loud.push_back(1);
+}
+
+void StreamBuilder::finalizeOpen(const size_t depth){
+  Level& level = getLevel(depth);
+  const OpenNode& node = open_[depth];
+  level.tail.push_back(0);
+  if (node.terminal){
+    pushTerminal(depth, node.key);
+  } else {
+    level.terminal.push_back(0);
+  }
+  level.edges += node.edges;
+  for (size_t i = 0; i < node.edges.size(); ++i){
+    level.loud.push_back(0);
+  }
+  level.loud.push_back(1);
+}
+
+int StreamBuilder::checkMemory(){
+  size_t bufferSize = hashes_.size() * sizeof(hashes_[0]);
+  for (size_t i = 0; i < levels_.size(); ++i){
+    bufferSize += levels_[i]->bufferSize();
+  }
+  if (bufferSize <= memoryLimit_) return 0;
+
+  for (size_t i = 0; i < levels_.size(); ++i){
+    Level& level = *levels_[i];
+    if (level.spill == NULL && (level.spill = tmpfile()) == NULL){
+      return Trie::FILE_OPEN_ERROR;
+    }
+    if (!level.write(level.spill)){
+      return Trie::FILE_WRITE_ERROR;
+    }
+    level.clear();
+  }
+
+  if (hashes_.size() > 0){
+    if (hashSpill_ == NULL && (hashSpill_ = tmpfile()) == NULL){
+      return Trie::FILE_OPEN_ERROR;
+    }
+    if (!writeBytes(hashSpill_, &hashes_[0], hashes_.size() * sizeof(hashes_[0]))){
+      return Trie::FILE_WRITE_ERROR;
+    }
+    vector<uint64_t>().swap(hashes_);
+  }
+  return 0;
+}
+
+int StreamBuilder::finish(){
+  return finish(NULL);
+}
+
+int StreamBuilder::finish(vector<id_t>& ids){
+  return finish(&ids);
+}
+
+int StreamBuilder::finish(vector<id_t>* ids){
+  if (err_) return err_;
+  trie_.clear();
+  if (keyNum_ > 0){
+    finalizeSingle(prev_, open_.size());
+    while (!open_.empty()){
+      finalizeOpen(open_.size() - 1);
+      open_.pop_back();
+    }
+  }
+
+  // the levels are read one chunk at a time. Only the trie itself and the input of 
+  // the tail trie within the memory limit are kept in memory.
+  BitVec loudBV;
+  BitVec terminalBV;
+  BitVec tailBV;
+  TailSorter tailSorter(memoryLimit_, trie_.threadNum_);
+  if (!isTailUX_){
+    trie_.tailOffsets_.push_back(0);
+  }
+  loudBV.push_back(0); // super root
+  loudBV.push_back(1);
+  // the IDs of the terminals in each level start from levelIDs[i]
+  vector<uint64_t> levelIDs(levels_.size() + 1, 0);
+  for (size_t i = 0; i < levels_.size(); ++i){
+    Level& level = *levels_[i];
+    levelIDs[i+1] = levelIDs[i] + level.terminalNum;
+    if (level.spill){
+      rewind(level.spill);
+    }
+    // the spilled chunks come first, and then the one in memory
+    for (bool isLast = false; !isLast; ){
+      Level spilled;
+      Level* chunk = &level;
+      if (level.spill){
+	const int ret = spilled.read(level.spill);
+	if (ret < 0) return err_ = Trie::FILE_READ_ERROR;
+	if (ret > 0) chunk = &spilled;
+      }
+      isLast = (chunk == &level);
+      loudBV.append(chunk->loud);
+      terminalBV.append(chunk->terminal);
+      tailBV.append(chunk->tail);
+      trie_.edges_.append((const uint8_t*)chunk->edges.data(), chunk->edges.size());
+      const char* tail = chunk->tailBuf.data();
+      for (size_t j = 0; j < chunk->tailLens.size(); tail += chunk->tailLens[j++]){
+	if (isTailUX_){
+	  int err = tailSorter.add(tail, chunk->tailLens[j]);
+	  if (err != 0) return err_ = err;
+	} else {
+	  trie_.tails_.append(tail, chunk->tailLens[j]);
+	  trie_.tailOffsets_.push_back(trie_.tails_.size());
+	}
+      }
+      chunk->clear();
+    }
+    delete levels_[i];
+    levels_[i] = NULL;
+  }
+  levels_.clear();
+
+  if (trie_.filterBitsPerKey_ > 0){
+    trie_.filter_.init(keyNum_, trie_.filterBitsPerKey_);
+    if (hashSpill_){
+      vector<uint64_t> hashes(HASH_CHUNK);
+      rewind(hashSpill_);
+      for (size_t num; (num = fread(&hashes[0], sizeof(hashes[0]), hashes.size(), hashSpill_)) > 0; ){
+	for (size_t i = 0; i < num; ++i){
+	  trie_.filter_.add(hashes[i]);
+	}
+      }
+      if (ferror(hashSpill_)){
+	return err_ = Trie::FILE_READ_ERROR;
+      }
+    }
+    for (size_t i = 0; i < hashes_.size(); ++i){
+      trie_.filter_.add(hashes_[i]);
+    }
+    vector<uint64_t>().swap(hashes_);
+  }
+
+  if (ids){
+    ids->resize(keyDepths_.size());
+    for (size_t i = 0; i < keyDepths_.size(); ++i){
+      (*ids)[i] = levelIDs[keyDepths_[i]] + keyRanks_[i];
+    }
+  }
+  trie_.keyNum_ = keyNum_;
+  if (isTailUX_){
+    Trie* tailTrie = new Trie;
+    trie_.vtailux_ = tailTrie;
+    tailTrie->setThreadNum(trie_.threadNum_);
+    tailTrie->setTailLevel(trie_.tailLevel_ - 1);
+    vector<id_t> tailIDs;
+    int err = tailSorter.build(*tailTrie, trie_.tailLevel_ > 1, tailIDs);
+    if (err != 0){
+      trie_.clear();
+      return err_ = err;
+    }
+    if (trie_.tailLevel_ > 1){
+      tailTrie->shrinkTails();
+    }
+    trie_.tailIDLen_ = lg2(tailTrie->size());
+    for (size_t i = 0; i < tailIDs.size(); ++i){
+      trie_.tailIDs_.push_back_with_len(tailIDs[i], trie_.tailIDLen_);
+    }
+  }
+  trie_.finishBuild(loudBV, terminalBV, tailBV, NULL, isTailUX_);
+  return 0;
+}
+
+size_t StreamBuilder::size() const {
+  return keyNum_;
+}
+
+}
@@ -0,0 +1,144 @@
+/* 
+ *  Copyright (c) 2010 Daisuke Okanohara
+ * 
+ *   Redistribution and use in source and binary forms, with or without
+ *   modification, are permitted provided that the following conditions
+ *   are met:
+ * 
+ *   1. Redistributions of source code must retain the above Copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *   2. Redistributions in binary form must reproduce the above Copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ *   3. Neither the name of the authors nor the names of its contributors
+ *      may be used to endorse or promote products derived from this
+ *      software without specific prior written permission.
+ */
+
+#ifndef UX_BUILDER_HPP__
+#define UX_BUILDER_HPP__
+
+#include <string>
+#include <vector>
+#include <iostream>
+#include <cstdio>
+#include <stdint.h>
+#include "uxTrie.hpp"
+
+namespace ux{
+
+/**
+ * Build a Trie from keys given in the lexicographic order one by one.
+ * Only the path of the last key is kept as the working state, and the 
+ * bits, edges and tails of each depth are spilled to temporary files 
+ * when their buffers exceed the memory limit.
+ * At finish(), the depths are read back one chunk at a time, and the tails
+ * are sorted for the tail trie in runs within the memory limit, which are
+ * merged from temporary files. So the memory is bounded by the trie itself, 
+ * the limit, and about 20 bytes per tail for the IDs of the tails.
+ * The result is identical to the one by Trie::build().
+ */
+class StreamBuilder {
+public:
+  /**
+   * Constructor
+   * @param trie The trie to be built. Its filter and thread settings are used.
+   * @param isTailUX use tail compression. 
+   * @param memoryLimit The maximum size of the buffers in bytes, or 0 for no limit
+   */
+  StreamBuilder(Trie& trie, bool isTailUX = true, size_t memoryLimit = 0);
+
+  /**
+   * Destructor
+   */
+  ~StreamBuilder();
+
+  /**
+   * Keep the positions of keys so that finish(ids) can return their IDs. 
+   * This costs 12 bytes per key, and must be called before the first add().
+   */
+  void trackIDs();
+
+  /**
+   * Add a key. Keys must be added in the lexicographic order (as unsigned bytes).
+   * A key equal to the previous one is ignored.
+   * @param str The key
+   * @param len The length of the key
+   * @return 0 on success, Trie::ORDER_ERROR if the key is smaller than 
+   *         the previous one, or Trie::FILE_WRITE_ERROR if spilling failed
+   */
+  int add(const char* str, size_t len);
+
+  /**
+   * Add a key.
+   * @param key The key
+   * @return 0 on success, or an error code of Trie
+   */
+  int add(const std::string& key);
+
+  /**
+   * Add all keys in the stream, one key per line
+   * @param is The input stream
+   * @return 0 on success, or an error code of Trie
+   */
+  int add(std::istream& is);
+
+  /**
+   * Build the trie from the added keys
+   * @return 0 on success, or an error code of Trie
+   */
+  int finish();
+
+  /**
+   * Build the trie from the added keys, and return their IDs. trackIDs() must be called before.
+   * @param ids ids[i] is the ID of the i-th distinct key added
+   * @return 0 on success, or an error code of Trie
+   */
+  int finish(std::vector<id_t>& ids);
+
+  /**
+   * Get the number of distinct keys added so far
+   * @return The number of keys
+   */
+  size_t size() const;
+
+private:
+  struct Level;
+  struct OpenNode {
+    bool terminal;
+    uint64_t key; // the key ending at this node if terminal
+    std::string edges;
+  };
+
+  Level& getLevel(size_t depth);
+  int finish(std::vector<id_t>* ids);
+  void pushTerminal(size_t depth, uint64_t key);
+  void finalizeSingle(const std::string& key, size_t depth);
+  void finalizeOpen(size_t depth);
+  int checkMemory();
+
+  Trie& trie_;
+  bool isTailUX_;
+  size_t memoryLimit_;
+  size_t bufferSize_;
+  size_t keyNum_;
+  int err_;
+  bool isTrackingIDs_;
+
+  std::string prev_;
+  std::vector<OpenNode> open_;
+  std::vector<Level*> levels_;
+  std::vector<uint64_t> hashes_;
+  std::vector<uint32_t> keyDepths_;
+  std::vector<uint64_t> keyRanks_;
+  FILE* hashSpill_;
+
+  StreamBuilder(const StreamBuilder&);
+  StreamBuilder& operator=(const StreamBuilder&);
+};
+
+}
+
+#endif // UX_BUILDER_HPP__
@@ -0,0 +1,326 @@
+/* 
+ *  Copyright (c) 2010 Daisuke Okanohara
+ * 
+ *   Redistribution and use in source and binary forms, with or without
+ *   modification, are permitted provided that the following conditions
+ *   are met:
+ * 
+ *   1. Redistributions of source code must retain the above Copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *   2. Redistributions in binary form must reproduce the above Copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ *   3. Neither the name of the authors nor the names of its contributors
+ *      may be used to endorse or promote products derived from this
+ *      software without specific prior written permission.
+ */
+
+#include "uxDynamic.hpp"
+#include "uxBuilder.hpp"
+
+using namespace std;
+
+namespace ux{
+
+// Visit the keys of base (ids are in the lexicographic order) except the erased ones,
+// merged with overlay, in the lexicographic order. overlay overrides base.
+// visitor.visit(key) returns 0 to continue.
+template <class Visitor>
+static int mergeLayers(const Trie& base, const vector<id_t>& ids, const vector<bool>& erased,
+		       const map<string, bool>& overlay, Visitor& visitor){
+  map<string, bool>::const_iterator it = overlay.begin();
+  string key;
+  size_t i = 0;
+  if (i < ids.size()) base.decodeKey(ids[i], key);
+  for (;;){
+    const bool hasBase = (i < ids.size());
+    const bool hasOverlay = (it != overlay.end());
+    if (!hasBase && !hasOverlay) break;
+
+    int err = 0;
+    if (!hasOverlay || (hasBase && key < it->first)){
+      if (!erased[ids[i]]) err = visitor.visit(key);
+      if (++i < ids.size()) base.decodeKey(ids[i], key);
+    } else {
+      if (it->second) err = visitor.visit(it->first);
+      if (hasBase && key == it->first){
+	if (++i < ids.size()) base.decodeKey(ids[i], key);
+      }
+      ++it;
+    }
+    if (err != 0) return err;
+  }
+  return 0;
+}
+
+struct BuilderVisitor{
+  StreamBuilder* builder;
+  int visit(const string& key){
+    return builder->add(key);
+  }
+};
+
+struct CollectVisitor{
+  vector<string>* rets;
+  size_t limit;
+  int visit(const string& key){
+    rets->push_back(key);
+    return (rets->size() >= limit) ? 1 : 0;
+  }
+};
+
+static bool startsWith(const string& key, const char* str, const size_t len){
+  return key.size() >= len && key.compare(0, len, str, len) == 0;
+}
+
+DynamicTrie::DynamicTrie(const bool isTailUX) : base_(new Trie), erasedNum_(0), keyNum_(0), 
+  isTailUX_(isTailUX), memoryLimit_(0), merging_(false), threadStarted_(false), mergeErr_(0) {
+  pthread_rwlock_init(&lock_, NULL);
+}
+
+DynamicTrie::~DynamicTrie(){
+  waitMerge();
+  delete base_;
+  pthread_rwlock_destroy(&lock_);
+}
+
+void DynamicTrie::build(vector<string>& keyList){
+  waitMerge();
+  pthread_rwlock_wrlock(&lock_);
+  base_->build(keyList, isTailUX_);
+  erased_.assign(base_->size(), false);
+  erasedNum_ = 0;
+  delta_.clear();
+  keyNum_ = base_->size();
+  pthread_rwlock_unlock(&lock_);
+}
+
+void DynamicTrie::setMemoryLimit(const size_t memoryLimit){
+  memoryLimit_ = memoryLimit;
+}
+
+bool DynamicTrie::findLocked(const string& key, id_t& baseID) const {
+  baseID = base_->lookup(key.c_str(), key.size());
+  Delta::const_iterator it = delta_.find(key);
+  if (it != delta_.end()) return it->second;
+  it = frozen_.find(key);
+  if (it != frozen_.end()) return it->second;
+  return baseID != NOTFOUND && !erased_[baseID];
+}
+
+bool DynamicTrie::insert(const char* str, const size_t len){
+  const string key(str, len);
+  pthread_rwlock_wrlock(&lock_);
+  id_t baseID = NOTFOUND;
+  const bool exists = findLocked(key, baseID);
+  if (!exists){
+    ++keyNum_;
+    // the base and its bitmap are read by the merge, so updates go to the delta during the merge.
+    // A tombstone from a failed merge may hide the base key instead of the bitmap.
+    if (!merging_ && baseID != NOTFOUND){
+      delta_.erase(key);
+      if (erased_[baseID]){
+	erased_[baseID] = false;
+	--erasedNum_;
+      }
+    } else {
+      delta_[key] = true;
+    }
+  }
+  pthread_rwlock_unlock(&lock_);
+  return !exists;
+}
+
+bool DynamicTrie::erase(const char* str, const size_t len){
+  const string key(str, len);
+  pthread_rwlock_wrlock(&lock_);
+  id_t baseID = NOTFOUND;
+  const bool exists = findLocked(key, baseID);
+  if (exists){
+    --keyNum_;
+    if (merging_){
+      delta_[key] = false;
+    } else if (baseID != NOTFOUND){
+      delta_.erase(key);
+      if (!erased_[baseID]){
+	erased_[baseID] = true;
+	++erasedNum_;
+      }
+    } else {
+      delta_.erase(key);
+    }
+  }
+  pthread_rwlock_unlock(&lock_);
+  return exists;
+}
+
+bool DynamicTrie::contains(const char* str, const size_t len) const {
+  const string key(str, len);
+  pthread_rwlock_rdlock(&lock_);
+  id_t baseID = NOTFOUND;
+  const bool exists = findLocked(key, baseID);
+  pthread_rwlock_unlock(&lock_);
+  return exists;
+}
+
+size_t DynamicTrie::commonPrefixSearch(const char* str, const size_t len, vector<string>& rets,
+				       const size_t limit) const {
+  rets.clear();
+  pthread_rwlock_rdlock(&lock_);
+  vector<id_t> ids;
+  base_->commonPrefixSearch(str, len, ids);
+  vector<bool> inBase(len + 1, false);
+  for (size_t i = 0; i < ids.size(); ++i){
+    if (!erased_[ids[i]]) inBase[base_->decodeKey(ids[i]).size()] = true;
+  }
+  for (size_t i = 0; i <= len && rets.size() < limit; ++i){
+    const string key(str, i);
+    bool exists = inBase[i];
+    Delta::const_iterator it = delta_.find(key);
+    if (it != delta_.end()){
+      exists = it->second;
+    } else if ((it = frozen_.find(key)) != frozen_.end()){
+      exists = it->second;
+    }
+    if (exists) rets.push_back(key);
+  }
+  pthread_rwlock_unlock(&lock_);
+  return rets.size();
+}
+
+size_t DynamicTrie::predictiveSearch(const char* str, const size_t len, vector<string>& rets,
+				     const size_t limit) const {
+  rets.clear();
+  if (limit == 0) return 0;
+  pthread_rwlock_rdlock(&lock_);
+  Delta overlay;
+  const string prefix(str, len);
+  for (Delta::const_iterator it = frozen_.lower_bound(prefix); 
+       it != frozen_.end() && startsWith(it->first, str, len); ++it){
+    overlay[it->first] = it->second;
+  }
+  for (Delta::const_iterator it = delta_.lower_bound(prefix); 
+       it != delta_.end() && startsWith(it->first, str, len); ++it){
+    overlay[it->first] = it->second;
+  }
+
+  // at least limit keys remain after removing the erased and the overridden keys
+  vector<id_t> ids;
+  base_->predictiveSearch(str, len, ids, limit + erasedNum_ + overlay.size());
+  CollectVisitor visitor;
+  visitor.rets  = &rets;
+  visitor.limit = limit;
+  mergeLayers(*base_, ids, erased_, overlay, visitor);
+  pthread_rwlock_unlock(&lock_);
+  return rets.size();
+}
+
+int DynamicTrie::beginMerge(){
+  pthread_rwlock_wrlock(&lock_);
+  if (merging_){
+    pthread_rwlock_unlock(&lock_);
+    return -1;
+  }
+  frozen_.swap(delta_);
+  merging_ = true;
+  pthread_rwlock_unlock(&lock_);
+  return 0;
+}
+
+int DynamicTrie::mergeFrozen(){
+  // base_, erased_ and frozen_ are not modified during the merge
+  Trie* next = new Trie;
+  StreamBuilder builder(*next, isTailUX_, memoryLimit_);
+  vector<id_t> ids;
+  base_->predictiveSearch("", 0, ids);
+  BuilderVisitor visitor;
+  visitor.builder = &builder;
+  int err = mergeLayers(*base_, ids, erased_, frozen_, visitor);
+  if (err == 0){
+    err = builder.finish();
+  }
+
+  pthread_rwlock_wrlock(&lock_);
+  if (err == 0){
+    delete base_;
+    base_ = next;
+    erased_.assign(base_->size(), false);
+    erasedNum_ = 0;
+    // the updates during the merge go to the bitmap if their keys are in the new base
+    for (Delta::iterator it = delta_.begin(); it != delta_.end(); ){
+      id_t id = base_->lookup(it->first.c_str(), it->first.size());
+      if (id != NOTFOUND){
+	if (!it->second){
+	  erased_[id] = true;
+	  ++erasedNum_;
+	}
+	delta_.erase(it++);
+      } else if (!it->second){
+	delta_.erase(it++);
+      } else {
+	++it;
+      }
+    }
+  } else {
+    delete next;
+    // keep the frozen updates under the newer ones
+    delta_.insert(frozen_.begin(), frozen_.end());
+  }
+  frozen_.clear();
+  merging_ = false;
+  pthread_rwlock_unlock(&lock_);
+  return err;
+}
+
+int DynamicTrie::merge(){
+  if (beginMerge() != 0){
+    return -1;
+  }
+  return mergeFrozen();
+}
+
+void* DynamicTrie::mergeMain(void* p){
+  DynamicTrie* trie = static_cast<DynamicTrie*>(p);
+  trie->mergeErr_ = trie->mergeFrozen();
+  return NULL;
+}
+
+int DynamicTrie::startMerge(){
+  if (beginMerge() != 0){
+    return -1;
+  }
+  if (pthread_create(&mergeThread_, NULL, mergeMain, this) != 0){
+    // merge in the caller's thread
+    mergeErr_ = mergeFrozen();
+    return mergeErr_;
+  }
+  threadStarted_ = true;
+  return 0;
+}
+
+int DynamicTrie::waitMerge(){
+  if (!threadStarted_){
+    return 0;
+  }
+  pthread_join(mergeThread_, NULL);
+  threadStarted_ = false;
+  return mergeErr_;
+}
+
+size_t DynamicTrie::size() const {
+  pthread_rwlock_rdlock(&lock_);
+  const size_t ret = keyNum_;
+  pthread_rwlock_unlock(&lock_);
+  return ret;
+}
+
+size_t DynamicTrie::deltaSize() const {
+  pthread_rwlock_rdlock(&lock_);
+  const size_t ret = delta_.size() + frozen_.size() + erasedNum_;
+  pthread_rwlock_unlock(&lock_);
+  return ret;
+}
+
+}
@@ -0,0 +1,181 @@
+/* 
+ *  Copyright (c) 2010 Daisuke Okanohara
+ * 
+ *   Redistribution and use in source and binary forms, with or without
+ *   modification, are permitted provided that the following conditions
+ *   are met:
+ * 
+ *   1. Redistributions of source code must retain the above Copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *   2. Redistributions in binary form must reproduce the above Copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ *   3. Neither the name of the authors nor the names of its contributors
+ *      may be used to endorse or promote products derived from this
+ *      software without specific prior written permission.
+ */
+
+#ifndef UX_DYNAMIC_HPP__
+#define UX_DYNAMIC_HPP__
+
+#include <string>
+#include <vector>
+#include <map>
+#include <pthread.h>
+#include "uxTrie.hpp"
+
+namespace ux{
+
+/**
+ * A key set that supports insertions and deletions over the static Trie.
+ * Keys are stored in three layers. A query checks them from the top, and the first 
+ * layer that knows the key decides the result.
+ *   delta:  a sorted map of the recent updates (an erased key is kept as a tombstone)
+ *   frozen: the delta being merged in the background
+ *   base:   a succinct Trie and a bitmap of its erased keys
+ * While no merge is running, updates of base keys only flip the bitmap.
+ *
+ * Read amplification: contains() costs one lookup in each layer. 
+ * commonPrefixSearch() looks up every prefix of the query in the delta and the frozen layers. 
+ * predictiveSearch() fetches limit + (the number of erased keys) keys from the base
+ * so that enough keys remain after the erased ones are removed, and decodes all of them.
+ * The cost of these layers is removed by merge(), which builds a new base by StreamBuilder.
+ *
+ * All methods are thread safe. Queries share a read lock and updates take a write lock.
+ * The merge holds the write lock only when it starts and when it swaps the base.
+ * IDs are not exposed since they change at each merge.
+ */
+class DynamicTrie {
+public:
+  /**
+   * Constructor
+   * @param isTailUX use tail compression in the base trie
+   */
+  DynamicTrie(bool isTailUX = true);
+
+  /**
+   * Destructor. Wait for the background merge.
+   */
+  ~DynamicTrie();
+
+  /**
+   * Build the base trie from keyList and clear all updates
+   * @param keyList input key list
+   */
+  void build(std::vector<std::string>& keyList);
+
+  /**
+   * Bound the memory of merge() by spilling its buffers to temporary files
+   * @param memoryLimit The memory limit of StreamBuilder in bytes, or 0 for no limit
+   */
+  void setMemoryLimit(size_t memoryLimit);
+
+  /**
+   * Insert a key
+   * @param str The key
+   * @param len The length of the key
+   * @return true if the key is newly inserted, false if it already exists
+   */
+  bool insert(const char* str, size_t len);
+
+  /**
+   * Erase a key
+   * @param str The key
+   * @param len The length of the key
+   * @return true if the key is erased, false if it does not exist
+   */
+  bool erase(const char* str, size_t len);
+
+  /**
+   * Check whether the key exists
+   * @param str The key
+   * @param len The length of the key
+   * @return true if the key exists
+   */
+  bool contains(const char* str, size_t len) const;
+
+  /** 
+   * Return the all keys that match the prefix of the query, in the order of their lengths
+   * @param str the query
+   * @param len the length of the query
+   * @param rets The matched keys
+   * @param limit The maximum number of matched keys
+   * @return The number of matched keys
+   */
+  size_t commonPrefixSearch(const char* str, size_t len, std::vector<std::string>& rets,
+			    size_t limit = LIMIT_DEFAULT) const;
+
+  /** 
+   * Return the all keys whose their prefixes match the query, in the lexicographic order
+   * @param str the query
+   * @param len the length of the query
+   * @param rets The matched keys
+   * @param limit The maximum number of matched keys
+   * @return The number of matched keys
+   */
+  size_t predictiveSearch(const char* str, size_t len, std::vector<std::string>& rets,
+			  size_t limit = LIMIT_DEFAULT) const;
+
+  /**
+   * Fold all updates into a new base trie in the caller's thread
+   * @return 0 on success, -1 if a merge is already running, or an error code of Trie
+   */
+  int merge();
+
+  /**
+   * Start merge() in a background thread. Queries and updates continue during the merge.
+   * @return 0 on success, or -1 if a merge is already running or the thread cannot start
+   */
+  int startMerge();
+
+  /**
+   * Wait for the background merge. 
+   * startMerge() and waitMerge() should be called from the same thread.
+   * @return The result of the merge, or 0 if no merge is running
+   */
+  int waitMerge();
+
+  /**
+   * Return the number of keys
+   * @return The number of keys
+   */
+  size_t size() const;
+
+  /**
+   * Return the number of updates not yet merged into the base trie
+   * @return The number of updated keys
+   */
+  size_t deltaSize() const;
+
+private:
+  // true for an inserted key, false for an erased key (tombstone)
+  typedef std::map<std::string, bool> Delta;
+
+  static void* mergeMain(void* p);
+  int beginMerge();
+  int mergeFrozen();
+  bool findLocked(const std::string& key, id_t& baseID) const;
+
+  Trie* base_;
+  std::vector<bool> erased_;
+  size_t erasedNum_;
+  Delta frozen_;
+  Delta delta_;
+  size_t keyNum_;
+  bool isTailUX_;
+  size_t memoryLimit_;
+  bool merging_;
+  bool threadStarted_;
+  int mergeErr_;
+  pthread_t mergeThread_;
+  mutable pthread_rwlock_t lock_;
+
+  DynamicTrie(const DynamicTrie&);
+  DynamicTrie& operator=(const DynamicTrie&);
+};
+
+}
+
+#endif // UX_DYNAMIC_HPP__
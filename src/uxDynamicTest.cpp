@@ -0,0 +1,170 @@
+/* 
+ *  Copyright (c) 2010 Daisuke Okanohara
+  * 
+ *   Redistribution and use in source and binary forms, with or without
+ *   modification, are permitted provided that the following conditions
+ *   are met:
+ * 
+ *   1. Redistributions of source code must retain the above Copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *   2. Redistributions in binary form must reproduce the above Copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ *   3. Neither the name of the authors nor the names of its contributors
+ *      may be used to endorse or promote products derived from this
+ *      software without specific prior written permission.
+ */
+
+#include <gtest/gtest.h>
+#include <vector>
+#include <string>
+#include <set>
+#include <sstream>
+#include <sys/resource.h>
+#include "uxDynamic.hpp"
+
+using namespace std;
+
+static string makeKey(int i){
+  ostringstream os;
+  os << (i * 7919) % 1009 << "/" << i % 13;
+  return os.str();
+}
+
+static void checkSame(const ux::DynamicTrie& trie, const set<string>& keys, int keyRange){
+  ASSERT_EQ(keys.size(), trie.size());
+  for (int i = 0; i < keyRange; ++i){
+    string key = makeKey(i);
+    ASSERT_EQ(keys.count(key) > 0, trie.contains(key.c_str(), key.size()));
+  }
+
+  const char* prefixes[] = {"", "1", "12", "99", "5/"};
+  for (size_t p = 0; p < sizeof(prefixes) / sizeof(prefixes[0]); ++p){
+    string prefix(prefixes[p]);
+    vector<string> expected;
+    for (set<string>::const_iterator it = keys.lower_bound(prefix); 
+	 it != keys.end() && it->compare(0, prefix.size(), prefix) == 0; ++it){
+      expected.push_back(*it);
+    }
+    vector<string> rets;
+    trie.predictiveSearch(prefix.c_str(), prefix.size(), rets);
+    ASSERT_EQ(expected, rets);
+    trie.predictiveSearch(prefix.c_str(), prefix.size(), rets, 5);
+    expected.resize(min(expected.size(), (size_t)5));
+    ASSERT_EQ(expected, rets);
+  }
+}
+
+TEST(uxdynamic, trivial){
+  ux::DynamicTrie trie;
+  ASSERT_EQ(0, trie.size());
+  ASSERT_FALSE(trie.contains("a", 1));
+  ASSERT_TRUE(trie.insert("a", 1));
+  ASSERT_FALSE(trie.insert("a", 1));
+  ASSERT_TRUE(trie.contains("a", 1));
+  ASSERT_TRUE(trie.erase("a", 1));
+  ASSERT_FALSE(trie.erase("a", 1));
+  ASSERT_EQ(0, trie.merge());
+  ASSERT_EQ(0, trie.size());
+}
+
+TEST(uxdynamic, commonPrefixSearch){
+  vector<string> wordList;
+  wordList.push_back("i");
+  wordList.push_back("in");
+  wordList.push_back("inn");
+  ux::DynamicTrie trie;
+  trie.build(wordList);
+  trie.erase("in", 2);
+  trie.insert("", 0);
+  trie.insert("inne", 4);
+
+  vector<string> rets;
+  ASSERT_EQ(4, trie.commonPrefixSearch("inner", 5, rets));
+  ASSERT_EQ("", rets[0]);
+  ASSERT_EQ("i", rets[1]);
+  ASSERT_EQ("inn", rets[2]);
+  ASSERT_EQ("inne", rets[3]);
+  ASSERT_EQ(2, trie.commonPrefixSearch("inner", 5, rets, 2));
+  ASSERT_EQ(0, trie.merge());
+  ASSERT_EQ(4, trie.commonPrefixSearch("inner", 5, rets));
+  ASSERT_EQ("", rets[0]);
+}
+
+TEST(uxdynamic, update){
+  const int keyRange = 3000;
+  vector<string> wordList;
+  set<string> keys;
+  for (int i = 0; i < keyRange; i += 2){
+    wordList.push_back(makeKey(i));
+    keys.insert(makeKey(i));
+  }
+  ux::DynamicTrie trie;
+  trie.build(wordList);
+  checkSame(trie, keys, keyRange);
+
+  for (int round = 0; round < 4; ++round){
+    for (int i = 0; i < 1000; ++i){
+      string key = makeKey((i * 31 + round * 17) % keyRange);
+      if ((i + round) % 3 == 0){
+	ASSERT_EQ(keys.erase(key) > 0, trie.erase(key.c_str(), key.size()));
+      } else {
+	ASSERT_EQ(keys.insert(key).second, trie.insert(key.c_str(), key.size()));
+      }
+      if (i == 500 && round % 2 == 1){
+	// updates during the background merge
+	ASSERT_EQ(0, trie.startMerge());
+      }
+    }
+    ASSERT_EQ(0, trie.waitMerge());
+    checkSame(trie, keys, keyRange);
+    ASSERT_EQ(0, trie.merge());
+    ASSERT_EQ(0, trie.deltaSize());
+    checkSame(trie, keys, keyRange);
+  }
+}
+
+TEST(uxdynamic, failedMerge){
+  vector<string> wordList;
+  for (int i = 0; i < 100000; ++i){
+    ostringstream os;
+    os << i;
+    wordList.push_back(os.str());
+  }
+  ux::DynamicTrie trie;
+  trie.build(wordList);
+  trie.setMemoryLimit(4096);
+
+  // the merge fails since it cannot open the spill files
+  struct rlimit limit;
+  ASSERT_EQ(0, getrlimit(RLIMIT_NOFILE, &limit));
+  struct rlimit noFile = limit;
+  noFile.rlim_cur = 0;
+  ASSERT_EQ(0, setrlimit(RLIMIT_NOFILE, &noFile));
+  const int startErr = trie.startMerge();
+  // base keys updated during the merge stay in the delta after the failure
+  const bool erased   = trie.erase("1", 1);
+  const bool erased2  = trie.erase("2", 1);
+  const bool inserted = trie.insert("2", 1);
+  const int err = trie.waitMerge();
+  ASSERT_EQ(0, setrlimit(RLIMIT_NOFILE, &limit));
+  ASSERT_TRUE(startErr == 0 || startErr == ux::Trie::FILE_OPEN_ERROR);
+  ASSERT_EQ(ux::Trie::FILE_OPEN_ERROR, startErr ? startErr : err);
+  ASSERT_TRUE(erased && erased2 && inserted);
+
+  ASSERT_TRUE(trie.insert("1", 1));
+  ASSERT_TRUE(trie.contains("1", 1));
+  ASSERT_TRUE(trie.erase("2", 1));
+  ASSERT_FALSE(trie.contains("2", 1));
+  ASSERT_EQ(wordList.size() - 1, trie.size());
+  ASSERT_LE(trie.deltaSize(), 2U);
+
+  trie.setMemoryLimit(0);
+  ASSERT_EQ(0, trie.merge());
+  ASSERT_EQ(0U, trie.deltaSize());
+  ASSERT_TRUE(trie.contains("1", 1));
+  ASSERT_FALSE(trie.contains("2", 1));
+  ASSERT_EQ(wordList.size() - 1, trie.size());
+}
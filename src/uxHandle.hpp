@@ -0,0 +1,282 @@
+/* 
+ *  Copyright (c) 2010 Daisuke Okanohara
+ * 
+ *   Redistribution and use in source and binary forms, with or without
+ *   modification, are permitted provided that the following conditions
+ *   are met:
+ * 
+ *   1. Redistributions of source code must retain the above Copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *   2. Redistributions in binary form must reproduce the above Copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ *   3. Neither the name of the authors nor the names of its contributors
+ *      may be used to endorse or promote products derived from this
+ *      software without specific prior written permission.
+ */
+
+#ifndef UX_HANDLE_HPP__
+#define UX_HANDLE_HPP__
+
+#include <string>
+#include <vector>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include "uxTrie.hpp"
+#include "uxThread.hpp"
+
+namespace ux{
+
+/**
+ * A handle of the current version of an index, such as Trie or Map, shared by query threads.
+ * A new version is loaded in the background and published atomically, and queries never 
+ * wait for a load. A query holds a Guard, which protects the version it started with
+ * by a hazard pointer. A replaced version is deleted once no guard refers to it.
+ *
+ *   IndexHandle<Trie> handle;
+ *   handle.load("a.ind");
+ *   // query threads
+ *   {
+ *     IndexHandle<Trie>::Guard index(handle);
+ *     index->lookup(str, len);
+ *   }
+ *   // reload
+ *   handle.loadAsync("b.ind");
+ *
+ * T must have a default constructor, and int load(const char*) and int map(const char*)
+ * which return 0 on success.
+ */
+template <class T = Trie>
+class IndexHandle {
+public:
+  /**
+   * Protect the current version while the guard is alive. 
+   * A guard is used by one thread, and should not be kept for a long time.
+   */
+  class Guard {
+  public:
+    explicit Guard(IndexHandle& handle) : handle_(handle){
+      slot_ = handle_.acquireSlot();
+      T* ptr = NULL;
+      do {
+	ptr = __atomic_load_n(&handle_.current_, __ATOMIC_SEQ_CST);
+	__atomic_store_n(&handle_.slots_[slot_].ptr, ptr, __ATOMIC_SEQ_CST);
+      } while (ptr != __atomic_load_n(&handle_.current_, __ATOMIC_SEQ_CST));
+      ptr_ = ptr;
+    }
+
+    ~Guard(){
+      __atomic_store_n(&handle_.slots_[slot_].ptr, (T*)NULL, __ATOMIC_RELEASE);
+      __atomic_store_n(&handle_.slots_[slot_].used, 0, __ATOMIC_RELEASE);
+    }
+
+    /**
+     * @return The protected version, or NULL if no version is published
+     */
+    const T* get() const {
+      return ptr_;
+    }
+
+    const T* operator->() const {
+      return ptr_;
+    }
+
+    const T& operator*() const {
+      return *ptr_;
+    }
+
+  private:
+    Guard(const Guard&);
+    Guard& operator=(const Guard&);
+
+    IndexHandle& handle_;
+    size_t slot_;
+    const T* ptr_;
+  };
+
+  /**
+   * Constructor
+   * @param slotNum The maximum number of guards alive at the same time.
+   *                A guard waits for a free slot if all slots are used.
+   */
+  explicit IndexHandle(size_t slotNum = 64) : 
+    current_(NULL), slots_(new Slot[slotNum ? slotNum : 1]), slotNum_(slotNum ? slotNum : 1), 
+    isLoading_(false), loadErr_(0){
+    for (size_t i = 0; i < slotNum_; ++i){
+      slots_[i].ptr  = NULL;
+      slots_[i].used = 0;
+    }
+    pthread_mutex_init(&mutex_, NULL);
+  }
+
+  /**
+   * Destructor. Wait for the background load. No guard may be alive.
+   */
+  ~IndexHandle(){
+    wait();
+    delete current_;
+    for (size_t i = 0; i < retired_.size(); ++i){
+      delete retired_[i];
+    }
+    delete[] slots_;
+    pthread_mutex_destroy(&mutex_);
+  }
+
+  /**
+   * Publish a new version. The previous version is deleted when no guard refers to it.
+   * @param index The new version, which is owned by the handle. NULL to unpublish.
+   */
+  void publish(T* index){
+    pthread_mutex_lock(&mutex_);
+    T* old = __atomic_exchange_n(&current_, index, __ATOMIC_SEQ_CST);
+    if (old){
+      retired_.push_back(old);
+    }
+    reclaimLocked();
+    pthread_mutex_unlock(&mutex_);
+  }
+
+  /**
+   * Load a new version from a file, and publish it
+   * @param fileName The file name
+   * @return 0 on success, or the error code of T::load(). The current version is kept on failure.
+   */
+  int load(const char* fileName){
+    return open(fileName, false);
+  }
+
+  /**
+   * Map a new version from a file, and publish it
+   * @param fileName The file name
+   * @return 0 on success, or the error code of T::map(). The current version is kept on failure.
+   */
+  int map(const char* fileName){
+    return open(fileName, true);
+  }
+
+  /**
+   * Load or map a new version in a background thread, and publish it.
+   * The thread stays until the previous version is deleted.
+   * A preceding background load is waited for.
+   * @param fileName The file name
+   * @param useMMap true to map the file, false to load it
+   */
+  void loadAsync(const char* fileName, bool useMMap = false){
+    wait();
+    asyncFileName_ = fileName;
+    asyncMMap_     = useMMap;
+    loadErr_       = 0;
+    isLoading_ = (pthread_create(&loader_, NULL, loadMain, this) == 0);
+    if (!isLoading_){
+      loadMain(this); // run in the caller's thread
+    }
+  }
+
+  /**
+   * Wait for the background load
+   * @return 0 on success, or the error code of the background load
+   */
+  int wait(){
+    if (isLoading_){
+      pthread_join(loader_, NULL);
+      isLoading_ = false;
+    }
+    return loadErr_;
+  }
+
+  /**
+   * Delete replaced versions that no guard refers to. Called at each publish().
+   * @return The number of replaced versions that are still referred to
+   */
+  size_t reclaim(){
+    pthread_mutex_lock(&mutex_);
+    size_t num = reclaimLocked();
+    pthread_mutex_unlock(&mutex_);
+    return num;
+  }
+
+private:
+  enum {
+    CACHE_LINE = 64
+  };
+
+  struct Slot {
+    T* ptr;
+    int used;
+    char pad[CACHE_LINE - sizeof(T*) - sizeof(int)]; // slots of threads are in different lines
+  };
+
+  size_t acquireSlot(){
+    // start from a slot given by the thread to avoid collisions
+    const size_t start = threadHash();
+    for (;;){
+      for (size_t i = 0; i < slotNum_; ++i){
+	const size_t slot = (start + i) % slotNum_;
+	if (__atomic_load_n(&slots_[slot].used, __ATOMIC_RELAXED) == 0 &&
+	    __atomic_exchange_n(&slots_[slot].used, 1, __ATOMIC_ACQUIRE) == 0){
+	  return slot;
+	}
+      }
+      sched_yield();
+    }
+  }
+
+  size_t reclaimLocked(){
+    std::vector<T*> kept;
+    for (size_t i = 0; i < retired_.size(); ++i){
+      bool isUsed = false;
+      for (size_t j = 0; j < slotNum_ && !isUsed; ++j){
+	isUsed = (__atomic_load_n(&slots_[j].ptr, __ATOMIC_SEQ_CST) == retired_[i]);
+      }
+      if (isUsed){
+	kept.push_back(retired_[i]);
+      } else {
+	delete retired_[i];
+      }
+    }
+    retired_.swap(kept);
+    return retired_.size();
+  }
+
+  int open(const char* fileName, const bool useMMap){
+    T* index = new T;
+    int err = useMMap ? index->map(fileName) : index->load(fileName);
+    if (err != 0){
+      delete index;
+      return err;
+    }
+    publish(index);
+    return 0;
+  }
+
+  static void* loadMain(void* p){
+    IndexHandle* handle = static_cast<IndexHandle*>(p);
+    handle->loadErr_ = handle->open(handle->asyncFileName_.c_str(), handle->asyncMMap_);
+    while (handle->reclaim() > 0){
+      usleep(1000);
+    }
+    return NULL;
+  }
+
+  IndexHandle(const IndexHandle&);
+  IndexHandle& operator=(const IndexHandle&);
+
+  T* current_;
+  Slot* slots_;
+  size_t slotNum_;
+  std::vector<T*> retired_;
+  pthread_mutex_t mutex_;
+
+  pthread_t loader_;
+  bool isLoading_;
+  std::string asyncFileName_;
+  bool asyncMMap_;
+  int loadErr_;
+};
+
+}
+
+#endif // UX_HANDLE_HPP__
@@ -0,0 +1,187 @@
+/* 
+ *  Copyright (c) 2010 Daisuke Okanohara
+ * 
+ *   Redistribution and use in source and binary forms, with or without
+ *   modification, are permitted provided that the following conditions
+ *   are met:
+ * 
+ *   1. Redistributions of source code must retain the above Copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *   2. Redistributions in binary form must reproduce the above Copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ *   3. Neither the name of the authors nor the names of its contributors
+ *      may be used to endorse or promote products derived from this
+ *      software without specific prior written permission.
+ */
+
+#include <gtest/gtest.h>
+#include <vector>
+#include <string>
+#include <pthread.h>
+#include "uxHandle.hpp"
+#include "uxMap.hpp"
+
+using namespace std;
+
+namespace {
+
+int deletedNum = 0;
+
+// a trie which counts its deletions
+class CountedTrie : public ux::Trie {
+public:
+  ~CountedTrie(){
+    __atomic_add_fetch(&deletedNum, 1, __ATOMIC_SEQ_CST);
+  }
+};
+
+CountedTrie* makeTrie(const string& key){
+  vector<string> keys;
+  keys.push_back(key);
+  CountedTrie* trie = new CountedTrie;
+  trie->build(keys);
+  return trie;
+}
+
+struct ReaderArg {
+  ux::IndexHandle<CountedTrie>* handle;
+  int stop;
+  int errNum;
+  size_t queryNum;
+};
+
+// each version has one key, "a" or "b", and a query must see exactly one of them
+void* readerMain(void* p){
+  ReaderArg* arg = static_cast<ReaderArg*>(p);
+  while (!__atomic_load_n(&arg->stop, __ATOMIC_ACQUIRE)){
+    ux::IndexHandle<CountedTrie>::Guard index(*arg->handle);
+    const bool isA = index->lookup("a", 1) != ux::NOTFOUND;
+    const bool isB = index->lookup("b", 1) != ux::NOTFOUND;
+    string key;
+    index->decodeKey(0, key);
+    if (isA == isB || key != (isA ? "a" : "b")){
+      ++arg->errNum;
+    }
+    ++arg->queryNum;
+  }
+  return NULL;
+}
+
+}
+
+TEST(uxhandle, simple){
+  vector<string> keys;
+  keys.push_back("tea");
+  keys.push_back("ten");
+  ux::Trie trie;
+  trie.build(keys);
+  ASSERT_EQ(0, trie.save("uxhandle1.ind"));
+  keys.push_back("to");
+  trie.build(keys);
+  ASSERT_EQ(0, trie.save("uxhandle2.ind"));
+
+  ux::IndexHandle<> handle;
+  {
+    ux::IndexHandle<>::Guard index(handle);
+    ASSERT_TRUE(index.get() == NULL);
+  }
+  ASSERT_EQ(0, handle.load("uxhandle1.ind"));
+  {
+    ux::IndexHandle<>::Guard index(handle);
+    ASSERT_EQ(2, index->size());
+  }
+  handle.loadAsync("uxhandle2.ind", true);
+  ASSERT_EQ(0, handle.wait());
+  {
+    ux::IndexHandle<>::Guard index(handle);
+    ASSERT_EQ(3, index->size());
+    ASSERT_NE(ux::NOTFOUND, index->lookup("to", 2));
+  }
+
+  // a failed load keeps the current version
+  ASSERT_NE(0, handle.load("uxhandle_none.ind"));
+  handle.loadAsync("uxhandle_none.ind");
+  ASSERT_NE(0, handle.wait());
+  ux::IndexHandle<>::Guard index(handle);
+  ASSERT_EQ(3, index->size());
+}
+
+TEST(uxhandle, map){
+  ux::Map<int> m;
+  vector<pair<string, int> > kvs;
+  kvs.push_back(make_pair(string("one"), 1));
+  kvs.push_back(make_pair(string("two"), 2));
+  m.build(kvs);
+  ASSERT_EQ(0, m.save("uxhandle_map.ind"));
+
+  ux::IndexHandle<ux::Map<int> > handle;
+  ASSERT_EQ(0, handle.map("uxhandle_map.ind"));
+  ASSERT_EQ(0, handle.load("uxhandle_map.ind"));
+  ux::IndexHandle<ux::Map<int> >::Guard index(handle);
+  int v = 0;
+  ASSERT_EQ(0, index->get("two", 3, v));
+  ASSERT_EQ(2, v);
+}
+
+TEST(uxhandle, reclaim){
+  deletedNum = 0;
+  {
+    ux::IndexHandle<CountedTrie> handle(4);
+    handle.publish(makeTrie("a"));
+    {
+      ux::IndexHandle<CountedTrie>::Guard index(handle);
+      handle.publish(makeTrie("b"));
+      ASSERT_EQ(0, deletedNum);
+      ASSERT_EQ(1U, handle.reclaim());
+      // the old version is still usable
+      string key;
+      index->decodeKey(0, key);
+      ASSERT_EQ("a", key);
+
+      ux::IndexHandle<CountedTrie>::Guard newIndex(handle);
+      newIndex->decodeKey(0, key);
+      ASSERT_EQ("b", key);
+    }
+    ASSERT_EQ(0U, handle.reclaim());
+    ASSERT_EQ(1, deletedNum);
+  }
+  ASSERT_EQ(2, deletedNum);
+}
+
+TEST(uxhandle, concurrent){
+  deletedNum = 0;
+  const size_t readerNum  = 4;
+  const int    publishNum = 1000;
+  {
+    ux::IndexHandle<CountedTrie> handle(readerNum);
+    handle.publish(makeTrie("a"));
+
+    vector<ReaderArg> args(readerNum);
+    vector<pthread_t> readers(readerNum);
+    for (size_t i = 0; i < readerNum; ++i){
+      args[i].handle   = &handle;
+      args[i].stop     = 0;
+      args[i].errNum   = 0;
+      args[i].queryNum = 0;
+      ASSERT_EQ(0, pthread_create(&readers[i], NULL, readerMain, &args[i]));
+    }
+    for (int i = 0; i < publishNum; ++i){
+      handle.publish(makeTrie(i % 2 ? "a" : "b"));
+      if (i % 100 == 0){
+	usleep(1000);
+      }
+    }
+    for (size_t i = 0; i < readerNum; ++i){
+      __atomic_store_n(&args[i].stop, 1, __ATOMIC_RELEASE);
+      pthread_join(readers[i], NULL);
+      ASSERT_EQ(0, args[i].errNum);
+      ASSERT_LT(0U, args[i].queryNum);
+    }
+    ASSERT_EQ(0U, handle.reclaim());
+    ASSERT_EQ(publishNum, deletedNum);
+  }
+  ASSERT_EQ(publishNum + 1, deletedNum);
+}
@@ -0,0 +1,285 @@
+/* 
+ *  Copyright (c) 2010 Daisuke Okanohara
+ * 
+ *   Redistribution and use in source and binary forms, with or without
+ *   modification, are permitted provided that the following conditions
+ *   are met:
+ * 
+ *   1. Redistributions of source code must retain the above Copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *   2. Redistributions in binary form must reproduce the above Copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ *   3. Neither the name of the authors nor the names of its contributors
+ *      may be used to endorse or promote products derived from this
+ *      software without specific prior written permission.
+ */
+
+#include <cstring>
+#include "uxImage.hpp"
+#include "uxArray.hpp"
+#include "uxUtil.hpp"
+#include "uxThread.hpp"
+#include "uxTrie.hpp"
+
+using namespace std;
+
+namespace ux {
+
+static const uint64_t IMAGE_MAGIC      = 0x004547414D495855ULL; // "UXIMAGE\0"
+static const uint32_t BYTE_ORDER_MARK  = 0x01020304U;
+static const uint64_t CHECKSUM_CHUNK   = 1 << 20;
+
+struct ImageHeader {
+  uint64_t magic;
+  uint32_t version;
+  uint32_t byteOrder;
+  uint32_t type;
+  uint32_t sectionNum;
+  uint64_t size;
+  uint64_t directoryChecksum;
+};
+
+static size_t chunkNum(const uint64_t size){
+  return (size + CHECKSUM_CHUNK - 1) / CHECKSUM_CHUNK;
+}
+
+static uint64_t combineChunks(const vector<uint64_t>& chunkSums){
+  return checksum64(chunkSums.empty() ? NULL : (const char*)&chunkSums[0], 
+		    sizeof(chunkSums[0]) * chunkSums.size());
+}
+
+static uint64_t sectionChecksum(const char* p, const uint64_t size){
+  vector<uint64_t> chunkSums(chunkNum(size));
+  for (size_t i = 0; i < chunkSums.size(); ++i){
+    const uint64_t offset = i * CHECKSUM_CHUNK;
+    chunkSums[i] = checksum64(p + offset, min(CHECKSUM_CHUNK, size - offset));
+  }
+  return combineChunks(chunkSums);
+}
+
+ImageWriter::ImageWriter(const uint32_t type) : type_(type){
+}
+
+void ImageWriter::add(const uint32_t id, const string& data, const uint32_t flags){
+  section(id, flags) = data;
+}
+
+string& ImageWriter::section(const uint32_t id, const uint32_t flags){
+  ImageSection section;
+  section.id       = id;
+  section.flags    = flags;
+  section.offset   = 0;
+  section.size     = 0;
+  section.checksum = 0;
+  sections_.push_back(section);
+  data_.push_back(string());
+  return data_.back();
+}
+
+string ImageWriter::directory() const {
+  vector<ImageSection> sections(sections_);
+  uint64_t offset = alignedSize(sizeof(ImageHeader) + sizeof(ImageSection) * sections.size());
+  for (size_t i = 0; i < sections.size(); ++i){
+    sections[i].offset   = offset;
+    sections[i].size     = data_[i].size();
+    sections[i].checksum = sectionChecksum(data_[i].c_str(), data_[i].size());
+    offset += alignedSize(sections[i].size);
+  }
+
+  ImageHeader header;
+  header.magic      = IMAGE_MAGIC;
+  header.version    = IMAGE_VERSION;
+  header.byteOrder  = BYTE_ORDER_MARK;
+  header.type       = type_;
+  header.sectionNum = (uint32_t)sections.size();
+  header.size       = offset;
+  header.directoryChecksum = checksum64(sections.empty() ? NULL : (const char*)&sections[0], 
+					sizeof(sections[0]) * sections.size());
+  string dir((const char*)&header, sizeof(header));
+  if (!sections.empty()){
+    dir.append((const char*)&sections[0], sizeof(sections[0]) * sections.size());
+  }
+  dir.resize(alignedSize(dir.size()), '\0');
+  return dir;
+}
+
+uint64_t ImageWriter::size() const {
+  uint64_t size = alignedSize(sizeof(ImageHeader) + sizeof(ImageSection) * sections_.size());
+  for (size_t i = 0; i < data_.size(); ++i){
+    size += alignedSize(data_[i].size());
+  }
+  return size;
+}
+
+bool ImageWriter::write(ostream& os) const {
+  const string dir = directory();
+  os.write(dir.c_str(), dir.size());
+  const char pad[IMAGE_ALIGN] = {0};
+  for (size_t i = 0; i < data_.size(); ++i){
+    os.write(data_[i].c_str(), data_[i].size());
+    os.write(pad, alignedSize(data_[i].size()) - data_[i].size());
+  }
+  return !os.fail();
+}
+
+void ImageWriter::write(char* p) const {
+  const string dir = directory();
+  memcpy(p, dir.c_str(), dir.size());
+  p += dir.size();
+  for (size_t i = 0; i < data_.size(); ++i){
+    const size_t size = data_[i].size();
+    memcpy(p, data_[i].c_str(), size);
+    memset(p + size, 0, alignedSize(size) - size);
+    p += alignedSize(size);
+  }
+}
+
+ImageReader::ImageReader() : image_(NULL), size_(0){
+}
+
+size_t ImageReader::headerSize(){
+  return sizeof(ImageHeader);
+}
+
+bool ImageReader::isImage(const char* p){
+  uint64_t magic = 0;
+  memcpy(&magic, p, sizeof(magic));
+  return magic == IMAGE_MAGIC;
+}
+
+size_t ImageReader::directorySize(const char* p){
+  ImageHeader header;
+  memcpy(&header, p, sizeof(header));
+  return sizeof(header) + sizeof(ImageSection) * header.sectionNum;
+}
+
+int ImageReader::peekSize(const char* p, const uint32_t type, uint64_t& size){
+  ImageHeader header;
+  memcpy(&header, p, sizeof(header));
+  if (header.magic != IMAGE_MAGIC){
+    return Trie::LOAD_ERROR;
+  }
+  if (header.byteOrder != BYTE_ORDER_MARK || header.version > IMAGE_VERSION){
+    return Trie::VERSION_ERROR;
+  }
+  if (header.type != type || header.size < sizeof(header)){
+    return Trie::LOAD_ERROR;
+  }
+  size = header.size;
+  return 0;
+}
+
+int ImageReader::open(const char* p, const size_t size, const uint32_t type, 
+		      const uint32_t knownSectionNum){
+  image_ = NULL;
+  size_  = 0;
+  sections_.clear();
+
+  if (size < sizeof(ImageHeader)){
+    return Trie::LOAD_ERROR;
+  }
+  int err = 0;
+  uint64_t imageSize = 0;
+  if ((err = peekSize(p, type, imageSize)) != 0){
+    return err;
+  }
+  const ImageHeader& header = *(const ImageHeader*)p;
+  if (imageSize > size || 
+      header.sectionNum > (imageSize - sizeof(header)) / sizeof(ImageSection)){
+    return Trie::LOAD_ERROR; // truncated
+  }
+  const ImageSection* dir = (const ImageSection*)(p + sizeof(header));
+  if (checksum64((const char*)dir, sizeof(dir[0]) * header.sectionNum) != header.directoryChecksum){
+    return Trie::CHECKSUM_ERROR;
+  }
+  for (uint32_t i = 0; i < header.sectionNum; ++i){
+    const ImageSection& section = dir[i];
+    if (section.offset % IMAGE_ALIGN != 0 || section.offset > imageSize || 
+	section.size > imageSize - section.offset){
+      return Trie::LOAD_ERROR;
+    }
+    if (section.id == 0 || section.id > knownSectionNum){
+      if (section.flags & SECTION_OPTIONAL) continue;
+      return Trie::VERSION_ERROR;
+    }
+    sections_.push_back(section);
+  }
+  image_ = p;
+  size_  = imageSize;
+  return 0;
+}
+
+struct ChecksumTask{
+  vector<pair<const char*, uint64_t> > chunks; // (beginning, size)
+  vector<uint64_t> sums;
+  void run(){
+    sums.resize(chunks.size());
+    for (size_t i = 0; i < chunks.size(); ++i){
+      sums[i] = checksum64(chunks[i].first, chunks[i].second);
+    }
+  }
+};
+
+int ImageReader::verify(const size_t threadNum) const {
+  vector<const char*> data(sections_.size());
+  for (size_t i = 0; i < sections_.size(); ++i){
+    data[i] = image_ + sections_[i].offset;
+  }
+  return verify(sections_, data, threadNum);
+}
+
+int ImageReader::verify(const vector<ImageSection>& sections, const vector<const char*>& data, 
+			const size_t threadNum){
+  // chunks are distributed to threads in turn
+  vector<ChecksumTask> tasks(max(threadNum, (size_t)1));
+  size_t chunkID = 0;
+  for (size_t i = 0; i < sections.size(); ++i){
+    for (uint64_t offset = 0; offset < sections[i].size; offset += CHECKSUM_CHUNK, ++chunkID){
+      tasks[chunkID % tasks.size()].chunks.push_back
+	(make_pair(data[i] + offset, min(CHECKSUM_CHUNK, sections[i].size - offset)));
+    }
+  }
+  runTasks(tasks);
+
+  chunkID = 0;
+  for (size_t i = 0; i < sections.size(); ++i){
+    vector<uint64_t> chunkSums(chunkNum(sections[i].size));
+    for (size_t j = 0; j < chunkSums.size(); ++j, ++chunkID){
+      chunkSums[j] = tasks[chunkID % tasks.size()].sums[chunkID / tasks.size()];
+    }
+    if (combineChunks(chunkSums) != sections[i].checksum){
+      return Trie::CHECKSUM_ERROR;
+    }
+  }
+  return 0;
+}
+
+bool ImageReader::findSection(const uint32_t id, ImageSection& section) const {
+  for (size_t i = 0; i < sections_.size(); ++i){
+    if (sections_[i].id == id){
+      section = sections_[i];
+      return true;
+    }
+  }
+  return false;
+}
+
+bool ImageReader::find(const uint32_t id, const char*& begin, const char*& end) const {
+  for (size_t i = 0; i < sections_.size(); ++i){
+    if (sections_[i].id == id){
+      begin = image_ + sections_[i].offset;
+      end   = begin + sections_[i].size;
+      return true;
+    }
+  }
+  return false;
+}
+
+uint64_t ImageReader::size() const {
+  return size_;
+}
+
+}
@@ -0,0 +1,233 @@
+/* 
+ *  Copyright (c) 2010 Daisuke Okanohara
+ * 
+ *   Redistribution and use in source and binary forms, with or without
+ *   modification, are permitted provided that the following conditions
+ *   are met:
+ * 
+ *   1. Redistributions of source code must retain the above Copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *   2. Redistributions in binary form must reproduce the above Copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ *   3. Neither the name of the authors nor the names of its contributors
+ *      may be used to endorse or promote products derived from this
+ *      software without specific prior written permission.
+ */
+
+#ifndef UX_IMAGE_HPP__
+#define UX_IMAGE_HPP__
+
+#include <vector>
+#include <deque>
+#include <string>
+#include <iostream>
+#include <streambuf>
+#include <stdint.h>
+
+namespace ux {
+
+/**
+ * A saved image consists of a header, a section directory and sections.
+ *
+ *   header:    magic "UXIMAGE\0", version, byte order mark, image type,
+ *              the number of sections, the image size, and the checksum of the directory
+ *   directory: (id, flags, offset, size, checksum) for each section
+ *   sections:  each aligned to 8 bytes from the beginning of the image
+ *
+ * The checksum of a section is XXH64 of the XXH64s of its 1MB chunks, 
+ * so that a large section can be verified by multiple threads.
+ * A reader skips unknown sections marked as optional, and rejects other unknown sections.
+ */
+enum {
+  IMAGE_VERSION     = 2, // 1 was a plain concatenation of arrays
+  SECTION_OPTIONAL  = 1
+};
+
+struct ImageSection {
+  uint32_t id;
+  uint32_t flags;
+  uint64_t offset;
+  uint64_t size;
+  uint64_t checksum;
+};
+
+/**
+ * Collect sections in memory, and write them with the header and the directory
+ */
+class ImageWriter {
+public:
+  /**
+   * @param type The type of the image such as IMAGE_TRIE
+   */
+  explicit ImageWriter(uint32_t type);
+
+  /**
+   * Add a section 
+   * @param id The section ID
+   * @param data The content of the section
+   * @param flags SECTION_OPTIONAL if a reader may ignore the section
+   */
+  void add(uint32_t id, const std::string& data, uint32_t flags = 0);
+
+  /**
+   * Add a section to be filled by the caller before write()
+   * @param id The section ID
+   * @param flags SECTION_OPTIONAL if a reader may ignore the section
+   * @return The content of the section, which is empty
+   */
+  std::string& section(uint32_t id, uint32_t flags = 0);
+
+  /**
+   * Write the image
+   * @param os The output
+   * @return true on success
+   */
+  bool write(std::ostream& os) const;
+
+  /**
+   * Write the image in memory
+   * @param p The destination of size() bytes
+   */
+  void write(char* p) const;
+
+  /**
+   * @return The size of the image
+   */
+  uint64_t size() const;
+
+private:
+  std::string directory() const;
+
+  uint32_t type_;
+  std::vector<ImageSection> sections_;
+  std::deque<std::string> data_; // strings do not move
+};
+
+/**
+ * A stream buffer that appends the output to a string
+ */
+class StringBuf : public std::streambuf {
+public:
+  explicit StringBuf(std::string& str) : str_(str) {}
+
+protected:
+  std::streamsize xsputn(const char* s, std::streamsize n){
+    str_.append(s, n);
+    return n;
+  }
+
+  int_type overflow(int_type c){
+    if (!traits_type::eq_int_type(c, traits_type::eof())){
+      str_.push_back(traits_type::to_char_type(c));
+    }
+    return traits_type::not_eof(c);
+  }
+
+private:
+  std::string& str_;
+};
+
+/**
+ * Parse an image in memory. Sections are not copied.
+ */
+class ImageReader {
+public:
+  ImageReader();
+
+  /**
+   * @param header The first headerSize() bytes
+   * @return true if header is the beginning of an image
+   */
+  static bool isImage(const char* header);
+
+  /**
+   * Read the header of an image, and find the image size.
+   * @param header The first headerSize() bytes of the image
+   * @param type The expected type of the image
+   * @param size The size of the whole image
+   * @return 0 on success, or an error code of Trie
+   */
+  static int peekSize(const char* header, uint32_t type, uint64_t& size);
+
+  /**
+   * @return The size of the fixed header
+   */
+  static size_t headerSize();
+
+  /**
+   * @param header The first headerSize() bytes of the image
+   * @return The size of the header and the directory
+   */
+  static size_t directorySize(const char* header);
+
+  /**
+   * Parse the header and the directory. 
+   * Sections are not read here, and may be read later by the caller.
+   * @param p The beginning of the image, aligned to 8 bytes. At least the header and 
+   *          the directory must be in memory.
+   * @param size The size of the image available from p such as the file size
+   * @param type The expected type of the image
+   * @param knownSectionNum Sections of IDs from 1 to knownSectionNum are known to the caller
+   * @return 0 on success, or an error code of Trie
+   */
+  int open(const char* p, size_t size, uint32_t type, uint32_t knownSectionNum);
+
+  /**
+   * Check the checksums of all sections
+   * @param threadNum The number of threads
+   * @return 0 on success, or an error code of Trie
+   */
+  int verify(size_t threadNum) const;
+
+  /**
+   * Check the checksums of sections read by the caller
+   * @param sections The directory entries of the sections
+   * @param data data[i] is the content of sections[i]
+   * @param threadNum The number of threads
+   * @return 0 on success, or an error code of Trie
+   */
+  static int verify(const std::vector<ImageSection>& sections, 
+		    const std::vector<const char*>& data, size_t threadNum);
+
+  /**
+   * Find the directory entry of a section
+   * @param id The section ID
+   * @param section The entry of the section
+   * @return true if found
+   */
+  bool findSection(uint32_t id, ImageSection& section) const;
+
+  /**
+   * Find a section of an image whose sections are in memory
+   * @param id The section ID
+   * @param begin The beginning of the section
+   * @param end The end of the section
+   * @return true if found
+   */
+  bool find(uint32_t id, const char*& begin, const char*& end) const;
+
+  /**
+   * @return The size of the whole image
+   */
+  uint64_t size() const;
+
+private:
+  const char* image_;
+  uint64_t size_;
+  std::vector<ImageSection> sections_;
+};
+
+/**
+ * Image types
+ */
+enum {
+  IMAGE_TRIE    = 1,
+  IMAGE_SHARDED = 2  // the router of ShardedTrie
+};
+
+}
+
+#endif // UX_IMAGE_HPP__
@@ -0,0 +1,78 @@
+/* 
+ *  Copyright (c) 2010 Daisuke Okanohara
+ * 
+ *   Redistribution and use in source and binary forms, with or without
+ *   modification, are permitted provided that the following conditions
+ *   are met:
+ * 
+ *   1. Redistributions of source code must retain the above Copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *   2. Redistributions in binary form must reproduce the above Copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ *   3. Neither the name of the authors nor the names of its contributors
+ *      may be used to endorse or promote products derived from this
+ *      software without specific prior written permission.
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "uxMMap.hpp"
+
+namespace ux {
+
+MMapFile::MMapFile() : data_(NULL), size_(0) {
+}
+
+MMapFile::~MMapFile(){
+  close();
+}
+
+bool MMapFile::open(const char* fileName){
+  close();
+  int fd = ::open(fileName, O_RDONLY);
+  if (fd < 0){
+    return false;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0){
+    ::close(fd);
+    return false;
+  }
+  size_ = st.st_size;
+  if (size_ == 0){
+    ::close(fd);
+    return true;
+  }
+  void* p = mmap(NULL, size_, PROT_READ, MAP_SHARED, fd, 0);
+  ::close(fd); // the mapping remains after close
+  if (p == MAP_FAILED){
+    size_ = 0;
+    return false;
+  }
+  data_ = static_cast<const char*>(p);
+  return true;
+}
+
+void MMapFile::close(){
+  if (data_){
+    munmap(const_cast<char*>(data_), size_);
+  }
+  data_ = NULL;
+  size_ = 0;
+}
+
+const char* MMapFile::data() const {
+  return data_;
+}
+
+size_t MMapFile::size() const {
+  return size_;
+}
+
+}
@@ -0,0 +1,61 @@
+/* 
+ *  Copyright (c) 2010 Daisuke Okanohara
+ * 
+ *   Redistribution and use in source and binary forms, with or without
+ *   modification, are permitted provided that the following conditions
+ *   are met:
+ * 
+ *   1. Redistributions of source code must retain the above Copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *   2. Redistributions in binary form must reproduce the above Copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ *   3. Neither the name of the authors nor the names of its contributors
+ *      may be used to endorse or promote products derived from this
+ *      software without specific prior written permission.
+ */
+
+#ifndef UX_MMAP_HPP__
+#define UX_MMAP_HPP__
+
+#include <cstddef>
+
+namespace ux {
+
+/**
+ * A read only memory mapped file. The mapping is shared with other processes
+ * through the page cache, and is removed in the destructor.
+ */
+class MMapFile {
+public:
+  MMapFile();
+  ~MMapFile();
+
+  /**
+   * Map a file
+   * @param fileName The file name
+   * @return true on success
+   */
+  bool open(const char* fileName);
+
+  /**
+   * Remove the mapping
+   */
+  void close();
+
+  const char* data() const;
+  size_t size() const;
+
+private:
+  const char* data_;
+  size_t size_;
+
+  MMapFile(const MMapFile&);
+  MMapFile& operator=(const MMapFile&);
+};
+
+}
+
+#endif // UX_MMAP_HPP__
@@ -1,8 +1,14 @@
 #include <iostream>
 #include <fstream>
 #include <string>
+#include <algorithm>
+#include <cstring>
+#include <map>
 #include "cmdline.h"
 #include "uxTrie.hpp"
+#include "uxBuilder.hpp"
+#include "uxDynamic.hpp"
+#include "uxThread.hpp"
 
 using namespace std;
 
@@ -80,22 +86,49 @@ void printQuery(const ux::Trie& ux,
 }
 
 
-int readKeyList(const string& fn, vector<string>& keyList){
-  ifstream ifs(fn.c_str());
+int readKeyBuffer(const string& fn, string& buf, vector<size_t>& offsets){
+  ifstream ifs(fn.c_str(), ios::binary);
   if (!ifs){
     cerr << "cannot open " << fn << endl;
     return -1;
   }
+  ifs.seekg(0, ios::end);
+  buf.resize(ifs.tellg());
+  ifs.seekg(0, ios::beg);
+  ifs.read(&buf[0], buf.size());
+
+  // remove the line separators in place
+  size_t w = 0;
+  offsets.push_back(0);
+  for (size_t i = 0; i < buf.size(); ){
+    size_t j = buf.find('\n', i);
+    if (j == string::npos) j = buf.size();
+    size_t end = j;
+    if (end > i && buf[end-1] == '\r') --end;
+    if (w != i) memmove(&buf[w], &buf[i], end - i);
+    w += end - i;
+    offsets.push_back(w);
+    i = j + 1;
+  }
+  buf.resize(w);
+  return 0;
+}
 
-  for (string key; getline(ifs, key); ){
-    if (key.size() > 0 &&
-	key[key.size()-1] == '\r'){
-      key = key.substr(0, key.size()-1);
+int readQueryLog(const string& fn, vector<string>& queries){
+  ifstream ifs(fn.c_str());
+  if (!ifs){
+    cerr << "cannot open " << fn << endl;
+    return -1;
+  }
+  string query;
+  while (getline(ifs, query)){
+    if (query.size() > 0 && query[query.size()-1] == '\r'){
+      query.erase(query.size()-1);
     }
-    keyList.push_back(key);
+    queries.push_back(query);
   }
   return 0;
-} 
+}
 
 void performanceTest(ux::Trie& ux, vector<string>& keyList){
   random_shuffle(keyList.begin(), keyList.end());
@@ -109,21 +142,79 @@ void performanceTest(ux::Trie& ux, vector<string>& keyList){
   double end   = gettimeofday_sec();
   cout << "  query time:\t" << end - start << endl; 
   cout << "  check keys:\t" << min((int)keyList.size(), 1000) << endl;
-  
+
+  // exact match lookup for existing keys and missing keys
+  vector<string> missList;
+  for (size_t i = 0; i < keyList.size() && i < 1000; ++i){
+    missList.push_back(keyList[i] + '\x01');
+  }
+  start = gettimeofday_sec();
+  for (size_t i = 0; i < keyList.size() && i < 1000; ++i){
+    dummy += ux.lookup(keyList[i].c_str(), keyList[i].size());
+  }
+  end = gettimeofday_sec();
+  cout << " lookup time:\t" << end - start << endl;
+
+  size_t missNum = 0;
+  start = gettimeofday_sec();
+  for (size_t i = 0; i < missList.size(); ++i){
+    missNum += (ux.lookup(missList[i].c_str(), missList[i].size()) == ux::NOTFOUND);
+  }
+  end = gettimeofday_sec();
+  cout << "   miss time:\t" << end - start << endl;
+  cout << "   miss keys:\t" << missNum << endl;
+
   if (dummy == 777){
     cerr << "luckey" << endl;
   }
 }
 
-int buildUX(const string& fn, const string& index, const bool uncompress, const int verbose){
-  vector<string> keyList;
-  if (readKeyList(fn, keyList) == -1){
+int buildUX(const string& fn, const string& index, const bool uncompress, const int filter, const int threadNum, 
+	    const int tailLevel, const string& freqLog, const int verbose){
+  string buf;
+  vector<size_t> offsets;
+  if (readKeyBuffer(fn, buf, offsets) == -1){
     return -1;
   }
+  // the frequency of a key is the number of its occurrences in the query log
+  vector<uint64_t> freqs;
+  if (freqLog != ""){
+    vector<string> queries;
+    if (readQueryLog(freqLog, queries) == -1){
+      return -1;
+    }
+    map<string, uint64_t> counts;
+    for (size_t i = 0; i < queries.size(); ++i){
+      ++counts[queries[i]];
+    }
+    freqs.resize(offsets.size() - 1);
+    for (size_t i = 0; i + 1 < offsets.size(); ++i){
+      map<string, uint64_t>::const_iterator it = counts.find(buf.substr(offsets[i], offsets[i+1] - offsets[i]));
+      freqs[i] = (it != counts.end()) ? it->second : 0;
+    }
+  }
+
   ux::Trie ux;
+  ux.setFilterBitsPerKey(filter);
+  ux.setThreadNum(threadNum);
+  ux.setTailLevel(tailLevel);
   double start = gettimeofday_sec();
-  ux.build(keyList, !uncompress);
+  if (freqs.empty()){
+    ux.build(buf.c_str(), &offsets[0], offsets.size() - 1, !uncompress);
+  } else {
+    vector<ux::id_t> ids;
+    ux.build(buf.c_str(), &offsets[0], offsets.size() - 1, &freqs[0], ids, !uncompress);
+  }
   double elapsedTime = gettimeofday_sec() - start;
+
+  vector<string> keyList;
+  if (verbose >= 1){
+    for (size_t i = 0; i + 1 < offsets.size(); ++i){
+      keyList.push_back(buf.substr(offsets[i], offsets[i+1] - offsets[i]));
+    }
+    sort(keyList.begin(), keyList.end());
+    keyList.erase(unique(keyList.begin(), keyList.end()), keyList.end());
+  }
   if (verbose >= 1){
     cout << "  index time:\t" << elapsedTime << endl;
     reportStat(ux, keyList);
@@ -141,13 +232,58 @@ int buildUX(const string& fn, const string& index, const bool uncompress, const
   return 0;
 }
 
-int searchUX(const string& index, const int limit){
+int buildSortedUX(const string& fn, const string& index, const bool uncompress, const int filter,
+		  const int threadNum, const int tailLevel, const int memory, const int verbose){
+  ifstream ifs(fn.c_str());
+  if (!ifs){
+    cerr << "cannot open " << fn << endl;
+    return -1;
+  }
   ux::Trie ux;
-  int err = ux.load(index.c_str());
+  ux.setFilterBitsPerKey(filter);
+  ux.setThreadNum(threadNum);
+  ux.setTailLevel(tailLevel);
+  double start = gettimeofday_sec();
+  ux::StreamBuilder builder(ux, !uncompress, (size_t)memory << 20);
+  int err = builder.add(ifs);
+  if (err == 0){
+    err = builder.finish();
+  }
+  if (err != 0){
+    cerr << ux.what(err) << " " << fn << endl;
+    return -1;
+  }
+  double elapsedTime = gettimeofday_sec() - start;
+  if (verbose >= 1){
+    cout << "  index time:\t" << elapsedTime << endl;
+    ux.allocStat(ux.getAllocSize(), cout);
+    ux.stat(cout);
+  }
+
+  if (index == "") return 0;
+  err = ux.save(index.c_str());
+  if (err != ux::Trie::SUCCESS){
+    cerr << ux.what(err) << " " << index << endl;
+    return -1;
+  }
+  return 0;
+}
+
+int openUX(ux::Trie& ux, const string& index, const bool useMMap, const bool lazy){
+  ux.setLazy(lazy);
+  int err = useMMap ? ux.map(index.c_str()) : ux.load(index.c_str());
   if (err != ux::Trie::SUCCESS){ 
     cerr << ux.what(err) << " " << index << endl;
     return -1;
   }
+  return 0;
+}
+
+int searchUX(const string& index, const int limit, const bool useMMap, const bool lazy){
+  ux::Trie ux;
+  if (openUX(ux, index, useMMap, lazy) == -1){
+    return -1;
+  }
   cout << "read:" << ux.size() << " keys" << endl;
   
   string query;
@@ -163,13 +299,198 @@ int searchUX(const string& index, const int limit){
   return 0;
 }
 
-int listUX(const string& index){
+int replayUX(const string& index, const string& queryLog, const bool useMMap, const bool lazy){
+  vector<string> queries;
+  if (readQueryLog(queryLog, queries) == -1){
+    return -1;
+  }
   ux::Trie ux;
-  int err = ux.load(index.c_str());
+  double start = gettimeofday_sec();
+  if (openUX(ux, index, useMMap, lazy) == -1){
+    return -1;
+  }
+  double openTime = gettimeofday_sec() - start;
+  if (!queries.empty()){
+    ux.lookup(queries[0].c_str(), queries[0].size());
+  }
+  double firstQueryTime = gettimeofday_sec() - start;
+
+  size_t hitNum = 0;
+  start = gettimeofday_sec();
+  for (size_t i = 0; i < queries.size(); ++i){
+    hitNum += (ux.lookup(queries[i].c_str(), queries[i].size()) != ux::NOTFOUND);
+  }
+  double elapsedTime = gettimeofday_sec() - start;
+  cout << "   open time:\t" << openTime << endl
+       << " first query:\t" << firstQueryTime << endl
+       << "     queries:\t" << queries.size() << endl
+       << "        hits:\t" << hitNum << endl
+       << " replay time:\t" << elapsedTime << endl
+       << "   per query:\t" << elapsedTime * 1e9 / max(queries.size(), (size_t)1) << " ns" << endl;
+  return 0;
+}
+
+struct DynamicReader{
+  const ux::DynamicTrie* trie;
+  const vector<string>* keys;
+  size_t queryNum;
+  size_t hitNum;
+  void run(){
+    hitNum = 0;
+    for (size_t i = 0; i < queryNum; ++i){
+      const string& key = (*keys)[(i * 7919) % keys->size()];
+      hitNum += trie->contains(key.c_str(), key.size());
+    }
+  }
+};
+
+struct DynamicWriter{
+  ux::DynamicTrie* trie;
+  const vector<string>* keys;
+  size_t begin;
+  size_t mergeSize;
+  size_t mergeNum;
+  void run(){
+    mergeNum = 0;
+    for (size_t i = begin; i < keys->size(); ++i){
+      const string& key = (*keys)[i];
+      trie->insert(key.c_str(), key.size());
+      const string& old = (*keys)[i - begin];
+      trie->erase(old.c_str(), old.size());
+      if (trie->deltaSize() >= mergeSize && trie->startMerge() == 0){
+	++mergeNum;
+      }
+    }
+    trie->waitMerge();
+  }
+};
+
+// the writer task runs with the reader tasks
+struct DynamicTask{
+  DynamicReader* reader;
+  DynamicWriter* writer;
+  void run(){
+    if (reader) reader->run();
+    else writer->run();
+  }
+};
+
+int dynamicTest(const string& fn, const int threadNum){
+  string buf;
+  vector<size_t> offsets;
+  if (readKeyBuffer(fn, buf, offsets) == -1){
+    return -1;
+  }
+  vector<string> keys;
+  for (size_t i = 0; i + 1 < offsets.size(); ++i){
+    keys.push_back(buf.substr(offsets[i], offsets[i+1] - offsets[i]));
+  }
+  sort(keys.begin(), keys.end());
+  keys.erase(unique(keys.begin(), keys.end()), keys.end());
+  random_shuffle(keys.begin(), keys.end());
+  
+  // 90% of keys are in the base, and the rest are inserted
+  const size_t baseNum = keys.size() * 9 / 10;
+  vector<string> baseKeys(keys.begin(), keys.begin() + baseNum);
+  ux::DynamicTrie trie;
+  trie.build(baseKeys);
+
+  // read amplification by the size of the delta
+  const size_t queryNum = 100000;
+  size_t inserted = baseNum;
+  for (int step = 0; step < 3; ++step){
+    DynamicReader reader;
+    reader.trie     = &trie;
+    reader.keys     = &keys;
+    reader.queryNum = queryNum;
+    double start = gettimeofday_sec();
+    reader.run();
+    double elapsedTime = gettimeofday_sec() - start;
+    cout << "   delta:\t" << trie.deltaSize() << "\tcontains:\t" 
+	 << elapsedTime * 1e9 / queryNum << " ns" << endl;
+    size_t next = baseNum + (keys.size() - baseNum) * (step + 1) / 2;
+    for (; inserted < next; ++inserted){
+      trie.insert(keys[inserted].c_str(), keys[inserted].size());
+      trie.erase(keys[inserted - baseNum].c_str(), keys[inserted - baseNum].size());
+    }
+  }
+  trie.build(baseKeys);
+
+  // mixed load: readers and one writer with background merges
+  vector<DynamicReader> readers(max(threadNum, 1));
+  DynamicWriter writer;
+  writer.trie      = &trie;
+  writer.keys      = &keys;
+  writer.begin     = baseNum;
+  writer.mergeSize = max(baseNum / 20, (size_t)1);
+  vector<DynamicTask> tasks(readers.size() + 1);
+  for (size_t i = 0; i < readers.size(); ++i){
+    readers[i].trie     = &trie;
+    readers[i].keys     = &keys;
+    readers[i].queryNum = queryNum * 10;
+    tasks[i].reader = &readers[i];
+    tasks[i].writer = NULL;
+  }
+  tasks.back().reader = NULL;
+  tasks.back().writer = &writer;
+  double start = gettimeofday_sec();
+  ux::runTasks(tasks);
+  double elapsedTime = gettimeofday_sec() - start;
+  const size_t readNum  = readers.size() * queryNum * 10;
+  const size_t writeNum = (keys.size() - baseNum) * 2;
+  cout << "   mixed:\t" << elapsedTime << " sec" << endl
+       << "   reads:\t" << readNum  << "\t" << readNum  / elapsedTime << " /sec" << endl
+       << "  writes:\t" << writeNum << "\t" << writeNum / elapsedTime << " /sec" << endl
+       << "  merges:\t" << writer.mergeNum << endl
+       << "    keys:\t" << trie.size() << endl;
+  return 0;
+}
+
+int mergeUX(const string& index, const vector<string>& inputNames, const bool uncompress, 
+	    const int filter, const int tailLevel, const int verbose){
+  vector<const ux::Trie*> inputs;
+  int err = 0;
+  for (size_t i = 0; i < inputNames.size() && err == 0; ++i){
+    ux::Trie* input = new ux::Trie;
+    inputs.push_back(input);
+    if ((err = input->load(inputNames[i].c_str())) != ux::Trie::SUCCESS){
+      cerr << ux::Trie::what(err) << " " << inputNames[i] << endl;
+    }
+  }
+  ux::Trie ux;
+  ux.setFilterBitsPerKey(filter);
+  ux.setTailLevel(tailLevel);
+  double start = gettimeofday_sec();
+  if (err == 0){
+    err = ux.merge(inputs.empty() ? NULL : &inputs[0], inputs.size(), NULL, !uncompress);
+  }
+  for (size_t i = 0; i < inputs.size(); ++i){
+    delete inputs[i];
+  }
+  if (err != 0){
+    cerr << ux.what(err) << endl;
+    return -1;
+  }
+  double elapsedTime = gettimeofday_sec() - start;
+  if (verbose >= 1){
+    cout << "  merge time:\t" << elapsedTime << endl;
+    ux.allocStat(ux.getAllocSize(), cout);
+    ux.stat(cout);
+  }
+
+  err = ux.save(index.c_str());
   if (err != ux::Trie::SUCCESS){
     cerr << ux.what(err) << " " << index << endl;
     return -1;
   }
+  return 0;
+}
+
+int listUX(const string& index, const bool useMMap, const bool lazy){
+  ux::Trie ux;
+  if (openUX(ux, index, useMMap, lazy) == -1){
+    return -1;
+  }
   
   for (size_t i = 0; i < ux.size(); ++i){
     cout << ux.decodeKey(i) <<  endl;
@@ -185,6 +506,17 @@ int main(int argc, char* argv[]){
   p.add<int>   ("limit",      'l', "limit at search", false, 10);
   p.add        ("uncompress", 'u', "tail is uncompressed");
   p.add        ("enumerate",  'e', "enumerate all keywords");
+  p.add<int>   ("filter",     'f', "bits per key of the Bloom filter for missing keys", false, 0);
+  p.add<int>   ("thread",     't', "the number of threads at build", false, 1);
+  p.add<int>   ("level",      'L', "the maximum number of nested tries for tails", false, 1);
+  p.add<string>("freq",       'q', "query log to order children by key frequencies", false);
+  p.add<string>("replay",     'r', "query log to replay lookups", false);
+  p.add        ("dynamic",    'y', "benchmark DynamicTrie under mixed reads and updates on the key list");
+  p.add        ("merge",      'g', "merge the indexes given as the rest arguments into the index");
+  p.add        ("mmap",       'p', "map the index into memory instead of reading it");
+  p.add        ("lazy",       'z', "read sections of the index at their first use");
+  p.add        ("sorted",     's', "key list is sorted. build with bounded memory");
+  p.add<int>   ("memory",     'm', "memory limit in MB for the sorted key list", false, 0);
   p.add<int>   ("verbose",    'v', "verbose mode", 0);
   p.add("help", 'h', "this message");
   p.set_program_name("ux");
@@ -194,12 +526,24 @@ int main(int argc, char* argv[]){
     return -1;
   }
 
-  if (p.exist("keylist")){
-    return buildUX(p.get<string>("keylist"), p.get<string>("index"), p.exist("uncompress"), p.get<int>("verbose"));
+  if (p.exist("merge")){
+    return mergeUX(p.get<string>("index"), p.rest(), p.exist("uncompress"), p.get<int>("filter"), 
+		   p.get<int>("level"), p.get<int>("verbose"));
+  } else if (p.exist("keylist") && p.exist("dynamic")){
+    return dynamicTest(p.get<string>("keylist"), p.get<int>("thread"));
+  } else if (p.exist("keylist") && p.exist("sorted")){
+    return buildSortedUX(p.get<string>("keylist"), p.get<string>("index"), p.exist("uncompress"),
+			 p.get<int>("filter"), p.get<int>("thread"), p.get<int>("level"), p.get<int>("memory"), 
+			 p.get<int>("verbose"));
+  } else if (p.exist("keylist")){
+    return buildUX(p.get<string>("keylist"), p.get<string>("index"), p.exist("uncompress"), p.get<int>("filter"), p.get<int>("thread"), 
+		   p.get<int>("level"), p.get<string>("freq"), p.get<int>("verbose"));
+  } else if (p.exist("replay")){
+    return replayUX(p.get<string>("index"), p.get<string>("replay"), p.exist("mmap"), p.exist("lazy"));
   } else if (p.exist("enumerate")){
-    return listUX(p.get<string>("index"));
+    return listUX(p.get<string>("index"), p.exist("mmap"), p.exist("lazy"));
   } else {
-    return searchUX(p.get<string>("index"), p.get<int>("limit"));
+    return searchUX(p.get<string>("index"), p.get<int>("limit"), p.exist("mmap"), p.exist("lazy"));
   }
 
   return 0; // NOT COME 
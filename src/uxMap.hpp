@@ -25,12 +25,44 @@
 #include <iostream>
 #include <map>
 #include <string>
+#include <cstring>
+#include <algorithm>
 #include "uxTrie.hpp"
+#include "uxArray.hpp"
+#include "uxMapUtil.hpp"
+#include "uxThread.hpp"
 
 namespace ux{
 
+/**
+ * Memory orders of the atomic operations of Map, which are those of GCC's __atomic builtins.
+ * fetch() does not take ORDER_RELEASE and ORDER_ACQ_REL, and store() does not take 
+ * ORDER_ACQUIRE and ORDER_ACQ_REL.
+ */
+enum MemoryOrder {
+  ORDER_RELAXED = __ATOMIC_RELAXED,
+  ORDER_ACQUIRE = __ATOMIC_ACQUIRE,
+  ORDER_RELEASE = __ATOMIC_RELEASE,
+  ORDER_ACQ_REL = __ATOMIC_ACQ_REL,
+  ORDER_SEQ_CST = __ATOMIC_SEQ_CST
+};
+
+/**
+ * Aggregations of values of Map::aggregatePrefix()
+ */
+enum AggregateOp {
+  AGGREGATE_SUM,
+  AGGREGATE_COUNT,
+  AGGREGATE_MAX
+};
+
 /**
  * Succict Map using UX
+ *
+ * The value of a key can be updated by many threads at the same time with fetchAdd(), 
+ * compareExchange() and store(), which need an integral V. These do not change the keys, 
+ * and must not be mixed with set() on the same key. 
+ * For keys updated by many threads, add() spreads the updates over stripes (setStripeNum()).
  */
 template <class V>
 class Map{
@@ -38,18 +70,38 @@ public:
   /**
    * Constructor
    */
-  Map() : size_(0){}
+  Map() : size_(0), mmap_(NULL){}
 
   /**
    * Destructor
    */
-  ~Map() {}
+  ~Map() {
+    delete mmap_;
+  }
+
+  /**
+   * Use a Bloom filter to reject missing keys in get() and set()
+   * @param bitsPerKey The number of filter bits per key, or 0 to disable the filter
+   */
+  void setFilterBitsPerKey(size_t bitsPerKey){
+    trie_.setFilterBitsPerKey(bitsPerKey);
+  }
+
+  /**
+   * Keep the rank of each key in the order of predictiveSearch(), which buildAggregates() needs.
+   * The ranks are built in the following build() and are saved with the map.
+   * @param useCountIndex true to keep the ranks
+   */
+  void setCountIndex(bool useCountIndex){
+    trie_.setCountIndex(useCountIndex);
+  }
 
   /**
    * Build a map without values
    * @param keys keys to be associated
    */
   void build(std::vector<std::string>& keys){
+    release();
     trie_.build(keys);
     vs_.resize(trie_.size());
   }
@@ -59,39 +111,58 @@ public:
    * @param m A std::map as an input
    */
   void build(const std::map<std::string, V>& m){
-    std::vector<std::string> wordList;
-    for (typename std::map<std::string, V>::const_iterator it = 
-	   m.begin(); it != m.end(); ++it){
-      wordList.push_back(it->first);
-    }
-    trie_.build(wordList);
-    vs_.resize(wordList.size());
-    for (typename std::map<std::string, V>::const_iterator it = 
-	   m.begin(); it != m.end(); ++it){
-      const std::string key = it->first;
-      if (set(key.c_str(), key.size(), it->second) != 0){
-	return;
-      }
-    }
+    std::vector<V> vs;
+    release();
+    trie_.buildKeyValues(m.begin(), m.end(), vs);
+    vs_.swap(vs);
   }
 
   /**
-   * Build a map from the vector of the pair of a key and a value
+   * Build a map from the vector of the pair of a key and a value.
+   * If a key appears more than once, the last value is used.
    * @param kvs A vector of the pair of a key and vlaue
    */
   void build(const std::vector< std::pair<std::string, V> >& kvs){
-    std::vector<std::string> wordList;
-    for (size_t i = 0; i < kvs.size(); ++i){
-      wordList.push_back(kvs[i].first);
-    }
-
-    trie_.build(wordList);
-    vs_.resize(wordList.size());
+    std::vector<V> vs;
+    release();
+    trie_.buildKeyValues(kvs.begin(), kvs.end(), vs);
+    vs_.swap(vs);
+  }
 
-    for (size_t i = 0; i < kvs.size(); ++i){
-      const std::string key = kvs[i].first;
-      assert(set(key.c_str(), key.size(), kvs[i].second) == 0);
+  /**
+   * Build a map of all keys in the input maps. Values are carried over by IDs
+   * without looking up keys again. If a key is in more than one input, 
+   * the value in the last input is used. This map may be one of the inputs.
+   * The values added by add() to stripes are carried over without foldStripes().
+   * @param inputs The input maps
+   * @param num The number of inputs
+   * @return 0 on success, or an error code of Trie
+   */
+  int merge(const Map<V>* inputs[], size_t num){
+    std::vector<const Trie*> tries(num);
+    for (size_t i = 0; i < num; ++i){
+      tries[i] = &inputs[i]->trie_;
     }
+    std::vector<std::vector<id_t> > idMaps;
+    int err = trie_.merge(num ? &tries[0] : NULL, num, &idMaps);
+    if (err != 0) return err;
+    std::vector<V> vs(trie_.size());
+    for (size_t i = 0; i < num; ++i){
+      // the values with the stripes added as save() does
+      Array<V> folded;
+      const Array<V>& ivs = inputs[i]->savedValues(folded);
+      for (size_t j = 0; j < idMaps[i].size(); ++j){
+	vs[idMaps[i][j]] = ivs[j];
+      }
+    }
+    vs_.swap(vs);
+    stripes_.clear();
+    ordered_.clear();
+    sums_.clear();
+    blockMaxes_.clear();
+    delete mmap_; // inputs are no longer used
+    mmap_ = NULL;
+    return 0;
   }
 
   /**
@@ -102,8 +173,7 @@ public:
    * @return 0 on success and -1 if not found
    */
   int get(const char* str, size_t len, V& v) const {
-    size_t retLen = 0;
-    id_t id = trie_.prefixSearch(str, len, retLen);
+    id_t id = trie_.lookup(str, len);
     if (id == NOTFOUND){
       return -1;
     } 
@@ -116,18 +186,164 @@ public:
    * @param str the key
    * @param len the length of str
    * @param v  A value to be associated for a key
-   * @return 0 on success and -1 if not found
+   * @return 0 on success and -1 if not found or the map is read only
    */
   int set(const char* str, size_t len, const V& v){
-    size_t retLen = 0;
-    id_t id = trie_.prefixSearch(str, len, retLen);
-    if (id == NOTFOUND){
+    id_t id = trie_.lookup(str, len);
+    if (id == NOTFOUND || vs_.isView()){
       return -1;
     }
     vs_[id] = v;
     return 0;
   }
 
+  /**
+   * Add a value to the value of a key atomically
+   * @param str the key
+   * @param len the length of str
+   * @param delta The value to be added
+   * @param old If not NULL, set to the value before the addition
+   * @param order The memory order
+   * @return 0 on success and -1 if not found or the map is read only
+   */
+  int fetchAdd(const char* str, size_t len, const V& delta, V* old = NULL, 
+	       MemoryOrder order = ORDER_SEQ_CST){
+    V* p = mutableValue(str, len);
+    if (!p){
+      return -1;
+    }
+    const V prev = __atomic_fetch_add(p, delta, order);
+    if (old){
+      *old = prev;
+    }
+    return 0;
+  }
+
+  /**
+   * Replace the value of a key with desired if it is equal to expected, atomically
+   * @param str the key
+   * @param len the length of str
+   * @param expected The expected value, which is set to the current value on failure
+   * @param desired The new value
+   * @param order The memory order on success. The order on failure is the strongest 
+   *              one allowed in a load.
+   * @return 0 if replaced, 1 if not replaced, and -1 if not found or the map is read only
+   */
+  int compareExchange(const char* str, size_t len, V& expected, const V& desired,
+		      MemoryOrder order = ORDER_SEQ_CST){
+    V* p = mutableValue(str, len);
+    if (!p){
+      return -1;
+    }
+    const int failureOrder = (order == ORDER_RELEASE) ? ORDER_RELAXED :
+      (order == ORDER_ACQ_REL) ? ORDER_ACQUIRE : order;
+    return __atomic_compare_exchange_n(p, &expected, desired, false, order, failureOrder) ? 0 : 1;
+  }
+
+  /**
+   * Set the value of a key atomically
+   * @param str the key
+   * @param len the length of str
+   * @param v The new value
+   * @param order The memory order
+   * @return 0 on success and -1 if not found or the map is read only
+   */
+  int store(const char* str, size_t len, const V& v, MemoryOrder order = ORDER_SEQ_CST){
+    V* p = mutableValue(str, len);
+    if (!p){
+      return -1;
+    }
+    __atomic_store_n(p, v, order);
+    return 0;
+  }
+
+  /**
+   * Get the value of a key atomically
+   * @param str the key
+   * @param len the length of str
+   * @param v The value
+   * @param order The memory order
+   * @return 0 on success and -1 if not found
+   */
+  int fetch(const char* str, size_t len, V& v, MemoryOrder order = ORDER_SEQ_CST) const {
+    id_t id = trie_.lookup(str, len);
+    if (id == NOTFOUND){
+      return -1;
+    }
+    v = __atomic_load_n(&vs_[id], order);
+    return 0;
+  }
+
+  /**
+   * Split values into stripes for add(). Each thread adds to the stripe chosen by
+   * the thread, so that threads updating the same key seldom share a cache line.
+   * The value of a key is the sum over the stripes. sum(), save() and saveToBuffer() see 
+   * all stripes at any time, and get() and others see them after foldStripes().
+   * Stripes are folded here, and are dropped by the following build() or load().
+   * @param stripeNum The number of stripes, or 1 to stop striping
+   */
+  void setStripeNum(size_t stripeNum){
+    foldStripes();
+    if (vs_.isView()){
+      return;
+    }
+    stripes_.assign(stripeNum > 1 ? stripeNum - 1 : 0, std::vector<V>());
+    for (size_t i = 0; i < stripes_.size(); ++i){
+      stripes_[i].assign(vs_.size(), V());
+    }
+  }
+
+  /**
+   * Add a value to the value of a key in the stripe of the caller's thread, 
+   * atomically with the relaxed order
+   * @param str the key
+   * @param len the length of str
+   * @param delta The value to be added
+   * @return 0 on success and -1 if not found or the map is read only
+   */
+  int add(const char* str, size_t len, const V& delta){
+    id_t id = trie_.lookup(str, len);
+    if (id == NOTFOUND || vs_.isView()){
+      return -1;
+    }
+    const size_t stripe = threadHash() % (stripes_.size() + 1);
+    V* p = (stripe == 0) ? &vs_[id] : &stripes_[stripe - 1][id];
+    __atomic_fetch_add(p, delta, __ATOMIC_RELAXED);
+    return 0;
+  }
+
+  /**
+   * Get the sum of the value of a key over the stripes
+   * @param str the key
+   * @param len the length of str
+   * @param v The sum
+   * @return 0 on success and -1 if not found
+   */
+  int sum(const char* str, size_t len, V& v) const {
+    id_t id = trie_.lookup(str, len);
+    if (id == NOTFOUND){
+      return -1;
+    }
+    v = __atomic_load_n(&vs_[id], __ATOMIC_RELAXED);
+    for (size_t i = 0; i < stripes_.size(); ++i){
+      v += __atomic_load_n(&stripes_[i][id], __ATOMIC_RELAXED);
+    }
+    return 0;
+  }
+
+  /**
+   * Add the stripes to the values, and clear the stripes. 
+   * This must not run with add() at the same time.
+   */
+  void foldStripes(){
+    for (size_t i = 0; i < stripes_.size(); ++i){
+      for (size_t id = 0; id < stripes_[i].size(); ++id){
+	vs_[id] += stripes_[i][id];
+	stripes_[i][id] = V();
+      }
+    }
+  }
+
   /**
    * Return the longest key that matches the prefix of the query in the dictionary
    * @param str the query
@@ -156,7 +372,7 @@ public:
   size_t commonPrefixSearch(const char* str, size_t len, std::vector<V>& vs, size_t limit = LIMIT_DEFAULT) const {
     vs.clear();
     std::vector<id_t> retIDs;
-    commonPrefixSearch(str, len, retIDs, limit);
+    trie_.commonPrefixSearch(str, len, retIDs, limit);
     vs.resize(retIDs.size());
     for (size_t i = 0; i < retIDs.size(); ++i){
       vs[i] = vs_[retIDs[i]];
@@ -175,7 +391,7 @@ public:
   size_t predictiveSearch(const char* str, size_t len, std::vector<V>& vs, size_t limit = LIMIT_DEFAULT) const {
     vs.clear();
     std::vector<id_t> retIDs;
-    predictiveSearch(str, len, retIDs, limit);
+    trie_.predictiveSearch(str, len, retIDs, limit);
     vs.resize(retIDs.size());
     for (size_t i = 0; i < retIDs.size(); ++i){
       vs[i] = vs_[retIDs[i]];
@@ -183,6 +399,74 @@ public:
     return vs.size();
   }
 
+  /**
+   * Prepare aggregatePrefix(). Values, with the stripes added, are arranged in the order 
+   * of predictiveSearch() using the ranks of the trie, where the keys under a prefix are 
+   * contiguous, with their prefix sums and the maximums of blocks. The map must be built 
+   * with setCountIndex(true). Changes of values after this call are not reflected. 
+   * The arrangement is kept in memory, and is dropped by the following build() or load().
+   * @return 0 on success, -1 if the trie does not keep the ranks
+   */
+  int buildAggregates(){
+    const size_t keyNum = trie_.size();
+    if (keyNum > 0 && trie_.keyRank(0) == NOTFOUND){
+      return -1;
+    }
+    Array<V> folded;
+    const Array<V>& vs = savedValues(folded);
+    ordered_.resize(keyNum);
+    for (size_t id = 0; id < keyNum; ++id){
+      ordered_[trie_.keyRank(id)] = vs[id];
+    }
+    sums_.assign(keyNum + 1, V());
+    for (size_t i = 0; i < keyNum; ++i){
+      sums_[i + 1] = sums_[i] + ordered_[i];
+    }
+    // blockMaxes_[k][b] is the maximum of the blocks from b to b + 2^k - 1
+    const size_t blockNum = (keyNum + AGGREGATE_BLOCK - 1) / AGGREGATE_BLOCK;
+    blockMaxes_.assign(1, std::vector<V>(blockNum));
+    for (size_t i = 0; i < keyNum; ++i){
+      V& m = blockMaxes_[0][i / AGGREGATE_BLOCK];
+      if (i % AGGREGATE_BLOCK == 0 || m < ordered_[i]) m = ordered_[i];
+    }
+    for (size_t k = 1; ((size_t)1 << k) <= blockNum; ++k){
+      const std::vector<V>& prev = blockMaxes_[k - 1];
+      std::vector<V> cur(blockNum - ((size_t)1 << k) + 1);
+      for (size_t b = 0; b < cur.size(); ++b){
+	cur[b] = std::max(prev[b], prev[b + ((size_t)1 << (k - 1))]);
+      }
+      blockMaxes_.push_back(cur);
+    }
+    return 0;
+  }
+
+  /**
+   * Aggregate the values of all keys whose prefixes match the query in O(the query length).
+   * buildAggregates() must be called before.
+   * @param str the query
+   * @param len the length of the query
+   * @param op AGGREGATE_SUM, AGGREGATE_COUNT (the number of keys), or AGGREGATE_MAX
+   * @param v The aggregated value
+   * @return 0 on success, -1 if no key matches or buildAggregates() is not called
+   */
+  int aggregatePrefix(const char* str, size_t len, AggregateOp op, V& v) const {
+    id_t first = 0;
+    id_t last  = 0;
+    if (sums_.size() != trie_.size() + 1 || !trie_.prefixBound(str, len, first, last)){
+      return -1;
+    }
+    const size_t begin = trie_.keyRank(first);
+    const size_t end   = trie_.keyRank(last) + 1;
+    if (op == AGGREGATE_SUM){
+      v = sums_[end] - sums_[begin];
+    } else if (op == AGGREGATE_COUNT){
+      v = (V)(end - begin);
+    } else {
+      v = maxOf(begin, end);
+    }
+    return 0;
+  }
+
   /**
    * Return the key for the given ID
    * @param id The ID of the key
@@ -199,9 +483,8 @@ public:
    */
   int save(std::ostream& os) const {
     trie_.save(os);
-    size_t vsSize = vs_.size();
-    os.write((const char*)&vsSize, sizeof(vsSize));
-    os.write((const char*)&vs_[0], sizeof(vs_[0]) * vs_.size());
+    Array<V> folded;
+    savedValues(folded).save(os);
     if (!os){
       return -1;
     } else {
@@ -215,18 +498,137 @@ public:
    * @return 0 on success, -1 on failure
    */
   int load(std::istream& is){
-    trie_.load(is);
-    size_t vsSize = 0;
-    is.read((char*)&vsSize, sizeof(vsSize));
-    vs_.resize(vsSize);
-    is.read((char*)&vs_[0], sizeof(vs_[0]) * vs_.size());
-    if (!is){
+    release();
+    if (trie_.load(is) != 0){
+      return -1;
+    }
+    uint64_t vsSize = 0;
+    if (!readU64(is, vsSize) || vsSize != trie_.size() ||
+	!hasBytesLeft(is, sizeof(V) * vsSize)){
+      release();
+      return -1;
+    }
+    std::vector<V> vs(vsSize);
+    if (vsSize > 0){
+      is.read((char*)&vs[0], sizeof(vs[0]) * vs.size());
+    }
+    vs_.swap(vs);
+    // skip the alignment padding, which is missing in files saved by older versions
+    const uint64_t bytes = sizeof(V) * vsSize;
+    is.ignore(alignedSize(bytes) - bytes);
+    if (is.fail()){
+      release();
       return -1;
     } else {
       return 0;
     }
   }
 
+  /**
+   * Save the map in a file
+   * @param fileName The file name
+   * @return 0 on success, -1 on failure
+   */
+  int save(const char* fileName) const {
+    return saveFile(*this, fileName);
+  }
+
+  /**
+   * Load the map from a file
+   * @param fileName The file name
+   * @return 0 on success, -1 on failure
+   */
+  int load(const char* fileName){
+    return loadFile(*this, fileName);
+  }
+
+  /**
+   * Append the image of the map to a buffer. The image is the same as the one by save().
+   * @param buf The image is appended to buf
+   * @return 0 on success, -1 on failure
+   */
+  int saveToBuffer(std::string& buf) const {
+    if (trie_.saveToBuffer(buf) != 0){
+      return -1;
+    }
+    Array<V> folded;
+    const Array<V>& vs   = savedValues(folded);
+    const uint64_t num   = vs.size();
+    const uint64_t bytes = sizeof(V) * num;
+    const size_t start = buf.size();
+    buf.resize(start + sizeof(num) + alignedSize(bytes), '\0');
+    memcpy(&buf[start], &num, sizeof(num));
+    if (num > 0){
+      memcpy(&buf[start + sizeof(num)], vs.data(), bytes);
+    }
+    return 0;
+  }
+
+  /**
+   * Load the map from an image in memory by copying it. 
+   * The image may be unaligned, and need not outlive the map.
+   * @param ptr The beginning of the image
+   * @param size The size of the image in bytes
+   * @return 0 on success, -1 on failure
+   */
+  int loadFromBuffer(const void* ptr, size_t size){
+    release();
+    const char* p = static_cast<const char*>(ptr);
+    size_t used = 0;
+    if (trie_.loadFromBuffer(p, size, &used) != 0){
+      return -1;
+    }
+    uint64_t num = 0;
+    if (size - used < sizeof(num)){
+      trie_.clear();
+      return -1;
+    }
+    memcpy(&num, p + used, sizeof(num));
+    used += sizeof(num);
+    if (num != trie_.size() || num > (size - used) / sizeof(V)){
+      trie_.clear();
+      return -1;
+    }
+    std::vector<V> vs(num);
+    if (num > 0){
+      memcpy(&vs[0], p + used, sizeof(V) * num);
+    }
+    vs_.swap(vs);
+    return 0;
+  }
+
+  /**
+   * Use an image saved by save() in memory without copying it.
+   * The image must be aligned to 8 bytes, and must outlive the map.
+   * The map is read only; set() fails until the following build() or load().
+   * @param ptr The beginning of the image
+   * @param size The size of the image in bytes
+   * @return 0 on success, -1 on failure
+   */
+  int view(const void* ptr, size_t size){
+    release();
+    size_t used = 0;
+    if (trie_.view(ptr, size, &used) != 0){
+      return -1;
+    }
+    const char* p = static_cast<const char*>(ptr) + used;
+    if (!vs_.view(p, static_cast<const char*>(ptr) + size) || vs_.size() != trie_.size()){
+      release();
+      return -1;
+    }
+    return 0;
+  }
+
+  /**
+   * Map a file saved by save() into memory, and use it without reading the whole file.
+   * The map is read only; set() fails until the following build() or load().
+   * @param fileName The file name
+   * @return 0 on success, -1 on failure
+   */
+  int map(const char* fileName){
+    return mapFile(*this, fileName, mmap_);
+  }
+
   /**
    * Get the number of keys 
    * @return the number of keys
@@ -235,10 +637,83 @@ public:
     return trie_.size();
   }
 
+  /**
+   * Clear the map
+   */
+  void clear(){
+    release();
+  }
+
 private:
+  // the values with the stripes added, which are put in folded if there are stripes
+  const Array<V>& savedValues(Array<V>& folded) const {
+    if (stripes_.empty()){
+      return vs_;
+    }
+    std::vector<V> vs(vs_.size());
+    for (size_t id = 0; id < vs.size(); ++id){
+      vs[id] = __atomic_load_n(&vs_[id], __ATOMIC_RELAXED);
+      for (size_t i = 0; i < stripes_.size(); ++i){
+	vs[id] += __atomic_load_n(&stripes_[i][id], __ATOMIC_RELAXED);
+      }
+    }
+    folded.swap(vs);
+    return folded;
+  }
+
+  V* mutableValue(const char* str, size_t len){
+    id_t id = trie_.lookup(str, len);
+    if (id == NOTFOUND || vs_.isView()){
+      return NULL;
+    }
+    return &vs_[id];
+  }
+
+  V maxOf(size_t begin, size_t end) const {
+    const size_t firstBlock = begin / AGGREGATE_BLOCK;
+    const size_t lastBlock  = (end - 1) / AGGREGATE_BLOCK;
+    V m = ordered_[begin];
+    if (lastBlock - firstBlock < 2){
+      for (size_t i = begin + 1; i < end; ++i){
+	m = std::max(m, ordered_[i]);
+      }
+      return m;
+    }
+    // the partial blocks at both ends, and the full blocks between them
+    for (size_t i = begin + 1; i < (firstBlock + 1) * AGGREGATE_BLOCK; ++i){
+      m = std::max(m, ordered_[i]);
+    }
+    for (size_t i = lastBlock * AGGREGATE_BLOCK; i < end; ++i){
+      m = std::max(m, ordered_[i]);
+    }
+    const size_t k = lg2(lastBlock - firstBlock - 1) - 1;
+    m = std::max(m, blockMaxes_[k][firstBlock + 1]);
+    return std::max(m, blockMaxes_[k][lastBlock - ((size_t)1 << k)]);
+  }
+
+  void release(){
+    ordered_.clear();
+    sums_.clear();
+    blockMaxes_.clear();
+    stripes_.clear();
+    vs_.clear();
+    trie_.clear();
+    delete mmap_;
+    mmap_ = NULL;
+  }
+
   Trie trie_;
-  std::vector<V> vs_;
+  Array<V> vs_;
+  std::vector<std::vector<V> > stripes_; // stripes except the first one, which is vs_
+
+  enum {
+    AGGREGATE_BLOCK = 64
+  };
+  std::vector<V> ordered_;       // values in the order of predictiveSearch()
+  std::vector<V> sums_;          // sums_[i] is the sum of ordered_[0, i)
+  std::vector<std::vector<V> > blockMaxes_;
   size_t size_;
+  MMapFile* mmap_;
 };
 
 
@@ -20,7 +20,13 @@
 #include <gtest/gtest.h>
 #include <vector>
 #include <string>
+#include <sstream>
+#include <fstream>
 #include "uxMap.hpp"
+#include "uxBlobMap.hpp"
+#include "uxPackedMap.hpp"
+#include "uxMultiMap.hpp"
+#include "uxThread.hpp"
 
 using namespace std;
 
@@ -136,4 +142,648 @@ TEST(uxmap, save){
     ASSERT_EQ(0, uxm_load.get(key.c_str(), key.size(), ret));
     ASSERT_EQ(it->second, ret);
   }
+
+  // broken value counts, which are followed by 7 values padded to 32 bytes
+  const uint64_t counts[] = {1, 8, 0x8000000000LLU};
+  for (size_t i = 0; i < 3; ++i){
+    string broken = os.str();
+    memcpy(&broken[broken.size() - 40], &counts[i], sizeof(counts[i]));
+    istringstream bis(broken);
+    ASSERT_EQ(-1, uxm_load.load(bis));
+    ASSERT_EQ(0U, uxm_load.size());
+  }
+}
+
+TEST(uxmap, exact){
+  vector<pair<string, int> > kvs;
+  kvs.push_back(make_pair("abc", 1));
+  kvs.push_back(make_pair("abcdefg", 2));
+
+  ux::Map<int> uxm;
+  uxm.build(kvs);
+
+  int ret = -1;
+  ASSERT_EQ(-1, uxm.get("abcd", 4, ret));
+  ASSERT_EQ(-1, uxm.set("abcd", 4, 3));
+  ASSERT_EQ(0, uxm.get("abc", 3, ret));
+  ASSERT_EQ(1, ret);
+  ASSERT_EQ(0, uxm.get("abcdefg", 7, ret));
+  ASSERT_EQ(2, ret);
+}
+
+TEST(uxmap, duplicatedKey){
+  vector<pair<string, int> > kvs;
+  kvs.push_back(make_pair("in",  1));
+  kvs.push_back(make_pair("to",  2));
+  kvs.push_back(make_pair("in",  3));
+
+  ux::Map<int> uxm;
+  uxm.build(kvs);
+  ASSERT_EQ(2, uxm.size());
+
+  int ret = -1;
+  ASSERT_EQ(0, uxm.get("in", 2, ret));
+  ASSERT_EQ(3, ret);
+  ASSERT_EQ(0, uxm.get("to", 2, ret));
+  ASSERT_EQ(2, ret);
+}
+
+TEST(uxmap, merge){
+  vector<pair<string, int> > kvs1;
+  kvs1.push_back(make_pair("in",  1));
+  kvs1.push_back(make_pair("to",  2));
+  vector<pair<string, int> > kvs2;
+  kvs2.push_back(make_pair("inn", 3));
+  kvs2.push_back(make_pair("to",  4));
+
+  ux::Map<int> uxm1;
+  uxm1.build(kvs1);
+  ux::Map<int> uxm2;
+  uxm2.build(kvs2);
+  const ux::Map<int>* inputs[] = {&uxm1, &uxm2};
+  ASSERT_EQ(0, uxm1.merge(inputs, 2));
+  ASSERT_EQ(3, uxm1.size());
+
+  int ret = -1;
+  ASSERT_EQ(0, uxm1.get("in", 2, ret));
+  ASSERT_EQ(1, ret);
+  ASSERT_EQ(0, uxm1.get("inn", 3, ret));
+  ASSERT_EQ(3, ret);
+  ASSERT_EQ(0, uxm1.get("to", 2, ret));
+  ASSERT_EQ(4, ret);
+}
+
+TEST(uxmap, mmap){
+  vector<pair<string, short> > kvs;
+  for (int i = 0; i < 1000; ++i){
+    ostringstream os;
+    os << "key" << i * 13;
+    kvs.push_back(make_pair(os.str(), (short)i)); // values are not aligned to 8 bytes
+  }
+  ux::Map<short> uxm;
+  uxm.build(kvs);
+  const char* fn = "uxMapTestMMap.ind";
+  ofstream ofs(fn, ios::binary);
+  ASSERT_EQ(0, uxm.save(ofs));
+  ofs.close();
+
+  ux::Map<short> mapped;
+  ASSERT_EQ(0, mapped.map(fn));
+  ifstream ifs(fn, ios::binary);
+  ux::Map<short> loaded;
+  ASSERT_EQ(0, loaded.load(ifs));
+  ASSERT_EQ(0, remove(fn));
+
+  ASSERT_EQ(uxm.size(), mapped.size());
+  for (size_t i = 0; i < kvs.size(); ++i){
+    const string& key = kvs[i].first;
+    short v1 = -1;
+    short v2 = -1;
+    ASSERT_EQ(0, mapped.get(key.c_str(), key.size(), v1));
+    ASSERT_EQ(0, loaded.get(key.c_str(), key.size(), v2));
+    ASSERT_EQ(kvs[i].second, v1);
+    ASSERT_EQ(kvs[i].second, v2);
+  }
+  ASSERT_EQ(-1, mapped.set("key0", 4, 5)); // read only
+  ASSERT_EQ(0, loaded.set("key0", 4, 5));
+
+  // build() replaces the mapping
+  mapped.build(kvs);
+  ASSERT_EQ(0, mapped.set("key0", 4, 5));
+}
+
+TEST(uxmap, buffer){
+  vector<pair<string, short> > kvs;
+  for (int i = 0; i < 1000; ++i){
+    ostringstream os;
+    os << "key" << i * 13;
+    kvs.push_back(make_pair(os.str(), (short)i));
+  }
+  ux::Map<short> uxm;
+  uxm.build(kvs);
+  ostringstream os;
+  ASSERT_EQ(0, uxm.save(os));
+  string buf;
+  ASSERT_EQ(0, uxm.saveToBuffer(buf));
+  ASSERT_TRUE(os.str() == buf);
+
+  vector<uint64_t> aligned(buf.size() / 8);
+  memcpy(&aligned[0], buf.c_str(), buf.size());
+  ux::Map<short> loaded;
+  ux::Map<short> viewed;
+  ASSERT_EQ(0, loaded.loadFromBuffer(buf.c_str(), buf.size()));
+  ASSERT_EQ(0, viewed.view(&aligned[0], buf.size()));
+  ASSERT_EQ(-1, loaded.loadFromBuffer(buf.c_str(), buf.size() - 8));
+  ASSERT_EQ(0, loaded.loadFromBuffer(buf.c_str(), buf.size()));
+  for (size_t i = 0; i < kvs.size(); ++i){
+    const string& key = kvs[i].first;
+    short v1 = -1;
+    short v2 = -1;
+    ASSERT_EQ(0, loaded.get(key.c_str(), key.size(), v1));
+    ASSERT_EQ(0, viewed.get(key.c_str(), key.size(), v2));
+    ASSERT_EQ(kvs[i].second, v1);
+    ASSERT_EQ(kvs[i].second, v2);
+  }
+  ASSERT_EQ(0,  loaded.set("key0", 4, 5));
+  ASSERT_EQ(-1, viewed.set("key0", 4, 5));
+
+  // value counts different from the number of keys, which are followed by 2000 bytes
+  const uint64_t counts[] = {1, 999};
+  for (size_t i = 0; i < 2; ++i){
+    string broken = buf;
+    memcpy(&broken[broken.size() - 2008], &counts[i], sizeof(counts[i]));
+    memcpy(&aligned[0], broken.c_str(), broken.size());
+    ASSERT_EQ(-1, loaded.loadFromBuffer(broken.c_str(), broken.size()));
+    ASSERT_EQ(-1, viewed.view(&aligned[0], broken.size()));
+    ASSERT_EQ(0U, loaded.size());
+    ASSERT_EQ(0U, viewed.size());
+  }
+}
+
+TEST(uxblobmap, simple){
+  vector<pair<string, string> > kvs;
+  kvs.push_back(make_pair(string("tea"), string("green")));
+  kvs.push_back(make_pair(string("ten"), string("")));
+  kvs.push_back(make_pair(string("to"),  string(1000, 'x')));
+  kvs.push_back(make_pair(string("tea"), string("black")));
+  ux::BlobMap m;
+  m.build(kvs);
+  ASSERT_EQ(3U, m.size());
+
+  string v;
+  ASSERT_EQ(0, m.get("tea", 3, v));
+  ASSERT_EQ("black", v);
+  ASSERT_EQ(0, m.get("ten", 3, v));
+  ASSERT_EQ("", v);
+  ASSERT_EQ(-1, m.get("t", 1, v));
+  const char* p = NULL;
+  size_t len = 0;
+  ASSERT_EQ(0, m.get("to", 2, p, len));
+  ASSERT_EQ(string(1000, 'x'), string(p, len));
+  size_t retLen = 0;
+  ASSERT_EQ(0, m.prefixSearch("tomato", 6, retLen, p, len));
+  ASSERT_EQ(2U, retLen);
+  ASSERT_EQ(1000U, len);
+
+  ux::BlobMap empty;
+  empty.build(vector<pair<string, string> >(1, make_pair(string("a"), string())));
+  ASSERT_EQ(0, empty.get("a", 1, v));
+  ASSERT_EQ("", v);
+}
+
+TEST(uxblobmap, saveLoad){
+  map<string, string> kvs;
+  for (int i = 0; i < 1000; ++i){
+    ostringstream key;
+    ostringstream value;
+    key << "key" << i * 13;
+    value << string(i % 17, 'v') << i;
+    kvs[key.str()] = value.str();
+  }
+  ux::BlobMap m;
+  m.build(kvs);
+  ASSERT_EQ(0, m.save("uxblobmap.ind"));
+
+  ux::BlobMap loaded;
+  ux::BlobMap mapped;
+  ASSERT_EQ(0, loaded.load("uxblobmap.ind"));
+  ASSERT_EQ(0, mapped.map("uxblobmap.ind"));
+  for (map<string, string>::const_iterator it = kvs.begin(); it != kvs.end(); ++it){
+    string v1;
+    const char* p = NULL;
+    size_t len = 0;
+    ASSERT_EQ(0, loaded.get(it->first.c_str(), it->first.size(), v1));
+    ASSERT_EQ(0, mapped.get(it->first.c_str(), it->first.size(), p, len));
+    ASSERT_EQ(it->second, v1);
+    ASSERT_EQ(it->second, string(p, len));
+  }
+
+  ostringstream os;
+  ASSERT_EQ(0, m.save(os));
+  const string image = os.str();
+  vector<uint64_t> aligned(image.size() / 8);
+  memcpy(&aligned[0], image.c_str(), image.size());
+  ASSERT_EQ(0,  mapped.view(&aligned[0], image.size()));
+  ASSERT_EQ(-1, mapped.view(&aligned[0], image.size() - 8));
+  ASSERT_EQ(0U, mapped.size());
+}
+
+TEST(uxpackedmap, simple){
+  vector<pair<string, uint64_t> > kvs;
+  for (int i = 0; i < 1000; ++i){
+    ostringstream os;
+    os << "key" << i * 13;
+    kvs.push_back(make_pair(os.str(), (uint64_t)(1000 + i % 300)));
+  }
+  ux::PackedMap m;
+  m.build(kvs);
+  ASSERT_EQ(9U, m.valueLen()); // 0 to 299 after the minimum 1000
+  ASSERT_FALSE(m.isQuantized());
+  vector<ux::id_t> ids;
+  vector<uint64_t> expected;
+  for (size_t i = 0; i < kvs.size(); ++i){
+    uint64_t v = 0;
+    ASSERT_EQ(0, m.get(kvs[i].first.c_str(), kvs[i].first.size(), v));
+    ASSERT_EQ(kvs[i].second, v);
+    ids.push_back(m.trie().lookup(kvs[i].first.c_str(), kvs[i].first.size()));
+    expected.push_back(kvs[i].second);
+  }
+  vector<uint64_t> vs(ids.size());
+  m.getValues(&ids[0], ids.size(), &vs[0]);
+  ASSERT_EQ(expected, vs);
+  uint64_t v = 0;
+  ASSERT_EQ(-1, m.get("key", 3, v));
+
+  // a single value and the full range
+  kvs.resize(2);
+  kvs[1].second = 1000;
+  m.build(kvs);
+  ASSERT_EQ(0U, m.valueLen());
+  ASSERT_EQ(0, m.get("key0", 4, v));
+  ASSERT_EQ(1000U, v);
+  kvs[1].second = 0xFFFFFFFFFFFFFFFFULL;
+  kvs[0].second = 0;
+  m.build(kvs);
+  ASSERT_EQ(64U, m.valueLen());
+  ASSERT_EQ(0, m.get(kvs[1].first.c_str(), kvs[1].first.size(), v));
+  ASSERT_EQ(0xFFFFFFFFFFFFFFFFULL, v);
+  ASSERT_EQ(0, m.get("key0", 4, v));
+  ASSERT_EQ(0U, v);
+}
+
+TEST(uxpackedmap, quantized){
+  vector<pair<string, float> > kvs;
+  for (int i = 0; i < 1000; ++i){
+    ostringstream os;
+    os << "key" << i;
+    kvs.push_back(make_pair(os.str(), (float)(i % 10) * 0.5f));
+  }
+  ux::PackedMap m;
+  m.buildQuantized(kvs, 4);
+  ASSERT_TRUE(m.isQuantized());
+  ASSERT_EQ(4U, m.valueLen());
+  for (size_t i = 0; i < kvs.size(); ++i){
+    float v = 0;
+    ASSERT_EQ(0, m.get(kvs[i].first.c_str(), kvs[i].first.size(), v));
+    ASSERT_EQ(kvs[i].second, v); // 10 distinct values are kept exactly
+  }
+
+  for (int i = 0; i < 1000; ++i){
+    kvs[i].second = (float)i / 1000;
+  }
+  m.buildQuantized(kvs, 3);
+  ASSERT_EQ(8U, m.codebook().size());
+  vector<ux::id_t> ids;
+  for (size_t i = 0; i < kvs.size(); ++i){
+    float v = 0;
+    ASSERT_EQ(0, m.get(kvs[i].first.c_str(), kvs[i].first.size(), v));
+    ASSERT_NEAR(kvs[i].second, v, 1.0 / 16 + 1e-3);
+    ids.push_back(m.trie().lookup(kvs[i].first.c_str(), kvs[i].first.size()));
+  }
+  vector<float> fs(ids.size());
+  m.getFloats(&ids[0], ids.size(), &fs[0]);
+  for (size_t i = 0; i < ids.size(); ++i){
+    ASSERT_EQ(m.getFloat(ids[i]), fs[i]);
+  }
+}
+
+TEST(uxpackedmap, saveLoad){
+  map<string, uint64_t> kvs;
+  for (int i = 0; i < 1000; ++i){
+    ostringstream os;
+    os << "key" << i * 13;
+    kvs[os.str()] = i * i;
+  }
+  ux::PackedMap m;
+  m.build(kvs);
+  ASSERT_EQ(0, m.save("uxpackedmap.ind"));
+  ux::PackedMap loaded;
+  ux::PackedMap mapped;
+  ASSERT_EQ(0, loaded.load("uxpackedmap.ind"));
+  ASSERT_EQ(0, mapped.map("uxpackedmap.ind"));
+  for (map<string, uint64_t>::const_iterator it = kvs.begin(); it != kvs.end(); ++it){
+    uint64_t v1 = 0;
+    uint64_t v2 = 0;
+    ASSERT_EQ(0, loaded.get(it->first.c_str(), it->first.size(), v1));
+    ASSERT_EQ(0, mapped.get(it->first.c_str(), it->first.size(), v2));
+    ASSERT_EQ(it->second, v1);
+    ASSERT_EQ(it->second, v2);
+  }
+
+  vector<pair<string, float> > fkvs;
+  fkvs.push_back(make_pair(string("a"), 0.25f));
+  fkvs.push_back(make_pair(string("b"), 2.5f));
+  fkvs.push_back(make_pair(string("c"), -1.f));
+  m.buildQuantized(fkvs);
+  ostringstream os;
+  ASSERT_EQ(0, m.save(os));
+  const string image = os.str();
+  vector<uint64_t> aligned(image.size() / 8);
+  memcpy(&aligned[0], image.c_str(), image.size());
+  ASSERT_EQ(0, mapped.view(&aligned[0], image.size()));
+  float v = 0;
+  ASSERT_EQ(0, mapped.get("c", 1, v));
+  ASSERT_EQ(-1.f, v);
+  ASSERT_EQ(-1, mapped.view(&aligned[0], image.size() - 8));
+}
+
+namespace {
+
+struct CountTask {
+  ux::Map<uint64_t>* m;
+  const vector<string>* keys;
+  bool striped;
+  void run(){
+    for (int r = 0; r < 1000; ++r){
+      for (size_t i = 0; i < keys->size(); ++i){
+	const string& key = (*keys)[i];
+	if (striped){
+	  m->add(key.c_str(), key.size(), i + 1);
+	} else {
+	  m->fetchAdd(key.c_str(), key.size(), i + 1, NULL, ux::ORDER_RELAXED);
+	}
+      }
+    }
+  }
+};
+
+}
+
+TEST(uxmap, atomic){
+  vector<string> keys;
+  keys.push_back("a");
+  keys.push_back("b");
+  keys.push_back("c");
+  ux::Map<uint64_t> m;
+  m.build(keys);
+
+  uint64_t v = 0;
+  ASSERT_EQ(0, m.store("a", 1, 10));
+  ASSERT_EQ(0, m.fetchAdd("a", 1, 5, &v));
+  ASSERT_EQ(10U, v);
+  ASSERT_EQ(0, m.fetch("a", 1, v, ux::ORDER_ACQUIRE));
+  ASSERT_EQ(15U, v);
+  uint64_t expected = 10;
+  ASSERT_EQ(1, m.compareExchange("a", 1, expected, 20));
+  ASSERT_EQ(15U, expected);
+  ASSERT_EQ(0, m.compareExchange("a", 1, expected, 20, ux::ORDER_ACQ_REL));
+  ASSERT_EQ(0, m.get("a", 1, v));
+  ASSERT_EQ(20U, v);
+  ASSERT_EQ(-1, m.fetchAdd("d", 1, 1));
+  ASSERT_EQ(-1, m.store("d", 1, 1));
+  ASSERT_EQ(-1, m.fetch("d", 1, v));
+
+  for (int striped = 0; striped < 2; ++striped){
+    m.build(keys);
+    m.setStripeNum(striped ? 4 : 1);
+    vector<CountTask> tasks(4);
+    for (size_t t = 0; t < tasks.size(); ++t){
+      tasks[t].m       = &m;
+      tasks[t].keys    = &keys;
+      tasks[t].striped = striped;
+    }
+    ux::runTasks(tasks);
+    for (size_t i = 0; i < keys.size(); ++i){
+      ASSERT_EQ(0, m.sum(keys[i].c_str(), keys[i].size(), v));
+      ASSERT_EQ(4000 * (i + 1), v);
+    }
+    m.foldStripes();
+    for (size_t i = 0; i < keys.size(); ++i){
+      ASSERT_EQ(0, m.get(keys[i].c_str(), keys[i].size(), v));
+      ASSERT_EQ(4000 * (i + 1), v);
+    }
+  }
+}
+
+TEST(uxmap, stripedSave){
+  vector<string> keys;
+  keys.push_back("p/a");
+  keys.push_back("p/b");
+  keys.push_back("q");
+  ux::Map<uint64_t> m;
+  m.build(keys);
+  m.setStripeNum(8);
+  vector<CountTask> tasks(8);
+  for (size_t t = 0; t < tasks.size(); ++t){
+    tasks[t].m       = &m;
+    tasks[t].keys    = &keys;
+    tasks[t].striped = true;
+  }
+  ux::runTasks(tasks);
+
+  // saved without folding the stripes
+  ostringstream os;
+  ASSERT_EQ(0, m.save(os));
+  string buf;
+  ASSERT_EQ(0, m.saveToBuffer(buf));
+  ux::Map<uint64_t> loaded;
+  istringstream is(os.str());
+  ASSERT_EQ(0, loaded.load(is));
+  ux::Map<uint64_t> buffered;
+  ASSERT_EQ(0, buffered.loadFromBuffer(buf.data(), buf.size()));
+  for (size_t i = 0; i < keys.size(); ++i){
+    uint64_t v = 0;
+    ASSERT_EQ(0, loaded.get(keys[i].c_str(), keys[i].size(), v));
+    ASSERT_EQ(8000 * (i + 1), v);
+    ASSERT_EQ(0, buffered.get(keys[i].c_str(), keys[i].size(), v));
+    ASSERT_EQ(8000 * (i + 1), v);
+  }
+}
+
+TEST(uxmap, stripedMerge){
+  vector<string> keys;
+  keys.push_back("p/a");
+  keys.push_back("p/b");
+  keys.push_back("q");
+  ux::Map<uint64_t> m;
+  m.build(keys);
+  m.setStripeNum(8);
+  vector<CountTask> tasks(8);
+  for (size_t t = 0; t < tasks.size(); ++t){
+    tasks[t].m       = &m;
+    tasks[t].keys    = &keys;
+    tasks[t].striped = true;
+  }
+  ux::runTasks(tasks);
+
+  vector<pair<string, uint64_t> > kvs;
+  kvs.push_back(make_pair("r", 7));
+  ux::Map<uint64_t> other;
+  other.build(kvs);
+
+  // merged without folding the stripes
+  ux::Map<uint64_t> merged;
+  const ux::Map<uint64_t>* inputs[] = {&m, &other};
+  ASSERT_EQ(0, merged.merge(inputs, 2));
+  ASSERT_EQ(4U, merged.size());
+  uint64_t v = 0;
+  for (size_t i = 0; i < keys.size(); ++i){
+    ASSERT_EQ(0, merged.get(keys[i].c_str(), keys[i].size(), v));
+    ASSERT_EQ(8000U * (i + 1), v);
+  }
+  ASSERT_EQ(0, merged.get("r", 1, v));
+  ASSERT_EQ(7U, v);
+
+  // merged into one of the inputs
+  ASSERT_EQ(0, m.merge(inputs, 2));
+  ASSERT_EQ(0, m.get("q", 1, v));
+  ASSERT_EQ(24000U, v);
+}
+
+TEST(uxmap, stripedAggregates){
+  vector<string> keys;
+  keys.push_back("p/a");
+  keys.push_back("p/b");
+  keys.push_back("q");
+  ux::Map<uint64_t> m;
+  m.setCountIndex(true);
+  m.build(keys);
+  m.setStripeNum(8);
+  vector<CountTask> tasks(8);
+  for (size_t t = 0; t < tasks.size(); ++t){
+    tasks[t].m       = &m;
+    tasks[t].keys    = &keys;
+    tasks[t].striped = true;
+  }
+  ux::runTasks(tasks);
+
+  // aggregated without folding the stripes
+  ASSERT_EQ(0, m.buildAggregates());
+  uint64_t v = 0;
+  ASSERT_EQ(0, m.aggregatePrefix("p/", 2, ux::AGGREGATE_SUM, v));
+  ASSERT_EQ(8000 * 1 + 8000 * 2, v);
+  ASSERT_EQ(0, m.aggregatePrefix("", 0, ux::AGGREGATE_SUM, v));
+  ASSERT_EQ(8000 * 6, v);
+  ASSERT_EQ(0, m.aggregatePrefix("", 0, ux::AGGREGATE_MAX, v));
+  ASSERT_EQ(8000 * 3, v);
+}
+
+TEST(uxmultimap, simple){
+  vector<pair<string, int> > kvs;
+  kvs.push_back(make_pair(string("run"),   1));
+  kvs.push_back(make_pair(string("r"),     2));
+  kvs.push_back(make_pair(string("run"),   3));
+  kvs.push_back(make_pair(string("runs"),  4));
+  kvs.push_back(make_pair(string("run"),   5));
+  ux::MultiMap<int> m;
+  m.build(kvs);
+  ASSERT_EQ(3U, m.size());
+  ASSERT_EQ(5U, m.valueNum());
+
+  pair<const int*, const int*> r = m.equal_range("run", 3);
+  ASSERT_EQ(3, r.second - r.first);
+  ASSERT_EQ(1, r.first[0]);
+  ASSERT_EQ(3, r.first[1]);
+  ASSERT_EQ(5, r.first[2]);
+  ASSERT_EQ(1U, m.count("runs", 4));
+  ASSERT_EQ(0U, m.count("ru", 2));
+
+  vector<ux::MultiMap<int>::Range> ranges;
+  ASSERT_EQ(3U, m.commonPrefixSearch("runs", 4, ranges));
+  ASSERT_EQ(1U, ranges[0].size());
+  ASSERT_EQ(2, *ranges[0].begin);
+  ASSERT_EQ(3U, ranges[1].size());
+  ASSERT_EQ(4, *ranges[2].begin);
+  ASSERT_EQ("runs", m.trie().decodeKey(ranges[2].id));
+  ASSERT_EQ(2U, m.predictiveSearch("ru", 2, ranges));
+  ASSERT_EQ(4U, ranges[0].size() + ranges[1].size());
+}
+
+TEST(uxmultimap, saveLoad){
+  multimap<string, short> kvs;
+  for (int i = 0; i < 1000; ++i){
+    ostringstream os;
+    os << "key" << i % 97;
+    kvs.insert(make_pair(os.str(), (short)i));
+  }
+  ux::MultiMap<short> m;
+  m.build(kvs);
+  ASSERT_EQ(0, m.save("uxmultimap.ind"));
+  ux::MultiMap<short> loaded;
+  ux::MultiMap<short> mapped;
+  ASSERT_EQ(0, loaded.load("uxmultimap.ind"));
+  ASSERT_EQ(0, mapped.map("uxmultimap.ind"));
+  for (int i = 0; i < 97; ++i){
+    ostringstream os;
+    os << "key" << i;
+    const string key = os.str();
+    typedef multimap<string, short>::const_iterator It;
+    pair<It, It> expected = kvs.equal_range(key);
+    vector<short> vs;
+    for (It it = expected.first; it != expected.second; ++it){
+      vs.push_back(it->second);
+    }
+    pair<const short*, const short*> r1 = loaded.equal_range(key.c_str(), key.size());
+    pair<const short*, const short*> r2 = mapped.equal_range(key.c_str(), key.size());
+    ASSERT_EQ(vs, vector<short>(r1.first, r1.second));
+    ASSERT_EQ(vs, vector<short>(r2.first, r2.second));
+  }
+  ostringstream os;
+  ASSERT_EQ(0, m.save(os));
+  const string image = os.str();
+  vector<uint64_t> aligned(image.size() / 8);
+  memcpy(&aligned[0], image.c_str(), image.size());
+  ASSERT_EQ(-1, mapped.view(&aligned[0], image.size() - 8));
+  ASSERT_EQ(0U, mapped.size());
+}
+
+TEST(uxmap, aggregatePrefix){
+  vector<pair<string, int> > kvs;
+  for (int i = 0; i < 5000; ++i){
+    ostringstream os;
+    os << "/" << i % 7 << "/" << i % 13 << "/" << i;
+    kvs.push_back(make_pair(os.str(), (i * 7919) % 10007 - 5000));
+  }
+  kvs.push_back(make_pair(string("/"), 1));
+  kvs.push_back(make_pair(string("/1/1/x"), 3));
+  ux::Map<int> m;
+  m.build(kvs);
+  int v = 0;
+  ASSERT_EQ(-1, m.buildAggregates()); // the trie does not keep the ranks
+  ASSERT_EQ(-1, m.aggregatePrefix("/", 1, ux::AGGREGATE_SUM, v));
+  m.setCountIndex(true);
+  m.build(kvs);
+  ASSERT_EQ(-1, m.aggregatePrefix("/", 1, ux::AGGREGATE_SUM, v));
+  ASSERT_EQ(0, m.buildAggregates());
+
+  const char* prefixes[] = {"", "/", "/1", "/1/", "/1/1", "/1/1/", "/1/1/x", "/1/1/1", 
+			    "/3/11/4", "/3/11/40", "/2/0/14", "/9"};
+  for (size_t p = 0; p < sizeof(prefixes) / sizeof(prefixes[0]); ++p){
+    const string prefix(prefixes[p]);
+    int sum = 0;
+    int count = 0;
+    int maxValue = 0;
+    for (size_t i = 0; i < kvs.size(); ++i){
+      if (kvs[i].first.compare(0, prefix.size(), prefix) != 0) continue;
+      sum += kvs[i].second;
+      maxValue = (count == 0) ? kvs[i].second : max(maxValue, kvs[i].second);
+      ++count;
+    }
+    if (count == 0){
+      ASSERT_EQ(-1, m.aggregatePrefix(prefix.c_str(), prefix.size(), ux::AGGREGATE_SUM, v));
+      continue;
+    }
+    ASSERT_EQ(0, m.aggregatePrefix(prefix.c_str(), prefix.size(), ux::AGGREGATE_SUM, v));
+    ASSERT_EQ(sum, v) << prefix;
+    ASSERT_EQ(0, m.aggregatePrefix(prefix.c_str(), prefix.size(), ux::AGGREGATE_COUNT, v));
+    ASSERT_EQ(count, v) << prefix;
+    ASSERT_EQ(0, m.aggregatePrefix(prefix.c_str(), prefix.size(), ux::AGGREGATE_MAX, v));
+    ASSERT_EQ(maxValue, v) << prefix;
+  }
+}
+
+TEST(uxmap, search){
+  vector<pair<string, int> > kvs;
+  kvs.push_back(make_pair(string("a"),   1));
+  kvs.push_back(make_pair(string("ab"),  2));
+  kvs.push_back(make_pair(string("abc"), 3));
+  kvs.push_back(make_pair(string("b"),   4));
+  ux::Map<int> m;
+  m.build(kvs);
+  vector<int> vs;
+  ASSERT_EQ(2U, m.commonPrefixSearch("abd", 3, vs));
+  ASSERT_EQ(1, vs[0]);
+  ASSERT_EQ(2, vs[1]);
+  ASSERT_EQ(3U, m.predictiveSearch("a", 1, vs));
+  ASSERT_EQ(6, vs[0] + vs[1] + vs[2]);
 }
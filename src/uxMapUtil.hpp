@@ -0,0 +1,159 @@
+/* 
+ *  Copyright (c) 2010 Daisuke Okanohara
+ * 
+ *   Redistribution and use in source and binary forms, with or without
+ *   modification, are permitted provided that the following conditions
+ *   are met:
+ * 
+ *   1. Redistributions of source code must retain the above Copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *   2. Redistributions in binary form must reproduce the above Copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ *   3. Neither the name of the authors nor the names of its contributors
+ *      may be used to endorse or promote products derived from this
+ *      software without specific prior written permission.
+ */
+
+#ifndef UX_MAP_UTIL_HPP__
+#define UX_MAP_UTIL_HPP__
+
+#include <vector>
+#include <iostream>
+#include <fstream>
+#include "bitVec.hpp"
+#include "uxArray.hpp"
+#include "uxUtil.hpp"
+#include "uxMMap.hpp"
+
+namespace ux{
+
+/**
+ * Offsets of the values of each key, where the values of the i-th key are 
+ * values[offsets[i], offsets[i+1]). Offsets are packed in lg2(the last offset) bits each, 
+ * so that an offset is found in O(1) without a select.
+ */
+class PackedOffsets {
+public:
+  PackedOffsets() : len_(0) {}
+
+  /**
+   * Pack offsets
+   * @param offsets Non-decreasing offsets, the last of which is the number of values
+   */
+  void build(const std::vector<uint64_t>& offsets){
+    clear();
+    len_ = offsets.empty() ? 0 : lg2(offsets.back());
+    if (len_ > 0){
+      for (size_t i = 0; i < offsets.size(); ++i){
+	bits_.push_back_with_len(offsets[i], len_);
+      }
+    }
+  }
+
+  /**
+   * Return the i-th offset
+   * @param i The position
+   * @return The offset
+   */
+  uint64_t operator[](uint64_t i) const {
+    return len_ ? bits_.getBits(i * len_, len_) : 0;
+  }
+
+  /**
+   * Check loaded offsets
+   * @param keyNum The number of keys, which is one less than the number of offsets
+   * @param valueNum The number of values
+   * @return true if the offsets cover valueNum values of keyNum keys
+   */
+  bool isValid(uint64_t keyNum, uint64_t valueNum) const {
+    return bits_.size() == (len_ ? (keyNum + 1) * len_ : 0) && (*this)[keyNum] == valueNum;
+  }
+
+  void save(std::ostream& os) const {
+    writeU64(os, len_);
+    bits_.save(os);
+  }
+
+  bool load(std::istream& is){
+    clear();
+    if (!readU64(is, len_) || len_ >= 64){
+      return false;
+    }
+    bits_.load(is);
+    return !is.fail();
+  }
+
+  bool view(const char*& p, const char* end){
+    clear();
+    return viewU64(p, end, len_) && len_ < 64 && bits_.view(p, end);
+  }
+
+  size_t getAllocSize() const {
+    return bits_.getAllocSize();
+  }
+
+  void clear(){
+    len_ = 0;
+    bits_.clear();
+  }
+
+private:
+  uint64_t len_;
+  BitVec bits_;
+};
+
+/**
+ * Save a map in a file by its save(std::ostream&)
+ * @param m The map
+ * @param fileName The file name
+ * @return 0 on success, -1 on failure
+ */
+template <class M>
+int saveFile(const M& m, const char* fileName){
+  std::ofstream ofs(fileName, std::ios::binary);
+  if (!ofs){
+    return -1;
+  }
+  return m.save(ofs);
+}
+
+/**
+ * Load a map from a file by its load(std::istream&)
+ * @param m The map
+ * @param fileName The file name
+ * @return 0 on success, -1 on failure
+ */
+template <class M>
+int loadFile(M& m, const char* fileName){
+  std::ifstream ifs(fileName, std::ios::binary);
+  if (!ifs){
+    return -1;
+  }
+  return m.load(ifs);
+}
+
+/**
+ * Map a file into memory, and use the map in it by its view()
+ * @param m The map, which is cleared on failure
+ * @param fileName The file name
+ * @param mmap The mapping, which is set on success. The previous one is released by view().
+ * @return 0 on success, -1 on failure
+ */
+template <class M>
+int mapFile(M& m, const char* fileName, MMapFile*& mmap){
+  MMapFile* file = new MMapFile;
+  if (!file->open(fileName) || m.view(file->data(), file->size()) != 0){
+    delete file;
+    m.clear();
+    return -1;
+  }
+  mmap = file;
+  return 0;
+}
+
+}
+
+#endif // UX_MAP_UTIL_HPP__
@@ -0,0 +1,327 @@
+/* 
+ *  Copyright (c) 2010 Daisuke Okanohara
+ * 
+ *   Redistribution and use in source and binary forms, with or without
+ *   modification, are permitted provided that the following conditions
+ *   are met:
+ * 
+ *   1. Redistributions of source code must retain the above Copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *   2. Redistributions in binary form must reproduce the above Copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ *   3. Neither the name of the authors nor the names of its contributors
+ *      may be used to endorse or promote products derived from this
+ *      software without specific prior written permission.
+ */
+
+#ifndef UX_MULTI_MAP_HPP__
+#define UX_MULTI_MAP_HPP__
+
+#include <vector>
+#include <map>
+#include <string>
+#include <iostream>
+#include "uxTrie.hpp"
+#include "uxArray.hpp"
+#include "uxMapUtil.hpp"
+
+namespace ux{
+
+/**
+ * Succinct map from a key to a list of values.
+ * Values are stored in one array grouped by key IDs, and the values of the i-th key are 
+ * values[offsets[i], offsets[i+1]). Offsets are packed in lg2(the number of values) bits each.
+ * The values of a key are kept in the input order.
+ * Queries return ranges in the value array without copying values.
+ */
+template <class V>
+class MultiMap{
+public:
+  /**
+   * The values of a key
+   */
+  struct Range {
+    id_t id;       // The ID of the key
+    const V* begin;
+    const V* end;
+    size_t size() const { return end - begin; }
+  };
+
+  /**
+   * Constructor
+   */
+  MultiMap() : mmap_(NULL){}
+
+  /**
+   * Destructor
+   */
+  ~MultiMap(){
+    delete mmap_;
+  }
+
+  /**
+   * Use a Bloom filter to reject missing keys in equal_range()
+   * @param bitsPerKey The number of filter bits per key, or 0 to disable the filter
+   */
+  void setFilterBitsPerKey(size_t bitsPerKey){
+    trie_.setFilterBitsPerKey(bitsPerKey);
+  }
+
+  /**
+   * Build a map from the vector of the pair of a key and a value. 
+   * All values of a key are kept.
+   * @param kvs A vector of the pair of a key and a value
+   */
+  void build(const std::vector<std::pair<std::string, V> >& kvs){
+    std::vector<id_t> ids;
+    clear();
+    trie_.buildKeys(kvs.begin(), kvs.end(), ids);
+
+    // group values by IDs keeping the input order
+    std::vector<uint64_t> starts(trie_.size() + 1, 0);
+    for (size_t i = 0; i < ids.size(); ++i){
+      ++starts[ids[i] + 1];
+    }
+    for (size_t id = 0; id < trie_.size(); ++id){
+      starts[id + 1] += starts[id];
+    }
+    offsets_.build(starts);
+    std::vector<V> vs(kvs.size());
+    for (size_t i = 0; i < kvs.size(); ++i){
+      vs[starts[ids[i]]++] = kvs[i].second;
+    }
+    vs_.swap(vs);
+  }
+
+  /**
+   * Build a map from std::multimap
+   * @param m A std::multimap as an input
+   */
+  void build(const std::multimap<std::string, V>& m){
+    std::vector<std::pair<std::string, V> > kvs(m.begin(), m.end());
+    build(kvs);
+  }
+
+  /**
+   * Return the values of a key
+   * @param str the key
+   * @param len the length of str
+   * @return The range of the values, which is empty if not found
+   */
+  std::pair<const V*, const V*> equal_range(const char* str, size_t len) const {
+    const id_t id = trie_.lookup(str, len);
+    if (id == NOTFOUND){
+      return std::make_pair(vs_.data(), vs_.data());
+    }
+    const Range r = range(id);
+    return std::make_pair(r.begin, r.end);
+  }
+
+  /**
+   * Return the number of values of a key
+   * @param str the key
+   * @param len the length of str
+   * @return The number of values
+   */
+  size_t count(const char* str, size_t len) const {
+    const std::pair<const V*, const V*> r = equal_range(str, len);
+    return r.second - r.first;
+  }
+
+  /**
+   * Return the values of a key ID given by the trie
+   * @param id The ID of the key
+   * @return The range of the values
+   */
+  Range range(id_t id) const {
+    Range r;
+    r.id    = id;
+    r.begin = vs_.data() + offsets_[id];
+    r.end   = vs_.data() + offsets_[id + 1];
+    return r;
+  }
+
+  /** 
+   * Return the values of all keys that match the prefix of the query, from the shortest key
+   * @param str the query
+   * @param len the length of the query
+   * @param ranges The values of each matched key
+   * @param limit The maximum number of matched keys
+   * @return The number of matched keys
+   */
+  size_t commonPrefixSearch(const char* str, size_t len, std::vector<Range>& ranges, 
+			    size_t limit = LIMIT_DEFAULT) const {
+    std::vector<id_t> ids;
+    trie_.commonPrefixSearch(str, len, ids, limit);
+    return toRanges(ids, ranges);
+  }
+
+  /** 
+   * Return the values of all keys whose prefixes match the query
+   * @param str the query
+   * @param len the length of the query
+   * @param ranges The values of each matched key
+   * @param limit The maximum number of matched keys
+   * @return The number of matched keys
+   */
+  size_t predictiveSearch(const char* str, size_t len, std::vector<Range>& ranges, 
+			  size_t limit = LIMIT_DEFAULT) const {
+    std::vector<id_t> ids;
+    trie_.predictiveSearch(str, len, ids, limit);
+    return toRanges(ids, ranges);
+  }
+
+  /**
+   * @return The trie of the keys
+   */
+  const Trie& trie() const {
+    return trie_;
+  }
+
+  /**
+   * Return the key for the given ID
+   * @param id The ID of the key
+   * @param ret The key for the given ID or empty if such ID does not exist
+   */ 
+  void decodeKey(id_t id, std::string& ret) const {
+    trie_.decodeKey(id, ret);
+  }
+
+  /**
+   * Save the map in ostream
+   * @param os The ostream as an output 
+   * @return 0 on success, -1 on failure
+   */
+  int save(std::ostream& os) const {
+    if (trie_.save(os) != 0){
+      return -1;
+    }
+    offsets_.save(os);
+    vs_.save(os);
+    return os ? 0 : -1;
+  }
+
+  /**
+   * Load the map from istream
+   * @param is The istream as an input
+   * @return 0 on success, -1 on failure
+   */
+  int load(std::istream& is){
+    clear();
+    if (trie_.load(is) != 0 || !offsets_.load(is) || !vs_.load(is) ||
+	!offsets_.isValid(trie_.size(), vs_.size())){
+      clear();
+      return -1;
+    }
+    return 0;
+  }
+
+  /**
+   * Save the map in a file
+   * @param fileName The file name
+   * @return 0 on success, -1 on failure
+   */
+  int save(const char* fileName) const {
+    return saveFile(*this, fileName);
+  }
+
+  /**
+   * Load the map from a file
+   * @param fileName The file name
+   * @return 0 on success, -1 on failure
+   */
+  int load(const char* fileName){
+    return loadFile(*this, fileName);
+  }
+
+  /**
+   * Use an image saved by save() in memory without copying it.
+   * The image must be aligned to 8 bytes, and must outlive the map.
+   * @param ptr The beginning of the image
+   * @param size The size of the image in bytes
+   * @return 0 on success, -1 on failure
+   */
+  int view(const void* ptr, size_t size){
+    clear();
+    size_t used = 0;
+    if (trie_.view(ptr, size, &used) != 0){
+      return -1;
+    }
+    const char* p   = static_cast<const char*>(ptr) + used;
+    const char* end = static_cast<const char*>(ptr) + size;
+    if (!offsets_.view(p, end) || !vs_.view(p, end) ||
+	!offsets_.isValid(trie_.size(), vs_.size())){
+      clear();
+      return -1;
+    }
+    return 0;
+  }
+
+  /**
+   * Map a file saved by save() into memory, and use it without reading the whole file.
+   * @param fileName The file name
+   * @return 0 on success, -1 on failure
+   */
+  int map(const char* fileName){
+    return mapFile(*this, fileName, mmap_);
+  }
+
+  /**
+   * Get the number of keys 
+   * @return the number of keys
+   */
+  size_t size() const {
+    return trie_.size();
+  }
+
+  /**
+   * Get the number of values
+   * @return the number of values
+   */
+  size_t valueNum() const {
+    return vs_.size();
+  }
+
+  /**
+   * Return the size of the values in bytes
+   * @return The size of the values and the offsets
+   */
+  size_t getAllocSize() const {
+    return vs_.size() * sizeof(V) + offsets_.getAllocSize();
+  }
+
+  /**
+   * Clear the internal state
+   */
+  void clear(){
+    trie_.clear();
+    offsets_.clear();
+    vs_.clear();
+    delete mmap_;
+    mmap_ = NULL;
+  }
+
+private:
+  MultiMap(const MultiMap&);
+  MultiMap& operator=(const MultiMap&);
+
+  size_t toRanges(const std::vector<id_t>& ids, std::vector<Range>& ranges) const {
+    ranges.resize(ids.size());
+    for (size_t i = 0; i < ids.size(); ++i){
+      ranges[i] = range(ids[i]);
+    }
+    return ranges.size();
+  }
+
+  Trie trie_;
+  PackedOffsets offsets_;
+  Array<V> vs_;
+  MMapFile* mmap_;
+};
+
+}
+
+#endif // UX_MULTI_MAP_HPP__
@@ -0,0 +1,250 @@
+/* 
+ *  Copyright (c) 2010 Daisuke Okanohara
+ * 
+ *   Redistribution and use in source and binary forms, with or without
+ *   modification, are permitted provided that the following conditions
+ *   are met:
+ * 
+ *   1. Redistributions of source code must retain the above Copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *   2. Redistributions in binary form must reproduce the above Copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ *   3. Neither the name of the authors nor the names of its contributors
+ *      may be used to endorse or promote products derived from this
+ *      software without specific prior written permission.
+ */
+
+#include <algorithm>
+#include "uxPackedMap.hpp"
+#include "uxMapUtil.hpp"
+
+using namespace std;
+
+namespace ux{
+
+static const size_t CODE_LEN_MAX = 24;
+
+// the index of the nearest value in the sorted codebook
+static uint64_t nearestCode(const vector<float>& codebook, const float v){
+  const size_t i = lower_bound(codebook.begin(), codebook.end(), v) - codebook.begin();
+  if (i == codebook.size()) return i - 1;
+  if (i > 0 && v - codebook[i-1] < codebook[i] - v) return i - 1;
+  return i;
+}
+
+PackedMap::PackedMap() : valueLen_(0), minValue_(0), mmap_(NULL){
+}
+
+PackedMap::~PackedMap(){
+  delete mmap_;
+}
+
+void PackedMap::setFilterBitsPerKey(const size_t bitsPerKey){
+  trie_.setFilterBitsPerKey(bitsPerKey);
+}
+
+void PackedMap::build(const std::map<string, uint64_t>& m){
+  vector<pair<string, uint64_t> > kvs(m.begin(), m.end());
+  build(kvs);
+}
+
+void PackedMap::build(const vector<pair<string, uint64_t> >& kvs){
+  clear();
+  vector<uint64_t> vs;
+  trie_.buildKeyValues(kvs.begin(), kvs.end(), vs);
+  buildValues(vs, true);
+}
+
+void PackedMap::buildQuantized(const vector<pair<string, float> >& kvs, size_t codeLen){
+  clear();
+  codeLen = max((size_t)1, min(codeLen, CODE_LEN_MAX));
+  vector<float> fs;
+  trie_.buildKeyValues(kvs.begin(), kvs.end(), fs);
+
+  vector<float> sorted(fs);
+  sort(sorted.begin(), sorted.end());
+  vector<float> codebook(sorted);
+  codebook.erase(unique(codebook.begin(), codebook.end()), codebook.end());
+  const size_t codeNum = (size_t)1 << codeLen;
+  if (codebook.size() > codeNum){
+    // the mean of each bucket of the same number of values
+    codebook.clear();
+    for (size_t c = 0; c < codeNum; ++c){
+      const size_t begin = sorted.size() * c / codeNum;
+      const size_t end   = sorted.size() * (c + 1) / codeNum;
+      double sum = 0;
+      for (size_t i = begin; i < end; ++i){
+	sum += sorted[i];
+      }
+      codebook.push_back((float)(sum / (end - begin)));
+    }
+    codebook.erase(unique(codebook.begin(), codebook.end()), codebook.end());
+  }
+  if (codebook.empty()){
+    codebook.push_back(0.f);
+  }
+
+  vector<uint64_t> codes(fs.size());
+  for (size_t i = 0; i < fs.size(); ++i){
+    codes[i] = nearestCode(codebook, fs[i]);
+  }
+  buildValues(codes, false);
+  // pad the codebook so that any code of valueLen_ bits is in it
+  codebook.resize((size_t)1 << valueLen_, codebook.back());
+  codebook_.append(&codebook[0], codebook.size());
+}
+
+void PackedMap::buildValues(const vector<uint64_t>& vs, const bool useMin){
+  minValue_ = (vs.empty() || !useMin) ? 0 : *min_element(vs.begin(), vs.end());
+  const uint64_t maxValue = vs.empty() ? 0 : *max_element(vs.begin(), vs.end());
+  valueLen_ = lg2(maxValue - minValue_);
+  values_.clear();
+  if (valueLen_ > 0){
+    for (size_t i = 0; i < vs.size(); ++i){
+      values_.push_back_with_len(vs[i] - minValue_, valueLen_);
+    }
+  }
+}
+
+int PackedMap::get(const char* str, const size_t len, uint64_t& v) const {
+  const id_t id = trie_.lookup(str, len);
+  if (id == NOTFOUND){
+    return -1;
+  }
+  v = getValue(id);
+  return 0;
+}
+
+int PackedMap::get(const char* str, const size_t len, float& v) const {
+  const id_t id = trie_.lookup(str, len);
+  if (id == NOTFOUND){
+    return -1;
+  }
+  v = getFloat(id);
+  return 0;
+}
+
+void PackedMap::getValues(const id_t* ids, const size_t num, uint64_t* vs) const {
+  if (valueLen_ == 0 || valueLen_ == 64){
+    for (size_t i = 0; i < num; ++i){
+      vs[i] = getValue(ids[i]);
+    }
+    return;
+  }
+  const uint64_t valueLen = valueLen_;
+  const uint64_t minValue = minValue_;
+  for (size_t i = 0; i < num; ++i){
+    vs[i] = minValue + values_.getBits(ids[i] * valueLen, valueLen);
+  }
+}
+
+void PackedMap::getFloats(const id_t* ids, const size_t num, float* vs) const {
+  for (size_t i = 0; i < num; ++i){
+    vs[i] = getFloat(ids[i]);
+  }
+}
+
+bool PackedMap::isQuantized() const {
+  return codebook_.size() > 0;
+}
+
+const Array<float>& PackedMap::codebook() const {
+  return codebook_;
+}
+
+size_t PackedMap::valueLen() const {
+  return valueLen_;
+}
+
+const Trie& PackedMap::trie() const {
+  return trie_;
+}
+
+void PackedMap::decodeKey(const id_t id, string& ret) const {
+  trie_.decodeKey(id, ret);
+}
+
+int PackedMap::save(ostream& os) const {
+  if (trie_.save(os) != 0){
+    return -1;
+  }
+  writeU64(os, valueLen_);
+  writeU64(os, minValue_);
+  values_.save(os);
+  codebook_.save(os);
+  return os ? 0 : -1;
+}
+
+bool PackedMap::isValid() const {
+  if (valueLen_ > 64 || values_.size() != (valueLen_ ? trie_.size() * valueLen_ : 0)){
+    return false;
+  }
+  // every code must be in the codebook
+  return codebook_.size() == 0 || 
+    (minValue_ == 0 && valueLen_ <= CODE_LEN_MAX && codebook_.size() == ((size_t)1 << valueLen_));
+}
+
+int PackedMap::load(istream& is){
+  clear();
+  if (trie_.load(is) != 0 || !readU64(is, valueLen_) || !readU64(is, minValue_) || valueLen_ > 64){
+    clear();
+    return -1;
+  }
+  values_.load(is);
+  if (is.fail() || !codebook_.load(is) || !isValid()){
+    clear();
+    return -1;
+  }
+  return 0;
+}
+
+int PackedMap::save(const char* fileName) const {
+  return saveFile(*this, fileName);
+}
+
+int PackedMap::load(const char* fileName){
+  return loadFile(*this, fileName);
+}
+
+int PackedMap::view(const void* ptr, const size_t size){
+  clear();
+  size_t used = 0;
+  if (trie_.view(ptr, size, &used) != 0){
+    return -1;
+  }
+  const char* p   = static_cast<const char*>(ptr) + used;
+  const char* end = static_cast<const char*>(ptr) + size;
+  if (!viewU64(p, end, valueLen_) || !viewU64(p, end, minValue_) || 
+      !values_.view(p, end) || !codebook_.view(p, end) || !isValid()){
+    clear();
+    return -1;
+  }
+  return 0;
+}
+
+int PackedMap::map(const char* fileName){
+  return mapFile(*this, fileName, mmap_);
+}
+
+size_t PackedMap::size() const {
+  return trie_.size();
+}
+
+size_t PackedMap::getAllocSize() const {
+  return values_.getAllocSize() + codebook_.size() * sizeof(float);
+}
+
+void PackedMap::clear(){
+  trie_.clear();
+  valueLen_ = 0;
+  minValue_ = 0;
+  values_.clear();
+  codebook_.clear();
+  delete mmap_;
+  mmap_ = NULL;
+}
+
+}
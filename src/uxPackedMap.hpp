@@ -0,0 +1,247 @@
+/* 
+ *  Copyright (c) 2010 Daisuke Okanohara
+ * 
+ *   Redistribution and use in source and binary forms, with or without
+ *   modification, are permitted provided that the following conditions
+ *   are met:
+ * 
+ *   1. Redistributions of source code must retain the above Copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *   2. Redistributions in binary form must reproduce the above Copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ *   3. Neither the name of the authors nor the names of its contributors
+ *      may be used to endorse or promote products derived from this
+ *      software without specific prior written permission.
+ */
+
+#ifndef UX_PACKED_MAP_HPP__
+#define UX_PACKED_MAP_HPP__
+
+#include <string>
+#include <vector>
+#include <map>
+#include <iostream>
+#include "uxTrie.hpp"
+#include "bitVec.hpp"
+#include "uxArray.hpp"
+
+namespace ux{
+
+class MMapFile;
+
+/**
+ * Succinct map from keys to integers packed at the minimal width.
+ * A value is stored as (value - the minimum value) in lg2(the maximum - the minimum) bits,
+ * so that counters and scores take a few bits per key, and are fetched in O(1).
+ *
+ * Floats are quantized into a codebook of at most 2^codeLen values by buildQuantized(),
+ * and each key keeps the code of the nearest codebook value. 
+ * If there are at most 2^codeLen distinct values, they are kept exactly.
+ *
+ * The saved map is the trie followed by the packed values, and is used in place by map().
+ */
+class PackedMap {
+public:
+  /**
+   * Constructor
+   */
+  PackedMap();
+
+  /**
+   * Destructor
+   */
+  ~PackedMap();
+
+  /**
+   * Use a Bloom filter to reject missing keys in get()
+   * @param bitsPerKey The number of filter bits per key, or 0 to disable the filter
+   */
+  void setFilterBitsPerKey(size_t bitsPerKey);
+
+  /**
+   * Build a map from std::map
+   * @param m A std::map as an input
+   */
+  void build(const std::map<std::string, uint64_t>& m);
+
+  /**
+   * Build a map from the vector of the pair of a key and a value.
+   * If a key appears more than once, the last value is used.
+   * @param kvs A vector of the pair of a key and a value
+   */
+  void build(const std::vector<std::pair<std::string, uint64_t> >& kvs);
+
+  /**
+   * Build a map of floats quantized into a codebook. Each codebook value is the mean of
+   * the values in a bucket of the sorted values, and buckets have the same number of values.
+   * If a key appears more than once, the last value is used.
+   * @param kvs A vector of the pair of a key and a value
+   * @param codeLen The number of bits of a code (from 1 to 24)
+   */
+  void buildQuantized(const std::vector<std::pair<std::string, float> >& kvs, size_t codeLen = 8);
+
+  /**
+   * Get a value for a given key
+   * @param str the key
+   * @param len the length of str
+   * @param v The value, or the code of the value if the map is quantized
+   * @return 0 on success and -1 if not found
+   */
+  int get(const char* str, size_t len, uint64_t& v) const;
+
+  /**
+   * Get a value for a given key as a float
+   * @param str the key
+   * @param len the length of str
+   * @param v The value, or the codebook value if the map is quantized
+   * @return 0 on success and -1 if not found
+   */
+  int get(const char* str, size_t len, float& v) const;
+
+  /**
+   * Get the value of a key ID given by the trie
+   * @param id The ID of the key
+   * @return The value, or the code of the value if the map is quantized
+   */
+  uint64_t getValue(id_t id) const {
+    if (valueLen_ == 64){
+      return minValue_ + values_.lookupBlock(id); // one value per block
+    }
+    return minValue_ + (valueLen_ ? values_.getBits(id * valueLen_, valueLen_) : 0);
+  }
+
+  /**
+   * Get the value of a key ID given by the trie as a float
+   * @param id The ID of the key
+   * @return The value, or the codebook value if the map is quantized
+   */
+  float getFloat(id_t id) const {
+    return codebook_.size() ? codebook_[getValue(id)] : (float)getValue(id);
+  }
+
+  /**
+   * Get the values of the keys given by the trie at once, such as the result of 
+   * predictiveSearch()
+   * @param ids The IDs of the keys
+   * @param num The number of IDs
+   * @param vs vs[i] is set to getValue(ids[i]) 
+   */
+  void getValues(const id_t* ids, size_t num, uint64_t* vs) const;
+
+  /**
+   * Get the values of the keys given by the trie at once as floats
+   * @param ids The IDs of the keys
+   * @param num The number of IDs
+   * @param vs vs[i] is set to getFloat(ids[i]) 
+   */
+  void getFloats(const id_t* ids, size_t num, float* vs) const;
+
+  /**
+   * @return true if floats are quantized into a codebook
+   */
+  bool isQuantized() const;
+
+  /**
+   * @return The codebook of the quantized floats padded to 2^valueLen() values, or empty
+   */
+  const Array<float>& codebook() const;
+
+  /**
+   * @return The number of bits of a value
+   */
+  size_t valueLen() const;
+
+  /**
+   * @return The trie of the keys
+   */
+  const Trie& trie() const;
+
+  /**
+   * Return the key for the given ID
+   * @param id The ID of the key
+   * @param ret The key for the given ID or empty if such ID does not exist
+   */ 
+  void decodeKey(id_t id, std::string& ret) const;
+
+  /**
+   * Save the map in ostream
+   * @param os The ostream as an output 
+   * @return 0 on success, -1 on failure
+   */
+  int save(std::ostream& os) const;
+
+  /**
+   * Load the map from istream
+   * @param is The istream as an input
+   * @return 0 on success, -1 on failure
+   */
+  int load(std::istream& is);
+
+  /**
+   * Save the map in a file
+   * @param fileName The file name
+   * @return 0 on success, -1 on failure
+   */
+  int save(const char* fileName) const;
+
+  /**
+   * Load the map from a file
+   * @param fileName The file name
+   * @return 0 on success, -1 on failure
+   */
+  int load(const char* fileName);
+
+  /**
+   * Use an image saved by save() in memory without copying it.
+   * The image must be aligned to 8 bytes, and must outlive the map.
+   * @param ptr The beginning of the image
+   * @param size The size of the image in bytes
+   * @return 0 on success, -1 on failure
+   */
+  int view(const void* ptr, size_t size);
+
+  /**
+   * Map a file saved by save() into memory, and use it without reading the whole file.
+   * @param fileName The file name
+   * @return 0 on success, -1 on failure
+   */
+  int map(const char* fileName);
+
+  /**
+   * Get the number of keys 
+   * @return the number of keys
+   */
+  size_t size() const;
+
+  /**
+   * Return the size of the values in bytes
+   * @return The size of the packed values and the codebook
+   */
+  size_t getAllocSize() const;
+
+  /**
+   * Clear the internal state
+   */
+  void clear();
+
+private:
+  PackedMap(const PackedMap&);
+  PackedMap& operator=(const PackedMap&);
+
+  void buildValues(const std::vector<uint64_t>& vs, bool useMin);
+  bool isValid() const;
+
+  Trie trie_;
+  uint64_t valueLen_;
+  uint64_t minValue_;
+  BitVec values_;
+  Array<float> codebook_;
+  MMapFile* mmap_;
+};
+
+}
+
+#endif // UX_PACKED_MAP_HPP__
@@ -0,0 +1,464 @@
+/* 
+ *  Copyright (c) 2010 Daisuke Okanohara
+ * 
+ *   Redistribution and use in source and binary forms, with or without
+ *   modification, are permitted provided that the following conditions
+ *   are met:
+ * 
+ *   1. Redistributions of source code must retain the above Copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *   2. Redistributions in binary form must reproduce the above Copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ *   3. Neither the name of the authors nor the names of its contributors
+ *      may be used to endorse or promote products derived from this
+ *      software without specific prior written permission.
+ */
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <cstring>
+#include "uxSharded.hpp"
+#include "uxSort.hpp"
+#include "uxThread.hpp"
+#include "uxImage.hpp"
+
+using namespace std;
+
+namespace ux{
+
+// sections of the router
+enum {
+  SECTION_META = 1,      // the number of shards
+  SECTION_ID_OFFSETS,    // the first ID of each shard, and the number of keys
+  SECTION_BOUND_OFFSETS, // the i-th bound is BOUNDS[BOUND_OFFSETS[i], BOUND_OFFSETS[i+1])
+  SECTION_BOUNDS,
+  SECTION_NUM = SECTION_BOUNDS
+};
+
+static const size_t SHARD_NUM_DEFAULT = 8;
+
+// compare a query with a key as unsigned bytes
+static int compareKey(const char* str, const size_t len, const string& key){
+  const size_t minLen = min(len, key.size());
+  const int cmp = minLen ? memcmp(str, key.data(), minLen) : 0;
+  if (cmp != 0) return cmp;
+  return (len < key.size()) ? -1 : (len > key.size()) ? 1 : 0;
+}
+
+static size_t commonPrefix(const char* str, const size_t len, const string& key){
+  const size_t minLen = min(len, key.size());
+  size_t i = 0;
+  while (i < minLen && str[i] == key[i]) ++i;
+  return i;
+}
+
+// Prefixes of a query in a shard are not less than the bound of the shard.
+// The others are proper prefixes of the bound, and are in preceding shards. 
+// Return the length of the longest one, which is a query for the preceding shards.
+static size_t precedingLength(const char* str, const size_t len, const string& bound){
+  const size_t lcp = commonPrefix(str, len, bound);
+  return (lcp == bound.size()) ? lcp - 1 : lcp;
+}
+
+static string shardName(const char* indexName, const size_t i){
+  ostringstream os;
+  os << indexName << "." << i;
+  return os.str();
+}
+
+template <class T>
+static void addSection(ImageWriter& writer, const uint32_t id, const T* p, const size_t num){
+  Array<T> x;
+  x.append(p, num);
+  StringBuf buf(writer.section(id));
+  ostream os(&buf);
+  x.save(os);
+}
+
+// build shards of the sorted keys; starts[i] is the first key of the i-th shard
+struct ShardBuildTask {
+  const vector<KeySlice>* keys;
+  const vector<uint64_t>* starts;
+  vector<Trie*>* shards;
+  vector<size_t> targets;
+  bool isTailUX;
+  void run(){
+    for (size_t t = 0; t < targets.size(); ++t){
+      const size_t i = targets[t];
+      string buf;
+      vector<size_t> offsets(1, 0);
+      for (uint64_t k = (*starts)[i]; k < (*starts)[i+1]; ++k){
+	buf.append((*keys)[k].str, (*keys)[k].len);
+	offsets.push_back(buf.size());
+      }
+      (*shards)[i]->build(buf.data(), &offsets[0], offsets.size() - 1, isTailUX);
+    }
+  }
+};
+
+struct ShardLoadTask {
+  const ShardedTrie* trie;
+  vector<size_t> targets;
+  void run(){
+    for (size_t t = 0; t < targets.size(); ++t){
+      trie->shard(targets[t]);
+    }
+  }
+};
+
+ShardedTrie::ShardedTrie() : shardNum_(SHARD_NUM_DEFAULT), threadNum_(1), lazy_(false){
+}
+
+ShardedTrie::~ShardedTrie(){
+  clear();
+}
+
+void ShardedTrie::setShardNum(const size_t shardNum){
+  shardNum_ = shardNum ? shardNum : 1;
+}
+
+void ShardedTrie::setThreadNum(const size_t threadNum){
+  threadNum_ = threadNum ? threadNum : 1;
+}
+
+void ShardedTrie::setLazy(const bool lazy){
+  lazy_ = lazy;
+}
+
+void ShardedTrie::build(vector<string>& keyList, const bool isTailUX){
+  clear();
+  vector<KeySlice> keys(keyList.size());
+  for (size_t i = 0; i < keyList.size(); ++i){
+    keys[i].str = keyList[i].data();
+    keys[i].len = keyList[i].size();
+  }
+  vector<uint32_t> lcps;
+  radixSortKeys(keys, lcps, threadNum_);
+
+  const size_t shardNum = max((size_t)1, min(shardNum_, keys.size()));
+  idOffsets_.resize(shardNum + 1);
+  bounds_.resize(shardNum);
+  for (size_t i = 0; i < shardNum; ++i){
+    idOffsets_[i] = (uint64_t)keys.size() * i / shardNum;
+    if (i > 0){
+      bounds_[i].assign(keys[idOffsets_[i]].str, keys[idOffsets_[i]].len);
+    }
+  }
+  idOffsets_[shardNum] = keys.size();
+
+  shards_.resize(shardNum);
+  for (size_t i = 0; i < shardNum; ++i){
+    shards_[i] = new Trie;
+  }
+  vector<ShardBuildTask> tasks(min(threadNum_, shardNum));
+  for (size_t i = 0; i < shardNum; ++i){
+    tasks[i % tasks.size()].targets.push_back(i);
+  }
+  for (size_t t = 0; t < tasks.size(); ++t){
+    tasks[t].keys     = &keys;
+    tasks[t].starts   = &idOffsets_;
+    tasks[t].shards   = &shards_;
+    tasks[t].isTailUX = isTailUX;
+  }
+  runTasks(tasks);
+  states_.assign(shardNum, SHARD_READY);
+}
+
+int ShardedTrie::save(const char* indexName) const {
+  ImageWriter writer(IMAGE_SHARDED);
+  const uint64_t shardNum = shards_.size();
+  writer.section(SECTION_META).assign((const char*)&shardNum, sizeof(shardNum));
+  vector<uint64_t> boundOffsets(1, 0);
+  string bounds;
+  for (size_t i = 0; i < bounds_.size(); ++i){
+    bounds += bounds_[i];
+    boundOffsets.push_back(bounds.size());
+  }
+  addSection(writer, SECTION_ID_OFFSETS,    idOffsets_.empty() ? NULL : &idOffsets_[0], idOffsets_.size());
+  addSection(writer, SECTION_BOUND_OFFSETS, &boundOffsets[0], boundOffsets.size());
+  addSection(writer, SECTION_BOUNDS,        bounds.data(), bounds.size());
+
+  ofstream ofs(indexName, ios::binary);
+  if (!ofs){
+    return Trie::FILE_OPEN_ERROR;
+  }
+  if (!writer.write(ofs)){
+    return Trie::SAVE_ERROR;
+  }
+  for (size_t i = 0; i < shards_.size(); ++i){
+    const Trie* trie = shard(i);
+    if (!trie){
+      return Trie::SAVE_ERROR;
+    }
+    int err = 0;
+    if ((err = trie->save(shardName(indexName, i).c_str())) != 0){
+      return err;
+    }
+  }
+  return 0;
+}
+
+int ShardedTrie::load(const char* indexName){
+  clear();
+  int err = 0;
+  if ((err = loadRouter(indexName)) != 0){
+    clear();
+    return err;
+  }
+  if (lazy_){
+    return 0;
+  }
+  vector<ShardLoadTask> tasks(min(threadNum_, shards_.size()));
+  for (size_t i = 0; i < shards_.size(); ++i){
+    tasks[i % tasks.size()].targets.push_back(i);
+  }
+  for (size_t t = 0; t < tasks.size(); ++t){
+    tasks[t].trie = this;
+  }
+  runTasks(tasks);
+  for (size_t i = 0; i < shards_.size(); ++i){
+    if ((err = loadShard(i)) != 0){
+      clear();
+      return err;
+    }
+  }
+  return 0;
+}
+
+int ShardedTrie::loadRouter(const char* indexName){
+  ifstream ifs(indexName, ios::binary);
+  if (!ifs){
+    return Trie::FILE_OPEN_ERROR;
+  }
+  vector<uint64_t> image(alignedSize(ImageReader::headerSize()) / sizeof(uint64_t));
+  ifs.read((char*)&image[0], ImageReader::headerSize());
+  if (!ifs || !ImageReader::isImage((const char*)&image[0])){
+    return Trie::LOAD_ERROR;
+  }
+  int err = 0;
+  uint64_t size = 0;
+  if ((err = ImageReader::peekSize((const char*)&image[0], IMAGE_SHARDED, size)) != 0){
+    return err;
+  }
+  if (size < ImageReader::headerSize()){
+    return Trie::LOAD_ERROR;
+  }
+  image.resize(alignedSize(size) / sizeof(uint64_t));
+  ifs.read((char*)&image[0] + ImageReader::headerSize(), size - ImageReader::headerSize());
+  if (!ifs){
+    return Trie::LOAD_ERROR;
+  }
+  ImageReader reader;
+  if ((err = reader.open((const char*)&image[0], size, IMAGE_SHARDED, SECTION_NUM)) != 0 ||
+      (err = reader.verify(threadNum_)) != 0){
+    return err;
+  }
+
+  const char* begins[SECTION_NUM + 1];
+  const char* ends[SECTION_NUM + 1];
+  for (uint32_t id = SECTION_META; id <= SECTION_NUM; ++id){
+    if (!reader.find(id, begins[id], ends[id])){
+      return Trie::LOAD_ERROR;
+    }
+  }
+  uint64_t shardNum = 0;
+  Array<uint64_t> idOffsetView;
+  Array<uint64_t> boundOffsetView;
+  Array<char> boundView;
+  if (!viewU64(begins[SECTION_META], ends[SECTION_META], shardNum) ||
+      !idOffsetView.view(begins[SECTION_ID_OFFSETS], ends[SECTION_ID_OFFSETS]) ||
+      !boundOffsetView.view(begins[SECTION_BOUND_OFFSETS], ends[SECTION_BOUND_OFFSETS]) ||
+      !boundView.view(begins[SECTION_BOUNDS], ends[SECTION_BOUNDS]) ||
+      shardNum == 0 || idOffsetView.size() != shardNum + 1 || boundOffsetView.size() != shardNum + 1){
+    return Trie::LOAD_ERROR;
+  }
+  const uint64_t* idOffsets    = idOffsetView.data();
+  const uint64_t* boundOffsets = boundOffsetView.data();
+  if (boundOffsets[0] != 0 || boundOffsets[shardNum] != boundView.size()){
+    return Trie::LOAD_ERROR;
+  }
+  bounds_.resize(shardNum);
+  for (size_t i = 0; i < shardNum; ++i){
+    if (boundOffsets[i] > boundOffsets[i+1] || idOffsets[i] > idOffsets[i+1]){
+      return Trie::LOAD_ERROR;
+    }
+    bounds_[i].assign(boundView.data() + boundOffsets[i], boundOffsets[i+1] - boundOffsets[i]);
+  }
+  idOffsets_.assign(idOffsets, idOffsets + shardNum + 1);
+  shards_.resize(shardNum);
+  for (size_t i = 0; i < shardNum; ++i){
+    shards_[i] = new Trie;
+    shards_[i]->setLazy(lazy_);
+  }
+  states_.assign(shardNum, SHARD_UNLOADED);
+  // each shard has its own mutex so that loading one does not block the others
+  mutexes_.resize(shardNum);
+  for (size_t i = 0; i < shardNum; ++i){
+    pthread_mutex_init(&mutexes_[i], NULL);
+  }
+  indexName_ = indexName;
+  return 0;
+}
+
+int ShardedTrie::loadShard(const size_t i) const {
+  if (__atomic_load_n(&states_[i], __ATOMIC_ACQUIRE) == SHARD_READY){
+    return 0;
+  }
+  int err = 0;
+  pthread_mutex_lock(&mutexes_[i]);
+  if (states_[i] == SHARD_UNLOADED){
+    err = shards_[i]->load(shardName(indexName_.c_str(), i).c_str());
+    if (err == 0 && shards_[i]->size() != idOffsets_[i+1] - idOffsets_[i]){
+      err = Trie::LOAD_ERROR; // not the shard of this router
+    }
+    if (err != 0){
+      shards_[i]->clear();
+    }
+    __atomic_store_n(&states_[i], err ? SHARD_FAILED : SHARD_READY, __ATOMIC_RELEASE);
+  } else if (states_[i] == SHARD_FAILED){
+    err = Trie::LOAD_ERROR;
+  }
+  pthread_mutex_unlock(&mutexes_[i]);
+  return err;
+}
+
+const Trie* ShardedTrie::shard(const size_t i) const {
+  if (i >= shards_.size() || loadShard(i) != 0){
+    return NULL;
+  }
+  return shards_[i];
+}
+
+size_t ShardedTrie::findShard(const char* str, const size_t len) const {
+  // the last shard whose bound is not greater than the query
+  size_t low  = 0;
+  size_t high = bounds_.size();
+  while (high - low > 1){
+    const size_t mid = (low + high) / 2;
+    if (compareKey(str, len, bounds_[mid]) < 0){
+      high = mid;
+    } else {
+      low = mid;
+    }
+  }
+  return low;
+}
+
+id_t ShardedTrie::lookup(const char* str, const size_t len) const {
+  if (shards_.empty()) return NOTFOUND;
+  const size_t i = findShard(str, len);
+  const Trie* trie = shard(i);
+  if (!trie) return NOTFOUND;
+  const id_t id = trie->lookup(str, len);
+  return (id == NOTFOUND) ? (id_t)NOTFOUND : (id_t)(idOffsets_[i] + id);
+}
+
+id_t ShardedTrie::prefixSearch(const char* str, size_t len, size_t& retLen) const {
+  for (;;){
+    if (shards_.empty()) return NOTFOUND;
+    const size_t i = findShard(str, len);
+    const Trie* trie = shard(i);
+    if (trie){
+      const id_t id = trie->prefixSearch(str, len, retLen);
+      if (id != NOTFOUND) return idOffsets_[i] + id;
+    }
+    if (i == 0) return NOTFOUND;
+    len = precedingLength(str, len, bounds_[i]);
+  }
+}
+
+size_t ShardedTrie::commonPrefixSearch(const char* str, size_t len, vector<id_t>& retIDs, 
+				       const size_t limit) const {
+  retIDs.clear();
+  vector<vector<id_t> > found; // from the longest prefixes
+  vector<id_t> ids;
+  while (!shards_.empty()){
+    const size_t i = findShard(str, len);
+    const Trie* trie = shard(i);
+    if (trie && trie->commonPrefixSearch(str, len, ids, limit) > 0){
+      found.push_back(ids);
+      for (size_t j = 0; j < ids.size(); ++j){
+	found.back()[j] += idOffsets_[i];
+      }
+    }
+    if (i == 0) break;
+    len = precedingLength(str, len, bounds_[i]);
+  }
+  for (size_t i = found.size(); i > 0 && retIDs.size() < limit; --i){
+    const size_t num = min(found[i-1].size(), limit - retIDs.size());
+    retIDs.insert(retIDs.end(), found[i-1].begin(), found[i-1].begin() + num);
+  }
+  return retIDs.size();
+}
+
+size_t ShardedTrie::predictiveSearch(const char* str, const size_t len, vector<id_t>& retIDs, 
+				     const size_t limit) const {
+  retIDs.clear();
+  if (shards_.empty() || limit == 0) return 0;
+  vector<id_t> ids;
+  const size_t first = findShard(str, len);
+  for (size_t i = first; i < shards_.size() && retIDs.size() < limit; ++i){
+    // a following shard overlaps the prefix only if its bound has the prefix
+    if (i > first && commonPrefix(str, len, bounds_[i]) < len) break;
+    const Trie* trie = shard(i);
+    if (!trie) continue;
+    trie->predictiveSearch(str, len, ids, limit - retIDs.size());
+    for (size_t j = 0; j < ids.size(); ++j){
+      retIDs.push_back(idOffsets_[i] + ids[j]);
+    }
+  }
+  return retIDs.size();
+}
+
+void ShardedTrie::decodeKey(const id_t id, string& ret) const {
+  ret.clear();
+  if (shards_.empty() || id >= idOffsets_.back()) return;
+  const size_t i = upper_bound(idOffsets_.begin(), idOffsets_.end(), id) - idOffsets_.begin() - 1;
+  const Trie* trie = shard(i);
+  if (trie){
+    trie->decodeKey(id - idOffsets_[i], ret);
+  }
+}
+
+string ShardedTrie::decodeKey(const id_t id) const {
+  string ret;
+  decodeKey(id, ret);
+  return ret;
+}
+
+size_t ShardedTrie::shardNum() const {
+  return shards_.size();
+}
+
+size_t ShardedTrie::loadedShardNum() const {
+  size_t num = 0;
+  for (size_t i = 0; i < states_.size(); ++i){
+    if (__atomic_load_n(&states_[i], __ATOMIC_ACQUIRE) == SHARD_READY) ++num;
+  }
+  return num;
+}
+
+size_t ShardedTrie::size() const {
+  return idOffsets_.empty() ? 0 : idOffsets_.back();
+}
+
+void ShardedTrie::clear(){
+  for (size_t i = 0; i < shards_.size(); ++i){
+    delete shards_[i];
+  }
+  vector<Trie*>().swap(shards_);
+  vector<string>().swap(bounds_);
+  vector<uint64_t>().swap(idOffsets_);
+  vector<int>().swap(states_);
+  for (size_t i = 0; i < mutexes_.size(); ++i){
+    pthread_mutex_destroy(&mutexes_[i]);
+  }
+  vector<pthread_mutex_t>().swap(mutexes_);
+  indexName_.clear();
+}
+
+}
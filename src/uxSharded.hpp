@@ -0,0 +1,213 @@
+/* 
+ *  Copyright (c) 2010 Daisuke Okanohara
+ * 
+ *   Redistribution and use in source and binary forms, with or without
+ *   modification, are permitted provided that the following conditions
+ *   are met:
+ * 
+ *   1. Redistributions of source code must retain the above Copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *   2. Redistributions in binary form must reproduce the above Copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ *   3. Neither the name of the authors nor the names of its contributors
+ *      may be used to endorse or promote products derived from this
+ *      software without specific prior written permission.
+ */
+
+#ifndef UX_SHARDED_HPP__
+#define UX_SHARDED_HPP__
+
+#include <string>
+#include <vector>
+#include <pthread.h>
+#include "uxTrie.hpp"
+
+namespace ux{
+
+/**
+ * A key set split by lexicographic ranges into shards, each of which is an independent Trie.
+ * The i-th shard has the keys in [bounds[i], bounds[i+1]), where bounds[i] is the first key 
+ * of the shard (bounds[0] is empty). A small router of the bounds chooses shards for a query.
+ *   lookup():             one shard
+ *   predictiveSearch():   the shards whose ranges overlap the prefix
+ *   commonPrefixSearch(): the shard of the query, and preceding shards for 
+ *                         prefixes shorter than the shard bound
+ * The ID of a key is the offset of its shard (the number of keys in the preceding shards)
+ * plus the ID in the shard.
+ *
+ * save(indexName) writes the router in indexName and the i-th shard in indexName.i.
+ * Shards are built and loaded in parallel, or loaded at their first use by setLazy().
+ */
+class ShardedTrie {
+public:
+  /**
+   * Constructor
+   */
+  ShardedTrie();
+
+  /**
+   * Destructor
+   */
+  ~ShardedTrie();
+
+  /**
+   * Set the number of shards used in the following build() (default 8).
+   * Fewer shards are used if there are fewer keys.
+   * @param shardNum The number of shards
+   */
+  void setShardNum(size_t shardNum);
+
+  /**
+   * Set the number of threads to build or load shards
+   * @param threadNum The number of threads (default 1)
+   */
+  void setThreadNum(size_t threadNum);
+
+  /**
+   * Load shards at their first use in the following load(). Each shard is loaded by 
+   * Trie::setLazy(), so that its sections are also read at their first use.
+   * @param lazy true to load shards at their first use, false to load all (default)
+   */
+  void setLazy(bool lazy);
+
+  /**
+   * Build shards from keyList
+   * @param keyList input key list
+   * @param isTailUX use tail compression. 
+   */
+  void build(std::vector<std::string>& keyList, bool isTailUX = true);
+
+  /**
+   * Save the router and the shards
+   * @param indexName The file name of the router. The i-th shard is saved in indexName.i
+   * @return 0 on success, or an error code of Trie
+   */
+  int save(const char* indexName) const;
+
+  /**
+   * Load the router and the shards (only the router if setLazy() is set)
+   * @param indexName The file name of the router
+   * @return 0 on success, or an error code of Trie
+   */
+  int load(const char* indexName);
+
+  /**
+   * Return the ID of the key that exactly matches the query
+   * @param str the query
+   * @param len the length of the query
+   * @return The ID of the matched key or NOTFOUND if no key is matched
+   */
+  id_t lookup(const char* str, size_t len) const;
+
+  /**
+   * Return the longest key that matches the prefix of the query
+   * @param str the query
+   * @param len the length of the query
+   * @param retLen The length of the matched key
+   * @return The ID of the matched key or NOTFOUND if no key is matched
+   */
+  id_t prefixSearch(const char* str, size_t len, size_t& retLen) const;
+
+  /** 
+   * Return the all keys that match the prefix of the query, from the shortest
+   * @param str the query
+   * @param len the length of the query
+   * @param retIDs The IDs of the matched keys
+   * @param limit The maximum number of matched keys
+   * @return The number of matched keys
+   */
+  size_t commonPrefixSearch(const char* str, size_t len, std::vector<id_t>& retIDs, 
+			    size_t limit = LIMIT_DEFAULT) const;
+
+  /** 
+   * Return the all keys whose prefixes match the query, shard by shard in the range order
+   * @param str the query
+   * @param len the length of the query
+   * @param retIDs The IDs of the matched keys
+   * @param limit The maximum number of matched keys
+   * @return The number of matched keys
+   */
+  size_t predictiveSearch(const char* str, size_t len, std::vector<id_t>& retIDs, 
+			  size_t limit = LIMIT_DEFAULT) const;
+
+  /**
+   * Return the key for the given ID
+   * @param id The ID of the key
+   * @param ret The key for the given ID or empty if such ID does not exist
+   */ 
+  void decodeKey(id_t id, std::string& ret) const;
+
+  /**
+   * Return the key for the given ID
+   * @param id The ID of the key
+   * @return The key for the given ID or empty if such ID does not exist
+   */ 
+  std::string decodeKey(id_t id) const;
+
+  /**
+   * Return the shard whose range has the query
+   * @param str the query
+   * @param len the length of the query
+   * @return The index of the shard
+   */
+  size_t findShard(const char* str, size_t len) const;
+
+  /**
+   * Return a shard, which is loaded here if setLazy() is set
+   * @param i The index of the shard
+   * @return The shard, or NULL if it cannot be loaded
+   */
+  const Trie* shard(size_t i) const;
+
+  /**
+   * @return The number of shards
+   */
+  size_t shardNum() const;
+
+  /**
+   * @return The number of shards in memory
+   */
+  size_t loadedShardNum() const;
+
+  /**
+   * Return the number of keys
+   * @return the number of keys
+   */
+  size_t size() const;
+
+  /**
+   * Clear the internal state
+   */
+  void clear();
+
+private:
+  enum {
+    SHARD_UNLOADED = 0,
+    SHARD_READY    = 1,
+    SHARD_FAILED   = 2
+  };
+
+  ShardedTrie(const ShardedTrie&);
+  ShardedTrie& operator=(const ShardedTrie&);
+
+  int loadRouter(const char* indexName);
+  int loadShard(size_t i) const;
+
+  size_t shardNum_;
+  size_t threadNum_;
+  bool lazy_;
+
+  std::vector<Trie*> shards_;
+  std::vector<std::string> bounds_; // bounds_[i] is the first key of the i-th shard
+  std::vector<uint64_t> idOffsets_; // IDs of the i-th shard start at idOffsets_[i]
+  std::string indexName_;
+  mutable std::vector<int> states_;
+  mutable std::vector<pthread_mutex_t> mutexes_; // mutexes_[i] guards the loading of the i-th shard
+};
+
+}
+
+#endif // UX_SHARDED_HPP__
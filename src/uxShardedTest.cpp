@@ -0,0 +1,191 @@
+/* 
+ *  Copyright (c) 2010 Daisuke Okanohara
+ * 
+ *   Redistribution and use in source and binary forms, with or without
+ *   modification, are permitted provided that the following conditions
+ *   are met:
+ * 
+ *   1. Redistributions of source code must retain the above Copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *   2. Redistributions in binary form must reproduce the above Copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ *   3. Neither the name of the authors nor the names of its contributors
+ *      may be used to endorse or promote products derived from this
+ *      software without specific prior written permission.
+ */
+
+#include <gtest/gtest.h>
+#include <vector>
+#include <string>
+#include <set>
+#include <cstdio>
+#include "uxSharded.hpp"
+#include "uxThread.hpp"
+
+using namespace std;
+
+// keys over a small alphabet, so that many keys are prefixes of others and
+// keys sharing a prefix are split into several shards
+static vector<string> makeKeys(){
+  vector<string> keys;
+  for (int i = 0; i < 2000; ++i){
+    string key;
+    for (int x = (i * 7919) % 4093; x > 0; x /= 3){
+      key += (char)('a' + x % 3);
+    }
+    keys.push_back(key);
+  }
+  return keys;
+}
+
+struct LookupTask {
+  const ux::ShardedTrie* trie;
+  const vector<string>* keys;
+  vector<ux::id_t> ids;
+  void run(){
+    for (size_t i = 0; i < keys->size(); ++i){
+      ids.push_back(trie->lookup((*keys)[i].c_str(), (*keys)[i].size()));
+    }
+  }
+};
+
+static vector<string> decodeAll(const ux::ShardedTrie& trie, const vector<ux::id_t>& ids){
+  vector<string> rets;
+  for (size_t i = 0; i < ids.size(); ++i){
+    rets.push_back(trie.decodeKey(ids[i]));
+  }
+  return rets;
+}
+
+static void checkSame(const ux::ShardedTrie& trie, const vector<string>& keyList){
+  const set<string> keys(keyList.begin(), keyList.end());
+  ASSERT_EQ(keys.size(), trie.size());
+  set<ux::id_t> ids;
+  for (set<string>::const_iterator it = keys.begin(); it != keys.end(); ++it){
+    ux::id_t id = trie.lookup(it->c_str(), it->size());
+    ASSERT_LT(id, trie.size());
+    ASSERT_EQ(*it, trie.decodeKey(id));
+    ids.insert(id);
+  }
+  ASSERT_EQ(keys.size(), ids.size());
+
+  const char* queries[] = {"", "a", "b", "ab", "bca", "cacb", "abcabcab", "ccccccccc", "d"};
+  for (size_t q = 0; q < sizeof(queries) / sizeof(queries[0]); ++q){
+    const string query(queries[q]);
+    vector<string> expected;
+    for (size_t len = 0; len <= query.size(); ++len){
+      if (keys.count(query.substr(0, len))) expected.push_back(query.substr(0, len));
+    }
+    vector<ux::id_t> rets;
+    trie.commonPrefixSearch(query.c_str(), query.size(), rets);
+    ASSERT_EQ(expected, decodeAll(trie, rets));
+    trie.commonPrefixSearch(query.c_str(), query.size(), rets, 1);
+    ASSERT_EQ(min(expected.size(), (size_t)1), rets.size());
+
+    size_t retLen = 0;
+    ux::id_t id = trie.prefixSearch(query.c_str(), query.size(), retLen);
+    if (expected.empty()){
+      ASSERT_EQ(ux::NOTFOUND, id);
+    } else {
+      ASSERT_EQ(expected.back(), trie.decodeKey(id));
+      ASSERT_EQ(expected.back().size(), retLen);
+    }
+
+    expected.clear();
+    for (set<string>::const_iterator it = keys.lower_bound(query); 
+	 it != keys.end() && it->compare(0, query.size(), query) == 0; ++it){
+      expected.push_back(*it);
+    }
+    trie.predictiveSearch(query.c_str(), query.size(), rets);
+    ASSERT_EQ(expected, decodeAll(trie, rets));
+    trie.predictiveSearch(query.c_str(), query.size(), rets, 3);
+    expected.resize(min(expected.size(), (size_t)3));
+    ASSERT_EQ(expected, decodeAll(trie, rets));
+  }
+}
+
+TEST(uxsharded, trivial){
+  ux::ShardedTrie trie;
+  vector<string> keys;
+  trie.build(keys);
+  ASSERT_EQ(0U, trie.size());
+  ASSERT_EQ(1U, trie.shardNum());
+  ASSERT_EQ(ux::NOTFOUND, trie.lookup("a", 1));
+
+  keys.push_back("b");
+  keys.push_back("a");
+  trie.build(keys);
+  ASSERT_EQ(2U, trie.shardNum());
+  ASSERT_EQ(0U, trie.findShard("a", 1));
+  ASSERT_EQ(1U, trie.findShard("b", 1));
+  ASSERT_EQ(1U, trie.findShard("z", 1));
+  checkSame(trie, keys);
+}
+
+TEST(uxsharded, search){
+  vector<string> keys = makeKeys();
+  for (size_t shardNum = 1; shardNum <= 16; shardNum *= 4){
+    ux::ShardedTrie trie;
+    trie.setShardNum(shardNum);
+    trie.setThreadNum(3);
+    trie.build(keys);
+    ASSERT_EQ(shardNum, trie.shardNum());
+    checkSame(trie, keys);
+  }
+}
+
+TEST(uxsharded, saveLoad){
+  vector<string> keys = makeKeys();
+  ux::ShardedTrie trie;
+  trie.setShardNum(5);
+  trie.build(keys);
+  ASSERT_EQ(0, trie.save("uxsharded.ind"));
+  vector<ux::id_t> ids;
+  for (size_t i = 0; i < keys.size(); ++i){
+    ids.push_back(trie.lookup(keys[i].c_str(), keys[i].size()));
+  }
+
+  ux::ShardedTrie loaded;
+  loaded.setThreadNum(2);
+  ASSERT_EQ(0, loaded.load("uxsharded.ind"));
+  ASSERT_EQ(5U, loaded.loadedShardNum());
+  checkSame(loaded, keys);
+
+  ux::ShardedTrie lazy;
+  lazy.setLazy(true);
+  ASSERT_EQ(0, lazy.load("uxsharded.ind"));
+  ASSERT_EQ(0U, lazy.loadedShardNum());
+  ASSERT_EQ(ids[0], lazy.lookup(keys[0].c_str(), keys[0].size()));
+  ASSERT_EQ(1U, lazy.loadedShardNum());
+  for (size_t i = 0; i < keys.size(); ++i){
+    ASSERT_EQ(ids[i], lazy.lookup(keys[i].c_str(), keys[i].size()));
+  }
+  checkSame(lazy, keys);
+
+  // shards are loaded by concurrent lookups
+  ASSERT_EQ(0, lazy.load("uxsharded.ind"));
+  vector<LookupTask> tasks(4);
+  for (size_t t = 0; t < tasks.size(); ++t){
+    tasks[t].trie = &lazy;
+    tasks[t].keys = &keys;
+  }
+  ux::runTasks(tasks);
+  ASSERT_EQ(5U, lazy.loadedShardNum());
+  for (size_t t = 0; t < tasks.size(); ++t){
+    ASSERT_EQ(ids, tasks[t].ids);
+  }
+
+  // a missing shard
+  remove("uxsharded.ind.4");
+  ASSERT_NE(0, loaded.load("uxsharded.ind"));
+  ASSERT_EQ(0U, loaded.size());
+  ASSERT_EQ(0, lazy.load("uxsharded.ind"));
+  ASSERT_EQ(0U, lazy.findShard("", 0));
+  ASSERT_TRUE(lazy.shard(0) != NULL);
+  ASSERT_TRUE(lazy.shard(4) == NULL);
+  ASSERT_EQ(ux::NOTFOUND, lazy.lookup("cccccccc", 8));
+  ASSERT_EQ(ux::Trie::FILE_OPEN_ERROR, loaded.load("uxsharded_none.ind"));
+}
@@ -0,0 +1,234 @@
+/* 
+ *  Copyright (c) 2010 Daisuke Okanohara
+ * 
+ *   Redistribution and use in source and binary forms, with or without
+ *   modification, are permitted provided that the following conditions
+ *   are met:
+ * 
+ *   1. Redistributions of source code must retain the above Copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *   2. Redistributions in binary form must reproduce the above Copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ *   3. Neither the name of the authors nor the names of its contributors
+ *      may be used to endorse or promote products derived from this
+ *      software without specific prior written permission.
+ */
+
+#include <cstring>
+#include <algorithm>
+#include "uxSort.hpp"
+#include "uxThread.hpp"
+
+using namespace std;
+
+namespace ux {
+
+static const size_t INSERTION_SORT_SIZE = 32;
+static const size_t BUCKET_NUM          = 257; // 0 for the end of a key, c+1 for a byte c
+
+static inline uint16_t charAt(const KeySlice& key, const size_t depth){
+  return (key.len > depth) ? (uint16_t)((uint8_t)key.str[depth] + 1) : 0;
+}
+
+static inline const KeySlice& slice(const KeySlice& key){
+  return key;
+}
+
+static inline const KeySlice& slice(const IndexedKey& key){
+  return key.key;
+}
+
+static inline size_t commonPrefix(const KeySlice& a, const KeySlice& b, size_t depth){
+  const size_t minLen = min(a.len, b.len);
+  while (depth < minLen && a.str[depth] == b.str[depth]) ++depth;
+  return depth;
+}
+
+// keys share the first depth bytes
+template <class T>
+static void insertionSort(T* keys, uint32_t* lcps, const size_t num, const size_t depth){
+  for (size_t i = 1; i < num; ++i){
+    T key = keys[i];
+    size_t j = i;
+    for (; j > 0; --j){
+      const KeySlice& prev = slice(keys[j-1]);
+      size_t p = commonPrefix(prev, slice(key), depth);
+      if (charAt(prev, p) <= charAt(slice(key), p)) break;
+      keys[j] = keys[j-1];
+    }
+    keys[j] = key;
+  }
+  for (size_t i = 1; i < num; ++i){
+    lcps[i] = commonPrefix(slice(keys[i-1]), slice(keys[i]), depth);
+  }
+}
+
+// a bucket of keys[pos, pos+num) sharing the first depth bytes
+struct SortRange {
+  size_t pos;
+  size_t num;
+  size_t depth;
+  SortRange(size_t pos, size_t num, size_t depth) : pos(pos), num(num), depth(depth) {}
+};
+
+// keys share the first depth bytes. lcps[0] is not set.
+// buckets are kept in an explicit stack since keys may be as deep as the input is long.
+template <class T>
+static void radixSort(T* keys, T* tmp, uint16_t* chars, uint32_t* lcps,
+		      const size_t num, const size_t depth){
+  vector<SortRange> ranges;
+  ranges.push_back(SortRange(0, num, depth));
+  size_t counts[BUCKET_NUM];
+  size_t starts[BUCKET_NUM];
+  while (!ranges.empty()){
+    const SortRange range = ranges.back();
+    ranges.pop_back();
+    T* rkeys           = keys  + range.pos;
+    uint16_t* rchars   = chars + range.pos;
+    uint32_t* rlcps    = lcps  + range.pos;
+    const size_t rnum  = range.num;
+    if (rnum < INSERTION_SORT_SIZE){
+      insertionSort(rkeys, rlcps, rnum, range.depth);
+      continue;
+    }
+    memset(counts, 0, sizeof(counts));
+    for (size_t i = 0; i < rnum; ++i){
+      rchars[i] = charAt(slice(rkeys[i]), range.depth);
+      ++counts[rchars[i]];
+    }
+    if (counts[rchars[0]] == rnum && rchars[0] != 0){ 
+      // all keys go to the same bucket
+      ranges.push_back(SortRange(range.pos, rnum, range.depth + 1));
+      continue;
+    }
+
+    size_t sum = 0;
+    for (size_t b = 0; b < BUCKET_NUM; ++b){
+      starts[b] = sum;
+      sum += counts[b];
+    }
+    T* rtmp = tmp + range.pos;
+    for (size_t i = 0; i < rnum; ++i){
+      rtmp[starts[rchars[i]]++] = rkeys[i];
+    }
+    memcpy(rkeys, rtmp, sizeof(rkeys[0]) * rnum);
+
+    size_t pos = 0;
+    for (size_t b = 0; b < BUCKET_NUM; ++b){
+      if (counts[b] == 0) continue;
+      if (pos > 0) rlcps[pos] = range.depth;
+      if (b == 0){
+	// the same keys ending at depth
+	for (size_t i = 1; i < counts[b]; ++i){
+	  rlcps[pos + i] = range.depth;
+	}
+      } else if (counts[b] > 1){
+	ranges.push_back(SortRange(range.pos + pos, counts[b], range.depth + 1));
+      }
+      pos += counts[b];
+    }
+  }
+}
+
+template <class T>
+struct RadixSortTask{
+  T* keys;
+  T* tmp;
+  uint16_t* chars;
+  uint32_t* lcps;
+  vector<pair<size_t, size_t> > buckets;
+  void run(){
+    for (size_t i = 0; i < buckets.size(); ++i){
+      const size_t pos = buckets[i].first;
+      radixSort(keys + pos, tmp + pos, chars + pos, lcps + pos, buckets[i].second, 1);
+    }
+  }
+};
+
+template <class T>
+static void sortAll(vector<T>& keys, vector<uint32_t>& lcps, const size_t threadNum){
+  const size_t num = keys.size();
+  lcps.assign(num, 0);
+  if (num == 0) return;
+
+  vector<T> tmp(num);
+  vector<uint16_t> chars(num);
+  if (threadNum <= 1 || num < threadNum * 1024){
+    radixSort(&keys[0], &tmp[0], &chars[0], &lcps[0], num, 0);
+  } else {
+    // distribute by the first byte, and then sort buckets in parallel
+    size_t counts[BUCKET_NUM];
+    memset(counts, 0, sizeof(counts));
+    for (size_t i = 0; i < num; ++i){
+      chars[i] = charAt(slice(keys[i]), 0);
+      ++counts[chars[i]];
+    }
+    size_t starts[BUCKET_NUM];
+    size_t sum = 0;
+    for (size_t b = 0; b < BUCKET_NUM; ++b){
+      starts[b] = sum;
+      sum += counts[b];
+    }
+    for (size_t i = 0; i < num; ++i){
+      tmp[starts[chars[i]]++] = keys[i];
+    }
+    keys.swap(tmp);
+
+    vector<RadixSortTask<T> > tasks(threadNum);
+    vector<size_t> loads(threadNum);
+    size_t pos = counts[0];
+    for (size_t i = 1; i < counts[0]; ++i){
+      lcps[i] = 0; // empty keys
+    }
+    for (size_t b = 1; b < BUCKET_NUM; ++b){
+      if (counts[b] == 0) continue;
+      if (pos > 0) lcps[pos] = 0;
+      size_t t = min_element(loads.begin(), loads.end()) - loads.begin();
+      tasks[t].buckets.push_back(make_pair(pos, counts[b]));
+      loads[t] += counts[b];
+      pos += counts[b];
+    }
+    for (size_t t = 0; t < threadNum; ++t){
+      tasks[t].keys  = &keys[0];
+      tasks[t].tmp   = &tmp[0];
+      tasks[t].chars = &chars[0];
+      tasks[t].lcps  = &lcps[0];
+    }
+    runTasks(tasks);
+  }
+}
+
+void radixSortKeys(vector<KeySlice>& keys, vector<uint32_t>& lcps, const size_t threadNum){
+  sortAll(keys, lcps, threadNum);
+  if (keys.empty()) return;
+
+  // remove duplicated keys
+  const size_t num = keys.size();
+  size_t w = 1;
+  for (size_t i = 1; i < num; ++i){
+    if (keys[i].len == lcps[i] && keys[w-1].len == lcps[i]){
+      continue;
+    }
+    keys[w] = keys[i];
+    lcps[w] = lcps[i];
+    ++w;
+  }
+  keys.resize(w);
+  lcps.resize(w);
+}
+
+void radixSortKeys(vector<IndexedKey>& keys, vector<uint32_t>& lcps, const size_t threadNum){
+  sortAll(keys, lcps, threadNum);
+}
+
+void computeLCPs(const vector<KeySlice>& keys, vector<uint32_t>& lcps){
+  lcps.assign(keys.size(), 0);
+  for (size_t i = 1; i < keys.size(); ++i){
+    lcps[i] = commonPrefix(keys[i-1], keys[i], 0);
+  }
+}
+
+}
@@ -0,0 +1,67 @@
+/* 
+ *  Copyright (c) 2010 Daisuke Okanohara
+ * 
+ *   Redistribution and use in source and binary forms, with or without
+ *   modification, are permitted provided that the following conditions
+ *   are met:
+ * 
+ *   1. Redistributions of source code must retain the above Copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *   2. Redistributions in binary form must reproduce the above Copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ *   3. Neither the name of the authors nor the names of its contributors
+ *      may be used to endorse or promote products derived from this
+ *      software without specific prior written permission.
+ */
+
+#ifndef UX_SORT_HPP__
+#define UX_SORT_HPP__
+
+#include <vector>
+#include <stdint.h>
+#include "uxTrie.hpp"
+
+namespace ux {
+
+/**
+ * A key with its position in the input
+ */
+struct IndexedKey {
+  KeySlice key;
+  size_t index;
+};
+
+/**
+ * Sort keys in the lexicographic order (as unsigned bytes) by the MSD radix sort,
+ * and remove duplicated keys.
+ * As a side product, lcps[i] is set to the length of the longest common prefix of
+ * keys[i-1] and keys[i] (lcps[0] = 0), which is the depth where they are split in the trie.
+ * @param keys The keys to be sorted
+ * @param lcps The lengths of the longest common prefixes of adjacent keys
+ * @param threadNum The number of threads
+ */
+void radixSortKeys(std::vector<KeySlice>& keys, std::vector<uint32_t>& lcps, size_t threadNum);
+
+/**
+ * Sort keys in the lexicographic order by the MSD radix sort.
+ * Duplicated keys are kept next to each other; keys[i] is a duplicate of keys[i-1]
+ * if lcps[i] is equal to the lengths of both keys.
+ * @param keys The keys to be sorted
+ * @param lcps The lengths of the longest common prefixes of adjacent keys
+ * @param threadNum The number of threads
+ */
+void radixSortKeys(std::vector<IndexedKey>& keys, std::vector<uint32_t>& lcps, size_t threadNum);
+
+/**
+ * Compute the lengths of the longest common prefixes of adjacent keys
+ * @param keys The sorted keys
+ * @param lcps lcps[i] is the length of the longest common prefix of keys[i-1] and keys[i]
+ */
+void computeLCPs(const std::vector<KeySlice>& keys, std::vector<uint32_t>& lcps);
+
+}
+
+#endif // UX_SORT_HPP__
@@ -21,8 +21,18 @@
 #include <vector>
 #include <string>
 #include <sstream>
+#include <fstream>
+#include <iterator>
+#include <algorithm>
+#include <cstring>
+#include <cmath>
 #include <map>
+#include <set>
 #include "uxTrie.hpp"
+#include "uxBuilder.hpp"
+#include "bloomFilter.hpp"
+#include "uxImage.hpp"
+#include "uxThread.hpp"
 
 using namespace std;
 
@@ -227,3 +237,952 @@ TEST(ux, predictiveTest){
   ASSERT_EQ(1, trie.predictiveSearch(q.c_str(), q.size(), v));
 }  
 
+
+TEST(ux, prefixBound){
+  vector<string> wordList;
+  for (int i = 0; i < 1000; ++i){
+    ostringstream os;
+    os << "key" << i * 7;
+    wordList.push_back(os.str());
+  }
+  wordList.push_back("ke");
+  wordList.push_back("keyword");
+  for (int tail = 0; tail < 2; ++tail){
+    ux::Trie trie;
+    trie.build(wordList, tail);
+    const char* queries[] = {"", "k", "ke", "key", "key1", "key69", "key693", "key6930", "keyw", "x", "keyx"};
+    for (size_t q = 0; q < sizeof(queries) / sizeof(queries[0]); ++q){
+      const string query(queries[q]);
+      vector<ux::id_t> ids;
+      ux::id_t first = 0;
+      ux::id_t last  = 0;
+      trie.predictiveSearch(query.c_str(), query.size(), ids);
+      ASSERT_EQ(!ids.empty(), trie.prefixBound(query.c_str(), query.size(), first, last)) << query;
+      if (ids.empty()) continue;
+      ASSERT_EQ(ids.front(), first) << query;
+      ASSERT_EQ(ids.back(), last) << query;
+    }
+  }
+}
+
+TEST(ux, countPrefix){
+  vector<string> wordList;
+  for (int i = 0; i < 1000; ++i){
+    ostringstream os;
+    os << "key" << i * 7;
+    wordList.push_back(os.str());
+  }
+  wordList.push_back("");
+  wordList.push_back("ke");
+  wordList.push_back("keyword");
+  const char* queries[] = {"", "k", "ke", "key", "key1", "key69", "key693", "key6930", "keyw", "x", "keyx"};
+  for (int index = 0; index < 2; ++index){
+    ux::Trie trie;
+    trie.setCountIndex(index);
+    trie.build(wordList);
+    string buf;
+    ASSERT_EQ(0, trie.saveToBuffer(buf));
+    ux::Trie loaded;
+    ASSERT_EQ(0, loaded.loadFromBuffer(buf.data(), buf.size()));
+    for (size_t q = 0; q < sizeof(queries) / sizeof(queries[0]); ++q){
+      const string query(queries[q]);
+      vector<ux::id_t> ids;
+      trie.predictiveSearch(query.c_str(), query.size(), ids, wordList.size());
+      ASSERT_EQ(ids.size(), trie.countPrefix(query.c_str(), query.size())) << query;
+      ASSERT_EQ(ids.size(), loaded.countPrefix(query.c_str(), query.size())) << query;
+    }
+  }
+}
+
+TEST(ux, decodeKeys){
+  vector<string> wordList;
+  for (int i = 0; i < 1000; ++i){
+    ostringstream os;
+    os << "key" << i * 7;
+    wordList.push_back(os.str());
+  }
+  wordList.push_back("");
+  wordList.push_back("ke");
+  ux::Trie trie(wordList);
+
+  vector<ux::id_t> ids;
+  string q = "key1";
+  trie.predictiveSearch(q.c_str(), q.size(), ids);
+  ids.push_back(ids[0]);
+  for (size_t i = 0; i < trie.size(); ++i){
+    ids.push_back(i);
+  }
+
+  string buf;
+  vector<size_t> offsets;
+  trie.decodeKeys(&ids[0], ids.size(), buf, offsets);
+  ASSERT_EQ(ids.size() + 1, offsets.size());
+  for (size_t i = 0; i < ids.size(); ++i){
+    ASSERT_EQ(trie.decodeKey(ids[i]), buf.substr(offsets[i], offsets[i+1] - offsets[i]));
+  }
+
+  // in the reverse order of IDs
+  reverse(ids.begin(), ids.end());
+  trie.decodeKeys(&ids[0], ids.size(), buf, offsets);
+  for (size_t i = 0; i < ids.size(); ++i){
+    ASSERT_EQ(trie.decodeKey(ids[i]), buf.substr(offsets[i], offsets[i+1] - offsets[i]));
+  }
+
+  trie.decodeKeys(NULL, 0, buf, offsets);
+  ASSERT_EQ(1U, offsets.size());
+  ASSERT_EQ("", buf);
+}
+
+TEST(ux, lookup){
+  vector<string> wordList;
+  wordList.push_back("tea");
+  wordList.push_back("top");
+  wordList.push_back("bear");
+  wordList.push_back("bep");
+  wordList.push_back("beppu");
+  wordList.push_back("東京都");
+  vector<string> origWordList = wordList;
+  ux::Trie ux(wordList);
+
+  for (size_t i = 0; i < origWordList.size(); ++i){
+    const string& q = origWordList[i];
+    ux::id_t id = ux.lookup(q.c_str(), q.size());
+    ASSERT_NE(ux::NOTFOUND, id);
+    ASSERT_EQ(q, ux.decodeKey(id));
+  }
+  string q1 = "teapot";
+  ASSERT_EQ(ux::NOTFOUND, ux.lookup(q1.c_str(), q1.size()));
+  string q2 = "be";
+  ASSERT_EQ(ux::NOTFOUND, ux.lookup(q2.c_str(), q2.size()));
+  string q3 = "bepp";
+  ASSERT_EQ(ux::NOTFOUND, ux.lookup(q3.c_str(), q3.size()));
+  string q4 = "東京";
+  ASSERT_EQ(ux::NOTFOUND, ux.lookup(q4.c_str(), q4.size()));
+  ASSERT_EQ(ux::NOTFOUND, ux.lookup("", 0));
+}
+
+TEST(ux, filter){
+  vector<string> wordList;
+  for (int i = 0; i < 10000; ++i){
+    ostringstream os;
+    os << i * 2;
+    wordList.push_back(os.str());
+  }
+  vector<string> origWordList = wordList;
+  ux::Trie trie;
+  trie.setFilterBitsPerKey(10);
+  trie.build(wordList);
+
+  ostringstream os;
+  ASSERT_EQ(0, trie.save(os));
+  istringstream is(os.str());
+  ux::Trie trie2;
+  ASSERT_EQ(0, trie2.load(is));
+
+  for (size_t i = 0; i < origWordList.size(); ++i){
+    const string& q = origWordList[i];
+    ASSERT_NE(ux::NOTFOUND, trie.lookup(q.c_str(), q.size()));
+    ASSERT_NE(ux::NOTFOUND, trie2.lookup(q.c_str(), q.size()));
+    ostringstream miss;
+    miss << i * 2 + 1;
+    ASSERT_EQ(ux::NOTFOUND, trie2.lookup(miss.str().c_str(), miss.str().size()));
+  }
+}
+
+TEST(ux, bloomFilter){
+  const size_t keyNum  = 20000;
+  const size_t missNum = 200000;
+  vector<uint64_t> hashes;
+  for (size_t i = 0; i < keyNum; ++i){
+    ostringstream os;
+    os << "key" << i;
+    hashes.push_back(ux::hash64(os.str().c_str(), os.str().size()));
+  }
+  const size_t bitsPerKeys[] = {4, 8, 10, 16};
+  for (size_t b = 0; b < 4; ++b){
+    ux::BloomFilter filter;
+    filter.build(hashes, bitsPerKeys[b]);
+    ASSERT_LE(filter.getAllocSize() * 8, keyNum * bitsPerKeys[b] + ux::BLOOM_BLOCK);
+    for (size_t i = 0; i < keyNum; ++i){
+      ASSERT_TRUE(filter.mayContain(hashes[i]));
+    }
+    size_t fpNum = 0;
+    for (size_t i = 0; i < missNum; ++i){
+      ostringstream os;
+      os << "miss" << i;
+      fpNum += filter.mayContain(ux::hash64(os.str().c_str(), os.str().size()));
+    }
+    // the rate of a standard Bloom filter is 0.6185^bitsPerKey, and blocks add a little
+    const double rate = (double)fpNum / missNum;
+    ASSERT_LE(rate, 2 * pow(0.6185, (double)bitsPerKeys[b]) + 0.002);
+    ASSERT_LE(rate, 1.5 * filter.falsePositiveRate() + 0.002);
+  }
+}
+
+TEST(ux, parallelBuild){
+  vector<string> wordList;
+  for (int i = 0; i < 200000; ++i){
+    ostringstream os;
+    os << (i * 7919) % 100003 << "/" << i % 17;
+    wordList.push_back(os.str());
+  }
+  vector<string> wordList2 = wordList;
+
+  ux::Trie serial;
+  serial.build(wordList);
+  ux::Trie parallel;
+  parallel.setThreadNum(4);
+  parallel.build(wordList2);
+
+  ASSERT_EQ(wordList, wordList2);
+  ostringstream os1;
+  ostringstream os2;
+  ASSERT_EQ(0, serial.save(os1));
+  ASSERT_EQ(0, parallel.save(os2));
+  ASSERT_TRUE(os1.str() == os2.str());
+}
+
+TEST(ux, streamBuilder){
+  vector<string> wordList;
+  wordList.push_back("");
+  for (int i = 0; i < 100000; ++i){
+    ostringstream os;
+    os << (i * 7919) % 100003 << "/" << string(i % 7, 'a' + i % 3);
+    wordList.push_back(os.str());
+  }
+  ux::Trie trie;
+  trie.setFilterBitsPerKey(8);
+  trie.build(wordList);
+  ostringstream expected;
+  ASSERT_EQ(0, trie.save(expected));
+
+  for (size_t limit = 0; limit <= 4096; limit += 4096){
+    ux::Trie streamTrie;
+    streamTrie.setFilterBitsPerKey(8);
+    ux::StreamBuilder builder(streamTrie, true, limit);
+    for (size_t i = 0; i < wordList.size(); ++i){
+      ASSERT_EQ(0, builder.add(wordList[i]));
+      ASSERT_EQ(0, builder.add(wordList[i]));
+    }
+    ASSERT_EQ(wordList.size(), builder.size());
+    ASSERT_EQ(0, builder.finish());
+    ostringstream os;
+    ASSERT_EQ(0, streamTrie.save(os));
+    ASSERT_TRUE(expected.str() == os.str());
+  }
+
+  // nested tail tries and raw tails, with the tails sorted in spilled runs
+  for (int tailLevel = 0; tailLevel <= 2; ++tailLevel){
+    const bool isTailUX = (tailLevel > 0);
+    ux::Trie levelTrie;
+    levelTrie.setTailLevel(tailLevel);
+    levelTrie.build(wordList, isTailUX);
+    ostringstream levelExpected;
+    ASSERT_EQ(0, levelTrie.save(levelExpected));
+    for (size_t limit = 0; limit <= 4096; limit += 4096){
+      ux::Trie streamTrie;
+      streamTrie.setTailLevel(tailLevel);
+      ux::StreamBuilder builder(streamTrie, isTailUX, limit);
+      for (size_t i = 0; i < wordList.size(); ++i){
+	ASSERT_EQ(0, builder.add(wordList[i]));
+      }
+      ASSERT_EQ(0, builder.finish());
+      ostringstream os;
+      ASSERT_EQ(0, streamTrie.save(os));
+      ASSERT_TRUE(levelExpected.str() == os.str()) << tailLevel << " " << limit;
+    }
+  }
+
+  ux::Trie emptyTrie;
+  ux::StreamBuilder emptyBuilder(emptyTrie, true, 4096);
+  ASSERT_EQ(0, emptyBuilder.finish());
+  ASSERT_EQ(0U, emptyTrie.size());
+
+  ux::Trie trie2;
+  ux::StreamBuilder builder(trie2);
+  ASSERT_EQ(0, builder.add("b"));
+  ASSERT_EQ(ux::Trie::ORDER_ERROR, builder.add("a"));
+  ASSERT_EQ(ux::Trie::ORDER_ERROR, builder.finish());
+}
+
+TEST(ux, radixSort){
+  // binary keys with duplicates, empty keys and long common prefixes
+  vector<string> wordList;
+  string buf;
+  vector<size_t> offsets(1, 0);
+  for (int i = 0; i < 50000; ++i){
+    string s;
+    if (i % 3 == 0) s = string(40, 'x');
+    int len = (i * 31) % 7;
+    for (int j = 0; j < len; ++j){
+      s += (char)((i * 131 + j * 17) % 256);
+    }
+    wordList.push_back(s);
+    buf += s;
+    offsets.push_back(buf.size());
+  }
+
+  ux::Trie trie1;
+  trie1.build(wordList);
+  ostringstream os1;
+  ASSERT_EQ(0, trie1.save(os1));
+  for (size_t threadNum = 1; threadNum <= 4; threadNum += 3){
+    ux::Trie trie2;
+    trie2.setThreadNum(threadNum);
+    trie2.build(buf.c_str(), &offsets[0], offsets.size() - 1);
+    ASSERT_EQ(wordList.size(), trie2.size());
+    ostringstream os2;
+    ASSERT_EQ(0, trie2.save(os2));
+    ASSERT_TRUE(os1.str() == os2.str());
+  }
+}
+
+TEST(ux, buildFromBuffer){
+  // duplicates and an empty key
+  const char* words[] = {"to", "", "tea", "ten", "to", "", "inn", "tea", "i"};
+  const size_t wordNum = sizeof(words) / sizeof(words[0]);
+  vector<string> wordList;
+  string buf;
+  vector<size_t> offsets(1, 0);
+  for (size_t i = 0; i < wordNum; ++i){
+    wordList.push_back(words[i]);
+    buf += words[i];
+    offsets.push_back(buf.size());
+  }
+  for (int isTailUX = 0; isTailUX < 2; ++isTailUX){
+    vector<string> keyList(wordList);
+    ux::Trie trie1;
+    trie1.build(keyList, isTailUX);
+    ostringstream os1;
+    ASSERT_EQ(0, trie1.save(os1));
+
+    ux::Trie trie2;
+    trie2.build(buf.c_str(), &offsets[0], wordNum, isTailUX);
+    ASSERT_EQ(6U, trie2.size());
+    ostringstream os2;
+    ASSERT_EQ(0, trie2.save(os2));
+    ASSERT_TRUE(os1.str() == os2.str());
+    for (size_t i = 0; i < wordNum; ++i){
+      const ux::id_t id = trie2.lookup(words[i], strlen(words[i]));
+      ASSERT_NE(ux::NOTFOUND, id);
+      ASSERT_EQ(wordList[i], trie2.decodeKey(id));
+    }
+    ASSERT_EQ(ux::NOTFOUND, trie2.lookup("te", 2));
+  }
+
+  // no keys
+  const size_t emptyOffsets[] = {0};
+  for (int isTailUX = 0; isTailUX < 2; ++isTailUX){
+    ux::Trie trie;
+    trie.build("", emptyOffsets, 0, isTailUX);
+    ASSERT_EQ(0U, trie.size());
+    ASSERT_EQ(ux::NOTFOUND, trie.lookup("", 0));
+    vector<ux::id_t> retIDs;
+    ASSERT_EQ(0U, trie.predictiveSearch("", 0, retIDs));
+
+    vector<ux::id_t> ids;
+    trie.build("", emptyOffsets, 0, ids, isTailUX);
+    ASSERT_EQ(0U, trie.size());
+    ASSERT_TRUE(ids.empty());
+    ostringstream os;
+    ASSERT_EQ(0, trie.save(os));
+    istringstream is(os.str());
+    ux::Trie loaded;
+    ASSERT_EQ(0, loaded.load(is));
+    ASSERT_EQ(0U, loaded.size());
+  }
+}
+
+TEST(ux, deepKeys){
+  // each key is split from the next one a byte deeper
+  vector<string> wordList;
+  string buf;
+  vector<size_t> offsets(1, 0);
+  for (int i = 0; i < 4000; ++i){
+    const string s = string(i, 'a') + "b";
+    wordList.push_back(s);
+    buf += s;
+    offsets.push_back(buf.size());
+  }
+  ux::Trie trie;
+  trie.build(buf.c_str(), &offsets[0], offsets.size() - 1);
+  ASSERT_EQ(wordList.size(), trie.size());
+  for (size_t i = 0; i < wordList.size(); i += 97){
+    const ux::id_t id = trie.lookup(wordList[i].c_str(), wordList[i].size());
+    ASSERT_NE(ux::NOTFOUND, id);
+    ASSERT_EQ(wordList[i], trie.decodeKey(id));
+  }
+}
+
+TEST(ux, buildWithIDs){
+  string buf;
+  vector<size_t> offsets(1, 0);
+  for (int i = 0; i < 20000; ++i){
+    ostringstream os;
+    os << (i * 7919) % 10007 << "/x"; // with duplicates
+    buf += os.str();
+    offsets.push_back(buf.size());
+  }
+
+  for (size_t threadNum = 1; threadNum <= 4; threadNum += 3){
+    ux::Trie trie;
+    trie.setThreadNum(threadNum);
+    vector<ux::id_t> ids;
+    trie.build(buf.c_str(), &offsets[0], offsets.size() - 1, ids);
+    ASSERT_EQ(10007, trie.size());
+    ASSERT_EQ(offsets.size() - 1, ids.size());
+    for (size_t i = 0; i < ids.size(); ++i){
+      const char* key = buf.c_str() + offsets[i];
+      size_t len = offsets[i+1] - offsets[i];
+      ASSERT_EQ(trie.lookup(key, len), ids[i]);
+    }
+  }
+}
+
+TEST(ux, tailLevel){
+  vector<string> wordList;
+  for (int i = 0; i < 20000; ++i){
+    ostringstream os;
+    os << "http://www.example" << i % 97 << ".com/path/to/" << (i * 7919) % 20011 << "/index.html";
+    wordList.push_back(os.str());
+  }
+  vector<string> origWordList = wordList;
+
+  ux::Trie trie1;
+  trie1.build(wordList);
+  ASSERT_EQ(1, trie1.tailLevelNum());
+  for (size_t tailLevel = 1; tailLevel <= 4; ++tailLevel){
+    ux::Trie trie;
+    trie.setTailLevel(tailLevel);
+    trie.build(wordList);
+    ASSERT_LE(trie.tailLevelNum(), tailLevel);
+    ASSERT_EQ(trie1.size(), trie.size());
+    for (size_t i = 0; i < origWordList.size(); ++i){
+      const string& key = origWordList[i];
+      ux::id_t id = trie.lookup(key.c_str(), key.size());
+      ASSERT_EQ(trie1.lookup(key.c_str(), key.size()), id);
+      ASSERT_EQ(key, trie.decodeKey(id));
+    }
+
+    // misses which share a part of a tail
+    for (size_t i = 0; i < origWordList.size(); i += 7){
+      const string& key = origWordList[i];
+      const ux::id_t id = trie.lookup(key.c_str(), key.size());
+      string changed = key;
+      changed[key.size() - 3] ^= 1;
+      const string qs[]         = {key.substr(0, key.size() - 1), key.substr(0, key.size() - 6),
+				   key + "x", changed};
+      const ux::id_t prefixes[] = {ux::NOTFOUND, ux::NOTFOUND, id, ux::NOTFOUND};
+      const bool predictives[]  = {true, true, false, false};
+      for (size_t j = 0; j < 4; ++j){
+	const string& q = qs[j];
+	ASSERT_EQ(ux::NOTFOUND, trie.lookup(q.c_str(), q.size()));
+	size_t retLen = 0;
+	ASSERT_EQ(prefixes[j], trie.prefixSearch(q.c_str(), q.size(), retLen));
+	vector<ux::id_t> ids;
+	ASSERT_EQ(predictives[j], trie.predictiveSearch(q.c_str(), q.size(), ids) > 0);
+      }
+    }
+
+    ostringstream os;
+    ASSERT_EQ(0, trie.save(os));
+    istringstream is(os.str());
+    ux::Trie loaded;
+    ASSERT_EQ(0, loaded.load(is));
+    ASSERT_EQ(trie.tailLevelNum(), loaded.tailLevelNum());
+    ASSERT_EQ(origWordList[0], loaded.decodeKey(trie.lookup(origWordList[0].c_str(), origWordList[0].size())));
+  }
+}
+
+TEST(ux, frequency){
+  string buf;
+  vector<size_t> offsets(1, 0);
+  vector<uint64_t> freqs;
+  for (int i = 0; i < 5000; ++i){
+    ostringstream os;
+    os << (i * 7919) % 5003 << "/" << i % 7;
+    buf += os.str();
+    offsets.push_back(buf.size());
+    freqs.push_back((i % 10 == 0) ? 1000 + i : i % 3);
+  }
+  const size_t keyNum = offsets.size() - 1;
+
+  ux::Trie trie;
+  vector<ux::id_t> ids;
+  trie.build(buf.c_str(), &offsets[0], keyNum, &freqs[0], ids);
+  ASSERT_EQ(keyNum, ids.size());
+  for (size_t i = 0; i < keyNum; ++i){
+    string key = buf.substr(offsets[i], offsets[i+1] - offsets[i]);
+    ASSERT_EQ(ids[i], trie.lookup(key.c_str(), key.size()));
+    ASSERT_EQ(key, trie.decodeKey(ids[i]));
+  }
+
+  // the most frequent child of the root comes first
+  map<char, uint64_t> rootFreqs;
+  for (size_t i = 0; i < keyNum; ++i){
+    rootFreqs[buf[offsets[i]]] += freqs[i];
+  }
+  char top = rootFreqs.begin()->first;
+  for (map<char, uint64_t>::const_iterator it = rootFreqs.begin(); it != rootFreqs.end(); ++it){
+    if (it->second > rootFreqs[top]) top = it->first;
+  }
+  vector<ux::id_t> retIDs;
+  trie.predictiveSearch("", 0, retIDs, 1);
+  ASSERT_EQ(1, retIDs.size());
+  ASSERT_EQ(top, trie.decodeKey(retIDs[0])[0]);
+}
+
+TEST(ux, merge){
+  vector<string> wordLists[3];
+  set<string> all;
+  for (int i = 0; i < 6000; ++i){
+    ostringstream os;
+    os << (i * 7919) % 3001 << "/" << i % 11;
+    wordLists[i % 3].push_back(os.str());
+    if (i % 5 == 0) wordLists[(i + 1) % 3].push_back(os.str()); // shared keys
+    all.insert(os.str());
+  }
+  ux::Trie tries[3];
+  tries[0].build(wordLists[0]);
+  tries[1].build(wordLists[1], false);
+  string buf;
+  vector<size_t> offsets(1, 0);
+  vector<uint64_t> freqs;
+  for (size_t i = 0; i < wordLists[2].size(); ++i){
+    buf += wordLists[2][i];
+    offsets.push_back(buf.size());
+    freqs.push_back(i % 7);
+  }
+  vector<ux::id_t> ids;
+  tries[2].build(buf.c_str(), &offsets[0], wordLists[2].size(), &freqs[0], ids); // children not in the byte order
+
+  const ux::Trie* inputs[] = {&tries[0], &tries[1], &tries[2]};
+  ux::Trie merged;
+  vector<vector<ux::id_t> > idMaps;
+  ASSERT_EQ(0, merged.merge(inputs, 3, &idMaps));
+
+  vector<string> allList(all.begin(), all.end());
+  ux::Trie expected;
+  expected.build(allList);
+  ostringstream os1;
+  ostringstream os2;
+  ASSERT_EQ(0, expected.save(os1));
+  ASSERT_EQ(0, merged.save(os2));
+  ASSERT_TRUE(os1.str() == os2.str());
+
+  ASSERT_EQ(3, idMaps.size());
+  for (size_t i = 0; i < 3; ++i){
+    ASSERT_EQ(tries[i].size(), idMaps[i].size());
+    for (size_t j = 0; j < tries[i].size(); ++j){
+      ASSERT_EQ(tries[i].decodeKey(j), merged.decodeKey(idMaps[i][j]));
+    }
+  }
+
+  // merge into one of the inputs
+  ASSERT_EQ(0, tries[0].merge(inputs, 3));
+  ostringstream os3;
+  ASSERT_EQ(0, tries[0].save(os3));
+  ASSERT_TRUE(os1.str() == os3.str());
+}
+
+TEST(ux, view){
+  vector<string> wordList;
+  for (int i = 0; i < 5000; ++i){
+    ostringstream os;
+    os << "http://www.example" << i % 31 << ".com/" << (i * 7919) % 5011 << "/index.html";
+    wordList.push_back(os.str());
+  }
+  vector<string> origWordList = wordList;
+  const char* fn = "uxTestView.ind";
+
+  for (int type = 0; type < 4; ++type){
+    ux::Trie trie;
+    if (type == 2) trie.setTailLevel(3);
+    if (type == 3) trie.setFilterBitsPerKey(10);
+    trie.build(wordList, type != 1);
+    ostringstream os;
+    ASSERT_EQ(0, trie.save(os));
+    const string image = os.str();
+    ASSERT_EQ(0, image.size() % 8);
+
+    vector<uint64_t> buf(image.size() / 8);
+    memcpy(&buf[0], image.c_str(), image.size());
+    ux::Trie viewed;
+    size_t used = 0;
+    ASSERT_EQ(0, viewed.view(&buf[0], image.size(), &used));
+    ASSERT_EQ(image.size(), used);
+    ASSERT_NE(0, viewed.view((const char*)&buf[0] + 1, image.size() - 1));
+    ASSERT_NE(0, viewed.view(&buf[0], image.size() - 8));
+    ASSERT_EQ(0, viewed.view(&buf[0], image.size()));
+
+    ASSERT_EQ(0, trie.save(fn));
+    ux::Trie mapped;
+    ASSERT_EQ(0, mapped.map(fn));
+    ASSERT_EQ(0, remove(fn)); // the mapping remains
+
+    ASSERT_EQ(trie.size(), viewed.size());
+    ASSERT_EQ(trie.size(), mapped.size());
+    ASSERT_EQ(trie.tailLevelNum(), mapped.tailLevelNum());
+    for (size_t i = 0; i < origWordList.size(); ++i){
+      const string& key = origWordList[i];
+      ux::id_t id = trie.lookup(key.c_str(), key.size());
+      ASSERT_EQ(id, viewed.lookup(key.c_str(), key.size()));
+      ASSERT_EQ(id, mapped.lookup(key.c_str(), key.size()));
+      ASSERT_EQ(key, mapped.decodeKey(id));
+    }
+    ASSERT_EQ(ux::NOTFOUND, mapped.lookup("http://", 7));
+    vector<ux::id_t> ids1;
+    vector<ux::id_t> ids2;
+    trie.predictiveSearch("http://www.example1", 19, ids1);
+    mapped.predictiveSearch("http://www.example1", 19, ids2);
+    ASSERT_TRUE(ids1 == ids2);
+
+    // load() reads the same image
+    istringstream is(image);
+    ux::Trie loaded;
+    ASSERT_EQ(0, loaded.load(is));
+    ostringstream os2;
+    ASSERT_EQ(0, loaded.save(os2));
+    ASSERT_TRUE(image == os2.str());
+  }
+}
+
+TEST(ux, imageFormat){
+  ux::ImageWriter writer(ux::IMAGE_TRIE);
+  writer.add(1, "abc");
+  writer.add(2, string(3 << 20, 'x')); // verified in chunks
+  writer.add(9, "optional", ux::SECTION_OPTIONAL);
+  ostringstream os;
+  ASSERT_TRUE(writer.write(os));
+  string image = os.str();
+  vector<uint64_t> buf(image.size() / 8);
+  memcpy(&buf[0], image.c_str(), image.size());
+
+  ux::ImageReader reader;
+  ASSERT_EQ(0, reader.open((const char*)&buf[0], image.size(), ux::IMAGE_TRIE, 2));
+  ASSERT_EQ(image.size(), reader.size());
+  ASSERT_EQ(0, reader.verify(3));
+  const char* begin = NULL;
+  const char* end   = NULL;
+  ASSERT_TRUE(reader.find(1, begin, end));
+  ASSERT_EQ("abc", string(begin, end));
+  ASSERT_FALSE(reader.find(9, begin, end)); // skipped
+  ASSERT_EQ(ux::Trie::LOAD_ERROR, reader.open((const char*)&buf[0], image.size() - 8, ux::IMAGE_TRIE, 2));
+  ASSERT_EQ(ux::Trie::LOAD_ERROR, reader.open((const char*)&buf[0], image.size(), ux::IMAGE_TRIE + 1, 2));
+
+  ux::ImageWriter writer2(ux::IMAGE_TRIE);
+  writer2.add(3, "required");
+  ostringstream os2;
+  ASSERT_TRUE(writer2.write(os2));
+  ASSERT_EQ(ux::Trie::VERSION_ERROR, reader.open(os2.str().c_str(), os2.str().size(), ux::IMAGE_TRIE, 2));
+
+  ((char*)&buf[0])[image.size() - 16] ^= 1;
+  ASSERT_EQ(0, reader.open((const char*)&buf[0], image.size(), ux::IMAGE_TRIE, 2));
+  ASSERT_EQ(ux::Trie::CHECKSUM_ERROR, reader.verify(1));
+}
+
+TEST(ux, brokenImage){
+  vector<string> wordList;
+  for (int i = 0; i < 1000; ++i){
+    ostringstream os;
+    os << "key" << i * 17 << "/tail" << i;
+    wordList.push_back(os.str());
+  }
+  ux::Trie trie;
+  trie.build(wordList);
+  ostringstream os;
+  ASSERT_EQ(0, trie.save(os));
+  const string image = os.str();
+
+  for (size_t len = 0; len < image.size(); len += 97){
+    istringstream is(image.substr(0, len));
+    ux::Trie truncated;
+    ASSERT_NE(0, truncated.load(is));
+  }
+
+  string broken = image;
+  broken[broken.size() - 100] ^= 1;
+  istringstream is(broken);
+  ux::Trie trie2;
+  ASSERT_EQ(ux::Trie::CHECKSUM_ERROR, trie2.load(is));
+
+  // byte order mark
+  broken = image;
+  swap(broken[12], broken[15]);
+  istringstream is2(broken);
+  ASSERT_EQ(ux::Trie::VERSION_ERROR, trie2.load(is2));
+
+  // an image size smaller than the header with a huge section count
+  broken = image;
+  const uint32_t sectionNum = 100000000;
+  memcpy(&broken[20], &sectionNum, sizeof(sectionNum));
+  memset(&broken[24], 0, 8);
+  vector<uint64_t> aligned(broken.size() / sizeof(uint64_t) + 1);
+  memcpy(&aligned[0], broken.data(), broken.size());
+  ASSERT_EQ(ux::Trie::LOAD_ERROR, trie2.view(&aligned[0], broken.size()));
+  ASSERT_EQ(ux::Trie::LOAD_ERROR, trie2.loadFromBuffer(broken.data(), broken.size()));
+  istringstream is4(broken);
+  ASSERT_EQ(ux::Trie::LOAD_ERROR, trie2.load(is4));
+
+  // images followed by other data
+  istringstream is3(image + image);
+  ASSERT_EQ(0, trie2.load(is3));
+  ASSERT_EQ(0, trie2.load(is3));
+  ASSERT_EQ(trie.size(), trie2.size());
+  ASSERT_EQ(wordList[0], trie2.decodeKey(trie.lookup(wordList[0].c_str(), wordList[0].size())));
+}
+
+struct LookupTask{
+  const ux::Trie* trie;
+  const vector<string>* keys;
+  size_t hitNum;
+  void run(){
+    hitNum = 0;
+    for (size_t i = 0; i < keys->size(); ++i){
+      const string& key = (*keys)[i];
+      hitNum += (trie->decodeKey(trie->lookup(key.c_str(), key.size())) == key);
+    }
+  }
+};
+
+// indexes saved by ux 0.1.9 for tea, top, bear, bep, beppu, beppuonsen and topic
+static const char LEGACY_UX_IMAGE[] = 
+    "\x21\x00\x00\x00\x00\x00\x00\x00\x52\x52\xb5\xd5\x01\x00\x00\x00"
+    "\x10\x00\x00\x00\x00\x00\x00\x00\x80\xe7\x00\x00\x00\x00\x00\x00"
+    "\x10\x00\x00\x00\x00\x00\x00\x00\x00\x80\x00\x00\x00\x00\x00\x00"
+    "\x01\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00"
+    "\x07\x00\x00\x00\x00\x00\x00\x00\x0f\x00\x00\x00\x00\x00\x00\x00"
+    "\x62\x74\x65\x65\x6f\x61\x70\x61\x70\x72\x70\x69\x75\x63\x6f\x01"
+    "\x00\x00\x00\x03\x00\x00\x00\x00\x00\x00\x00\x06\x00\x00\x00\x00"
+    "\x00\x00\x00\x01\x00\x00\x00\x00\x00\x00\x00\x01\x00\x00\x00\x00"
+    "\x00\x00\x00\x01\x00\x00\x00\x00\x00\x00\x00\x01\x00\x00\x00\x00"
+    "\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x01\x00\x00\x00\x00"
+    "\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x01"
+    "\x00\x00\x00\x00\x00\x00\x00\x04\x00\x00\x00\x00\x00\x00\x00\x6e"
+    "\x65\x73\x6e";
+
+static const char LEGACY_RAW_IMAGE[] = 
+    "\x21\x00\x00\x00\x00\x00\x00\x00\x52\x52\xb5\xd5\x01\x00\x00\x00"
+    "\x10\x00\x00\x00\x00\x00\x00\x00\x80\xe7\x00\x00\x00\x00\x00\x00"
+    "\x10\x00\x00\x00\x00\x00\x00\x00\x00\x80\x00\x00\x00\x00\x00\x00"
+    "\x00\x00\x00\x00\x00\x00\x00\x00\x07\x00\x00\x00\x00\x00\x00\x00"
+    "\x0f\x00\x00\x00\x00\x00\x00\x00\x62\x74\x65\x65\x6f\x61\x70\x61"
+    "\x70\x72\x70\x69\x75\x63\x6f\x00\x00\x00\x00\x01\x00\x00\x00\x00"
+    "\x00\x00\x00\x04\x00\x00\x00\x00\x00\x00\x00\x6e\x73\x65\x6e";
+
+static const char LEGACY_EMPTY_IMAGE[] = 
+    "\x02\x00\x00\x00\x00\x00\x00\x00\x02\x00\x00\x00\x00\x00\x00\x00"
+    "\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00"
+    "\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00"
+    "\x00\x00\x00\x00\x00\x00\x00\x00\x01\x00\x00\x00\x02\x00\x00\x00"
+    "\x00\x00\x00\x00\x02\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00"
+    "\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00"
+    "\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00"
+    "\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00";
+
+TEST(ux, legacyFormat){
+  const char* keys[] = {"tea", "top", "bear", "bep", "beppu", "beppuonsen", "topic"};
+  ux::Trie empty;
+  ASSERT_EQ(0, empty.loadFromBuffer(LEGACY_EMPTY_IMAGE, sizeof(LEGACY_EMPTY_IMAGE) - 1));
+  ASSERT_EQ(0U, empty.size());
+  ASSERT_EQ(ux::NOTFOUND, empty.lookup("tea", 3));
+
+  const string images[] = {string(LEGACY_UX_IMAGE,  sizeof(LEGACY_UX_IMAGE)  - 1),
+			   string(LEGACY_RAW_IMAGE, sizeof(LEGACY_RAW_IMAGE) - 1)};
+  for (int i = 0; i < 2; ++i){
+    {
+      ofstream ofs("uxlegacy.ind", ios::binary);
+      ofs << images[i];
+    }
+    for (int type = 0; type < 4; ++type){
+      ux::Trie trie;
+      if (type == 0){
+	ASSERT_EQ(0, trie.loadFromBuffer(images[i].data(), images[i].size()));
+      } else if (type == 1){
+	istringstream is(images[i]);
+	ASSERT_EQ(0, trie.load(is));
+      } else if (type == 2){
+	ASSERT_EQ(0, trie.load("uxlegacy.ind"));
+      } else {
+	ASSERT_EQ(0, trie.map("uxlegacy.ind"));
+      }
+      ASSERT_EQ(7U, trie.size());
+      for (size_t j = 0; j < 7; ++j){
+	const ux::id_t id = trie.lookup(keys[j], strlen(keys[j]));
+	ASSERT_NE(ux::NOTFOUND, id) << keys[j];
+	ASSERT_EQ(string(keys[j]), trie.decodeKey(id));
+      }
+      ASSERT_EQ(ux::NOTFOUND, trie.lookup("be", 2));
+    }
+  }
+}
+
+TEST(ux, brokenFile){
+  // truncated legacy files
+  const string images[] = {string(LEGACY_UX_IMAGE,  sizeof(LEGACY_UX_IMAGE)  - 1),
+			   string(LEGACY_RAW_IMAGE, sizeof(LEGACY_RAW_IMAGE) - 1)};
+  for (int i = 0; i < 2; ++i){
+    for (size_t len = 0; len < images[i].size(); ++len){
+      ux::Trie trie;
+      istringstream is(images[i].substr(0, len));
+      ASSERT_NE(0, trie.load(is)) << len;
+      ASSERT_NE(0, trie.loadFromBuffer(images[i].data(), len)) << len;
+    }
+  }
+
+  // files which are neither images nor legacy files
+  vector<string> files;
+  files.push_back("hello\n");
+  string random(100000, '\0');
+  uint64_t x = 88172645463325252ULL;
+  for (size_t i = 0; i < random.size(); ++i){
+    x ^= x << 13; x ^= x >> 7; x ^= x << 17;
+    random[i] = (char)x;
+  }
+  files.push_back(random);
+  // a legacy file whose first length is huge
+  files.push_back(string("\xff\xff\xff\xff\xff\xff\xff\x0f", 8) + images[0]);
+
+  // an image whose section count or size is broken
+  vector<string> wordList;
+  wordList.push_back("tea");
+  wordList.push_back("top");
+  ux::Trie trie;
+  trie.build(wordList);
+  string image;
+  ASSERT_EQ(0, trie.saveToBuffer(image));
+  string broken = image;
+  broken[22] = '\x7f'; // sectionNum
+  files.push_back(broken);
+  broken = image;
+  broken[30] = '\x7f'; // size
+  files.push_back(broken);
+
+  for (size_t i = 0; i < files.size(); ++i){
+    {
+      ofstream ofs("uxbroken.ind", ios::binary);
+      ofs << files[i];
+    }
+    ux::Trie t;
+    istringstream is(files[i]);
+    ASSERT_NE(0, t.load(is)) << i;
+    ASSERT_NE(0, t.loadFromBuffer(files[i].data(), files[i].size())) << i;
+    ASSERT_NE(0, t.load("uxbroken.ind")) << i;
+    ASSERT_NE(0, t.map("uxbroken.ind")) << i;
+    ux::Trie lazy;
+    lazy.setLazy(true);
+    ASSERT_NE(0, lazy.load("uxbroken.ind")) << i;
+  }
+}
+
+TEST(ux, lazy){
+  vector<string> wordList;
+  for (int i = 0; i < 5000; ++i){
+    ostringstream os;
+    os << "http://www.example" << i % 31 << ".com/" << (i * 7919) % 5011 << "/index.html";
+    wordList.push_back(os.str());
+  }
+  vector<string> origWordList = wordList;
+  const char* fn = "uxTestLazy.ind";
+
+  for (int type = 0; type < 3; ++type){
+    ux::Trie trie;
+    trie.setFilterBitsPerKey(10);
+    trie.setTailLevel(2);
+    trie.build(wordList, type != 1);
+    ASSERT_EQ(0, trie.save(fn));
+    ostringstream expected;
+    ASSERT_EQ(0, trie.save(expected));
+
+    ux::Trie lazy;
+    lazy.setLazy(true);
+    ASSERT_EQ(0, type == 2 ? lazy.map(fn) : lazy.load(fn));
+    ASSERT_EQ(trie.size(), lazy.size());
+
+    // the first lookups of threads race to read sections
+    vector<LookupTask> tasks(4);
+    for (size_t i = 0; i < tasks.size(); ++i){
+      tasks[i].trie = &lazy;
+      tasks[i].keys = &origWordList;
+    }
+    ux::runTasks(tasks);
+    for (size_t i = 0; i < tasks.size(); ++i){
+      ASSERT_EQ(origWordList.size(), tasks[i].hitNum);
+    }
+    ASSERT_EQ(ux::NOTFOUND, lazy.lookup("http://", 7));
+    ostringstream os;
+    ASSERT_EQ(0, lazy.save(os));
+    ASSERT_TRUE(expected.str() == os.str());
+  }
+
+  // a broken section is found at its first use
+  string image;
+  {
+    ifstream ifs(fn, ios::binary);
+    image.assign(istreambuf_iterator<char>(ifs), istreambuf_iterator<char>());
+  }
+  image[image.size() - 100] ^= 1;
+  {
+    ofstream ofs(fn, ios::binary);
+    ofs << image;
+  }
+  ux::Trie eager;
+  ASSERT_EQ(ux::Trie::CHECKSUM_ERROR, eager.load(fn));
+  ux::Trie lazy;
+  lazy.setLazy(true);
+  ASSERT_EQ(0, lazy.load(fn));
+  // threads see the failure of the first read of another thread
+  vector<LookupTask> tasks(4);
+  for (size_t i = 0; i < tasks.size(); ++i){
+    tasks[i].trie = &lazy;
+    tasks[i].keys = &origWordList;
+  }
+  ux::runTasks(tasks);
+  for (size_t i = 0; i < tasks.size(); ++i){
+    ASSERT_EQ(0U, tasks[i].hitNum);
+  }
+  const string& key = origWordList[0];
+  ASSERT_EQ(ux::NOTFOUND, lazy.lookup(key.c_str(), key.size()));
+  ASSERT_EQ(0, remove(fn));
+}
+
+TEST(ux, buffer){
+  vector<string> wordList;
+  for (int i = 0; i < 3000; ++i){
+    ostringstream os;
+    os << "key" << i * 31 << "/tail" << i % 17;
+    wordList.push_back(os.str());
+  }
+  vector<string> origWordList = wordList;
+
+  for (int type = 0; type < 2; ++type){
+    ux::Trie trie;
+    trie.build(wordList, type == 0);
+    ostringstream os;
+    ASSERT_EQ(0, trie.save(os));
+
+    // images embedded in another blob at an unaligned position
+    string buf = "x";
+    ASSERT_EQ(0, trie.saveToBuffer(buf));
+    const size_t size = buf.size() - 1;
+    ASSERT_TRUE(os.str() == buf.substr(1));
+    ASSERT_EQ(0, trie.saveToBuffer(buf));
+
+    ux::Trie loaded;
+    size_t used = 0;
+    ASSERT_EQ(0, loaded.loadFromBuffer(buf.c_str() + 1, buf.size() - 1, &used));
+    ASSERT_EQ(size, used);
+    ASSERT_EQ(0, loaded.loadFromBuffer(buf.c_str() + 1 + used, buf.size() - 1 - used));
+    buf.clear(); // the image is copied
+    ASSERT_NE(0, loaded.loadFromBuffer(os.str().c_str(), size - 1));
+    ASSERT_EQ(0, loaded.loadFromBuffer(os.str().c_str(), size));
+
+    ASSERT_EQ(trie.size(), loaded.size());
+    for (size_t i = 0; i < origWordList.size(); ++i){
+      const string& key = origWordList[i];
+      ux::id_t id = trie.lookup(key.c_str(), key.size());
+      ASSERT_EQ(id, loaded.lookup(key.c_str(), key.size()));
+      ASSERT_EQ(key, loaded.decodeKey(id));
+    }
+  }
+}
@@ -0,0 +1,69 @@
+/* 
+ *  Copyright (c) 2010 Daisuke Okanohara
+ * 
+ *   Redistribution and use in source and binary forms, with or without
+ *   modification, are permitted provided that the following conditions
+ *   are met:
+ * 
+ *   1. Redistributions of source code must retain the above Copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *   2. Redistributions in binary form must reproduce the above Copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ *   3. Neither the name of the authors nor the names of its contributors
+ *      may be used to endorse or promote products derived from this
+ *      software without specific prior written permission.
+ */
+
+#ifndef UX_THREAD_HPP__
+#define UX_THREAD_HPP__
+
+#include <vector>
+#include <pthread.h>
+
+namespace ux {
+
+/**
+ * A hash of the caller's thread, which spreads threads over slots such as counter stripes
+ * @return The hash value
+ */
+inline size_t threadHash(){
+  return ((size_t)pthread_self() >> 12) * 2654435761U; // thread stacks are page aligned
+}
+
+template <class Task>
+void* runTaskMain(void* task){
+  static_cast<Task*>(task)->run();
+  return NULL;
+}
+
+/**
+ * Run task.run() for all tasks, each in its own thread.
+ * A task whose thread cannot be created is run in the caller's thread.
+ * @param tasks The tasks to be run
+ */
+template <class Task>
+void runTasks(std::vector<Task>& tasks){
+  if (tasks.size() == 1){
+    tasks[0].run();
+    return;
+  }
+  std::vector<pthread_t> threads(tasks.size());
+  std::vector<bool> started(tasks.size());
+  for (size_t i = 0; i < tasks.size(); ++i){
+    started[i] = (pthread_create(&threads[i], NULL, runTaskMain<Task>, &tasks[i]) == 0);
+  }
+  for (size_t i = 0; i < tasks.size(); ++i){
+    if (started[i]){
+      pthread_join(threads[i], NULL);
+    } else {
+      tasks[i].run();
+    }
+  }
+}
+
+}
+
+#endif // UX_THREAD_HPP__
@@ -23,125 +23,685 @@
 #include <cassert>
 #include <map>
 #include <cmath>
+#include <cstring>
+#include <sstream>
+#include <list>
+#include <cerrno>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include "uxTrie.hpp"
+#include "uxThread.hpp"
+#include "uxSort.hpp"
+#include "uxBuilder.hpp"
+#include "uxMMap.hpp"
+#include "uxImage.hpp"
 
 using namespace std;
 
 namespace ux{
 
+enum {
+  SECTION_META = 1,
+  SECTION_LOUD,
+  SECTION_TERMINAL,
+  SECTION_TAIL,
+  SECTION_EDGES,
+  SECTION_FILTER,
+  SECTION_TAIL_IDS,
+  SECTION_NESTED,
+  SECTION_TAIL_OFFSETS,
+  SECTION_TAILS,
+  SECTION_DFS_RANKS,
+  SECTION_NUM = SECTION_DFS_RANKS
+};
+
+// sections used together
+enum {
+  PART_CORE   = 1, // LOUD, TERMINAL, TAIL, EDGES
+  PART_FILTER = 2, // FILTER
+  PART_TAILS  = 4, // NESTED and TAIL_IDS, or TAIL_OFFSETS and TAILS
+  PART_RANKS  = 8, // DFS_RANKS
+  PART_ALL    = 15
+};
+
+static bool preadAll(const int fd, char* p, uint64_t size, uint64_t offset){
+  while (size > 0){
+    ssize_t ret = pread(fd, p, size, offset);
+    if (ret <= 0){
+      if (ret < 0 && errno == EINTR) continue;
+      return false;
+    }
+    p      += ret;
+    size   -= ret;
+    offset += ret;
+  }
+  return true;
+}
+
+/**
+ * Sections of an image, which are read and verified at their first use.
+ * Sections are in memory (image) or read from a file (fd).
+ */
+struct LazyImage {
+  LazyImage() : image(NULL), fd(-1), verify(true), threadNum(1), readyParts(0), err(0) {
+    pthread_mutex_init(&mutex, NULL);
+  }
+
+  ~LazyImage(){
+    if (fd >= 0){
+      close(fd);
+    }
+    pthread_mutex_destroy(&mutex);
+  }
+
+  // ranges of missing sections are NULL
+  int fetch(const uint32_t* ids, const size_t num, vector<const char*>& begins, 
+	    vector<const char*>& ends){
+    begins.assign(num, NULL);
+    ends.assign(num, NULL);
+    vector<ImageSection> sections;
+    vector<const char*> data;
+    for (size_t i = 0; i < num; ++i){
+      ImageSection section;
+      if (!reader.findSection(ids[i], section)) continue;
+      const char* p = NULL;
+      if (image){
+	p = image + section.offset;
+      } else {
+	buffers.push_back(vector<uint64_t>(alignedSize(section.size) / sizeof(uint64_t) + 1));
+	char* buf = (char*)&buffers.back()[0];
+	if (!preadAll(fd, buf, section.size, section.offset)){
+	  return Trie::FILE_READ_ERROR;
+	}
+	p = buf;
+      }
+      begins[i] = p;
+      ends[i]   = p + section.size;
+      sections.push_back(section);
+      data.push_back(p);
+    }
+    return verify ? ImageReader::verify(sections, data, threadNum) : 0;
+  }
+
+  ImageReader reader;
+  const char* image;
+  int fd;
+  std::vector<uint64_t> directory;
+  std::list<std::vector<uint64_t> > buffers; // sections read from fd
+  bool verify;
+  size_t threadNum;
+  pthread_mutex_t mutex;
+  int readyParts; // PART_*, read without the lock
+  int err;        // the first error of loadParts(), read without the lock
+};
+
 struct RangeNode{
   RangeNode(size_t _left, size_t _right) :
     left(_left), right(_right) {}
   size_t left;
   size_t right;
 };
-  
-Trie::Trie() : vtailux_(NULL), tailIDLen_(0), keyNum_(0), isReady_(false) {
-} 
 
-Trie::Trie(vector<string>& keyList, const bool isTailUX) : vtailux_(NULL), tailIDLen_(0), keyNum_(0), isReady_(false) {
-  build(keyList, isTailUX);
-} 
-  
-Trie::~Trie(){
-  delete vtailux_;
-}
-  
-void Trie::build(vector<string>& keyList, const bool isTailUX){
-  clear();
-  sort(keyList.begin(), keyList.end());
-  keyList.erase(unique(keyList.begin(), keyList.end()), keyList.end());
-  
-  keyNum_ = keyList.size();
-  
-  queue<RangeNode> q;
-  queue<RangeNode> nextQ;
-  if (keyNum_ != 0){
-    q.push(RangeNode(0, keyNum_));
+// The bits, edges and tails of consecutive nodes in one BFS level
+struct LevelFragment{
+  BitVec loud;
+  BitVec terminal;
+  BitVec tail;
+  vector<uint8_t> edges;
+  vector<KeySlice> tails;
+  vector<RangeNode> next;
+  vector<size_t> terminalKeys;
+
+  void append(const LevelFragment& frag){
+    loud.append(frag.loud);
+    terminal.append(frag.terminal);
+    tail.append(frag.tail);
+    edges.insert(edges.end(), frag.edges.begin(), frag.edges.end());
+    tails.insert(tails.end(), frag.tails.begin(), frag.tails.end());
+    next.insert(next.end(), frag.next.begin(), frag.next.end());
+    terminalKeys.insert(terminalKeys.end(), frag.terminalKeys.begin(), frag.terminalKeys.end());
   }
+};
 
-  BitVec terminalBV;
-  BitVec tailBV;
-  BitVec loudBV;
-  loudBV.push_back(0); // super root
-  loudBV.push_back(1);
-  
-  for (size_t depth = 0;;){
-    if (q.empty()){
-      swap(q, nextQ);
-      ++depth;
-      if (q.empty()) break;
-    }
-    RangeNode& rn = q.front();
-    const size_t left  = rn.left;
-    const size_t right = rn.right;
-    q.pop();
+// Order the children of a node, frag.next[begin, end), by their frequencies.
+// Children with the same frequency keep the byte order.
+static void orderChildren(const vector<uint64_t>& freqSums, const size_t begin, LevelFragment& frag){
+  const size_t num = frag.next.size() - begin;
+  if (num <= 1) return;
+  const size_t edgeBegin = frag.edges.size() - num;
+  vector<pair<uint64_t, size_t> > order(num);
+  for (size_t i = 0; i < num; ++i){
+    const RangeNode& child = frag.next[begin + i];
+    order[i] = make_pair(~(freqSums[child.right] - freqSums[child.left]), i);
+  }
+  sort(order.begin(), order.end());
+  vector<RangeNode> next(frag.next.begin() + begin, frag.next.end());
+  vector<uint8_t> edges(frag.edges.begin() + edgeBegin, frag.edges.end());
+  for (size_t i = 0; i < num; ++i){
+    frag.next[begin + i]      = next[order[i].second];
+    frag.edges[edgeBegin + i] = edges[order[i].second];
+  }
+}
+
+// lcps[i] is the length of the longest common prefix of keys[i-1] and keys[i]
+// freqSums[i] is the sum of the frequencies of keys[0, i), or empty if children are in the byte order
+// If recordTerminals is true, the indices of keys are stored in the order of their IDs
+static void buildLevel(const vector<KeySlice>& keys, const vector<uint32_t>& lcps, 
+		       const vector<uint64_t>& freqSums, const RangeNode* nodes, const size_t nodeNum,
+		       const size_t depth, const bool recordTerminals, LevelFragment& frag){
+  for (size_t n = 0; n < nodeNum; ++n){
+    const size_t left  = nodes[n].left;
+    const size_t right = nodes[n].right;
     
-    string& cur = keyList[left];
+    const KeySlice& cur = keys[left];
     if (left + 1 == right &&
-	depth + 1 < cur.size()){ // tail candidate
-      loudBV.push_back(1);
-      terminalBV.push_back(1);
-      tailBV.push_back(1);
-      string tail;
-      for (size_t i = depth; i < cur.size(); ++i){
-	tail += cur[i];
-      }
-      vtails_.push_back(tail);
+	depth + 1 < cur.len){ // tail candidate
+      frag.loud.push_back(1);
+      frag.terminal.push_back(1);
+      frag.tail.push_back(1);
+      KeySlice tail = {cur.str + depth, cur.len - depth};
+      frag.tails.push_back(tail);
+      if (recordTerminals) frag.terminalKeys.push_back(left);
       continue;
     } else {
-      tailBV.push_back(0);
+      frag.tail.push_back(0);
     }
     
-    assert(keyList.size() > left);
+    assert(keys.size() > left);
     size_t newLeft = left;
-    if (depth == cur.size()){
-      terminalBV.push_back(1);
+    if (depth == cur.len){
+      frag.terminal.push_back(1);
+      if (recordTerminals) frag.terminalKeys.push_back(left);
       ++newLeft;
       if (newLeft == right){
-	loudBV.push_back(1);
+	frag.loud.push_back(1);
 	continue;
       }
     } else {
-      terminalBV.push_back(0);
+      frag.terminal.push_back(0);
     }
     
+    const size_t firstChild = frag.next.size();
     size_t  prev  = newLeft;
-    assert(keyList[prev].size() > depth);
-    uint8_t prevC = (uint8_t)keyList[prev][depth];
-    uint64_t degree = 0;
+    assert(keys[prev].len > depth);
+    uint8_t prevC = (uint8_t)keys[prev].str[depth];
     for (size_t i = prev+1; ; ++i){
-      if (i < right && 
-	  prevC == (uint8_t)keyList[i][depth]){
+      if (i < right && lcps[i] > depth){
 	continue;
       }
-      edges_.push_back(prevC);
-      loudBV.push_back(0);
-      degree++;
-      nextQ.push(RangeNode(prev, i));
+      frag.edges.push_back(prevC);
+      frag.loud.push_back(0);
+      frag.next.push_back(RangeNode(prev, i));
       if (i == right){
 	break;
       }
       prev  = i;
-      assert(keyList[prev].size() > depth);
-      prevC = keyList[prev][depth];
-      
+      assert(keys[prev].len > depth);
+      prevC = keys[prev].str[depth];
+    }
+    if (!freqSums.empty()){
+      orderChildren(freqSums, firstChild, frag);
+    }
+    frag.loud.push_back(1);
+  }
+}
+
+struct BuildLevelTask{
+  const vector<KeySlice>* keys;
+  const vector<uint32_t>* lcps;
+  const vector<uint64_t>* freqSums;
+  const RangeNode* nodes;
+  size_t nodeNum;
+  size_t depth;
+  bool recordTerminals;
+  LevelFragment frag;
+  void run(){
+    buildLevel(*keys, *lcps, *freqSums, nodes, nodeNum, depth, recordTerminals, frag);
+  }
+};
+
+template <class T>
+struct SortTask{
+  vector<T>* keys;
+  size_t left;
+  size_t mid;
+  size_t right;
+  bool merge;
+  void run(){
+    if (merge){
+      inplace_merge(keys->begin() + left, keys->begin() + mid, keys->begin() + right);
+    } else {
+      sort(keys->begin() + left, keys->begin() + right);
+    }
+  }
+};
+
+struct RankDicTask{
+  Trie* trie;
+  RSDic* rsDic;
+  BitVec* bitVec;
+  const vector<KeySlice>* tails;
+  void run(){
+    if (rsDic){
+      rsDic->build(*bitVec);
+    } else {
+      trie->buildTailUX(*tails);
+    }
+  }
+};
+
+// Enumerate keys of a trie in the lexicographic order by DFS.
+// Children are visited in the byte order even if they are ordered by frequencies.
+class KeyCursor{
+public:
+  KeyCursor(const Trie& trie) : trie_(&trie) {
+    if (trie.isReady_ && trie.require(PART_CORE | PART_TAILS)){
+      push(2, 2, 0);
+    }
+  }
+
+  // return false if all keys are enumerated
+  bool next(string& key, id_t& id){
+    while (!stack_.empty()){
+      Frame& frame = stack_.back();
+      const uint64_t ones = frame.pos - frame.zeros;
+      if (!frame.isVisited){
+	frame.isVisited = true;
+	prefix_.resize(frame.depth);
+	if (trie_->tail_.getBit(ones)){
+	  key = prefix_ + trie_->getTail(trie_->tail_.rank(ones, 1) - 1);
+	  id  = trie_->terminal_.rank(ones, 1) - 1;
+	  stack_.pop_back();
+	  return true;
+	}
+	for (uint64_t i = 0; trie_->loud_.getBit(frame.pos + i) == 0; ++i){
+	  frame.children.push_back(make_pair(trie_->edges_[frame.zeros + i - 2], i));
+	}
+	sort(frame.children.begin(), frame.children.end());
+	if (trie_->terminal_.getBit(ones)){
+	  key = prefix_;
+	  id  = trie_->terminal_.rank(ones, 1) - 1;
+	  return true;
+	}
+      }
+      if (frame.next == frame.children.size()){
+	stack_.pop_back();
+	continue;
+      }
+      const uint8_t  c = frame.children[frame.next].first;
+      const uint64_t i = frame.children[frame.next].second;
+      ++frame.next;
+      const uint64_t pos   = trie_->loud_.select(frame.zeros + i, 1) + 1;
+      const uint64_t zeros = pos - frame.zeros - i + 1;
+      const size_t   depth = frame.depth;
+      prefix_.resize(depth);
+      prefix_ += (char)c;
+      push(pos, zeros, depth + 1);
+    }
+    return false;
+  }
+
+private:
+  struct Frame{
+    uint64_t pos;
+    uint64_t zeros;
+    size_t depth;
+    bool isVisited;
+    vector<pair<uint8_t, uint64_t> > children;
+    size_t next;
+  };
+
+  void push(const uint64_t pos, const uint64_t zeros, const size_t depth){
+    stack_.push_back(Frame());
+    Frame& frame = stack_.back();
+    frame.pos       = pos;
+    frame.zeros     = zeros;
+    frame.depth     = depth;
+    frame.isVisited = false;
+    frame.next      = 0;
+  }
+
+  const Trie* trie_;
+  vector<Frame> stack_;
+  string prefix_;
+};
+
+template <class T>
+static void sortKeys(vector<T>& keys, const size_t threadNum){
+  const size_t num = keys.size();
+  if (threadNum <= 1 || num < threadNum * 1024){
+    sort(keys.begin(), keys.end());
+    return;
+  }
+
+  // sort each block in parallel, and then merge adjacent blocks in parallel
+  vector<size_t> bounds;
+  vector<SortTask<T> > tasks(threadNum);
+  for (size_t i = 0; i <= threadNum; ++i){
+    bounds.push_back(num * i / threadNum);
+  }
+  for (size_t i = 0; i < threadNum; ++i){
+    tasks[i].keys    = &keys;
+    tasks[i].left    = bounds[i];
+    tasks[i].mid     = bounds[i+1];
+    tasks[i].right   = bounds[i+1];
+    tasks[i].merge   = false;
+  }
+  runTasks(tasks);
+
+  while (bounds.size() > 2){
+    vector<size_t> nextBounds;
+    nextBounds.push_back(0);
+    tasks.clear();
+    for (size_t i = 0; i + 2 < bounds.size(); i += 2){
+      SortTask<T> task;
+      task.keys    = &keys;
+      task.left    = bounds[i];
+      task.mid     = bounds[i+1];
+      task.right   = bounds[i+2];
+      task.merge   = true;
+      tasks.push_back(task);
+      nextBounds.push_back(bounds[i+2]);
+    }
+    if (bounds.size() % 2 == 0){
+      nextBounds.push_back(bounds.back());
+    }
+    runTasks(tasks);
+    bounds.swap(nextBounds);
+  }
+}
+  
+Trie::Trie() : vtailux_(NULL), filterBitsPerKey_(0), useCountIndex_(false), dfsRankLen_(0), threadNum_(1), tailLevel_(1), tailIDLen_(0), keyNum_(0), isReady_(false), verify_(true), lazy_(false), mmap_(NULL), lazyImage_(NULL) {
+} 
+
+Trie::Trie(vector<string>& keyList, const bool isTailUX) : vtailux_(NULL), filterBitsPerKey_(0), useCountIndex_(false), dfsRankLen_(0), threadNum_(1), tailLevel_(1), tailIDLen_(0), keyNum_(0), isReady_(false), verify_(true), lazy_(false), mmap_(NULL), lazyImage_(NULL) {
+  build(keyList, isTailUX);
+} 
+  
+Trie::~Trie(){
+  delete vtailux_;
+  delete lazyImage_;
+  delete mmap_;
+}
+  
+void Trie::build(vector<string>& keyList, const bool isTailUX){
+  sortKeys(keyList, threadNum_);
+  keyList.erase(unique(keyList.begin(), keyList.end()), keyList.end());
+
+  vector<KeySlice> keys(keyList.size());
+  for (size_t i = 0; i < keyList.size(); ++i){
+    keys[i].str = keyList[i].c_str();
+    keys[i].len = keyList[i].size();
+  }
+  vector<uint32_t> lcps;
+  computeLCPs(keys, lcps);
+  buildFromSorted(keys, lcps, vector<uint64_t>(), isTailUX, NULL);
+}
+
+void Trie::build(const char* buf, const size_t* offsets, const size_t keyNum, const bool isTailUX){
+  vector<KeySlice> keys(keyNum);
+  for (size_t i = 0; i < keyNum; ++i){
+    keys[i].str = buf + offsets[i];
+    keys[i].len = offsets[i+1] - offsets[i];
+  }
+  vector<uint32_t> lcps;
+  radixSortKeys(keys, lcps, threadNum_);
+  buildFromSorted(keys, lcps, vector<uint64_t>(), isTailUX, NULL);
+}
+
+void Trie::build(const char* buf, const size_t* offsets, const size_t keyNum, 
+		 vector<id_t>& ids, const bool isTailUX){
+  buildIndexed(buf, offsets, keyNum, NULL, ids, isTailUX);
+}
+
+void Trie::build(const char* buf, const size_t* offsets, const size_t keyNum, 
+		 const uint64_t* freqs, vector<id_t>& ids, const bool isTailUX){
+  buildIndexed(buf, offsets, keyNum, freqs, ids, isTailUX);
+}
+
+void Trie::buildIndexed(const char* buf, const size_t* offsets, const size_t keyNum, 
+			const uint64_t* freqs, vector<id_t>& ids, const bool isTailUX){
+  vector<IndexedKey> indexedKeys(keyNum);
+  for (size_t i = 0; i < keyNum; ++i){
+    indexedKeys[i].key.str = buf + offsets[i];
+    indexedKeys[i].key.len = offsets[i+1] - offsets[i];
+    indexedKeys[i].index   = i;
+  }
+  vector<uint32_t> lcps;
+  radixSortKeys(indexedKeys, lcps, threadNum_);
+
+  // remove duplicated keys. ids[i] is the position of the i-th key in the unique keys
+  ids.resize(keyNum);
+  vector<KeySlice> keys;
+  keys.reserve(keyNum);
+  vector<uint64_t> freqSums;
+  if (freqs){
+    freqSums.reserve(keyNum + 1);
+    freqSums.push_back(0);
+  }
+  for (size_t i = 0; i < keyNum; ++i){
+    const KeySlice& key = indexedKeys[i].key;
+    const uint64_t freq = freqs ? freqs[indexedKeys[i].index] : 0;
+    if (i > 0 && key.len == lcps[i] && keys.back().len == lcps[i]){
+      ids[indexedKeys[i].index] = keys.size() - 1;
+      if (freqs) freqSums.back() += freq;
+      continue;
+    }
+    ids[indexedKeys[i].index] = keys.size();
+    lcps[keys.size()] = lcps[i];
+    keys.push_back(key);
+    if (freqs) freqSums.push_back(freqSums.back() + freq);
+  }
+  lcps.resize(keys.size());
+  vector<IndexedKey>().swap(indexedKeys);
+
+  vector<size_t> terminalKeys;
+  buildFromSorted(keys, lcps, freqSums, isTailUX, &terminalKeys);
+  vector<id_t> keyIDs(keys.size());
+  for (size_t i = 0; i < terminalKeys.size(); ++i){
+    keyIDs[terminalKeys[i]] = i;
+  }
+  for (size_t i = 0; i < keyNum; ++i){
+    ids[i] = keyIDs[ids[i]];
+  }
+}
+
+void Trie::buildFromSorted(const vector<KeySlice>& keys, const vector<uint32_t>& lcps, 
+			   const vector<uint64_t>& freqSums, const bool isTailUX, 
+			   vector<size_t>* terminalKeys){
+  clear();
+  keyNum_ = keys.size();
+
+  if (filterBitsPerKey_ > 0){
+    vector<uint64_t> hashes(keyNum_);
+    for (size_t i = 0; i < keyNum_; ++i){
+      hashes[i] = hash64(keys[i].str, keys[i].len);
     }
-    loudBV.push_back(1);
+    filter_.build(hashes, filterBitsPerKey_);
   }
   
-  loud_.build(loudBV);
-  terminal_.build(terminalBV);
-  tail_.build(tailBV);
+  LevelFragment all;
+  all.loud.push_back(0); // super root
+  all.loud.push_back(1);
+
+  vector<RangeNode> level;
+  if (keyNum_ != 0){
+    level.push_back(RangeNode(0, keyNum_));
+  }
   
+  for (size_t depth = 0; !level.empty(); ++depth){
+    if (threadNum_ <= 1 || level.size() < threadNum_ * 64){
+      buildLevel(keys, lcps, freqSums, &level[0], level.size(), depth, terminalKeys != NULL, all);
+    } else {
+      // split the level so that each thread has the similar number of keys
+      vector<BuildLevelTask> tasks(threadNum_);
+      const size_t keyNumPerTask = (level.back().right - level[0].left) / threadNum_ + 1;
+      size_t begin = 0;
+      for (size_t t = 0; t < threadNum_; ++t){
+	size_t end = begin;
+	size_t sum = 0;
+	while (end < level.size() && (sum < keyNumPerTask || t + 1 == threadNum_)){
+	  sum += level[end].right - level[end].left;
+	  ++end;
+	}
+	tasks[t].keys    = &keys;
+	tasks[t].lcps    = &lcps;
+	tasks[t].freqSums = &freqSums;
+	tasks[t].nodes   = &level[0] + begin;
+	tasks[t].nodeNum = end - begin;
+	tasks[t].depth   = depth;
+	tasks[t].recordTerminals = (terminalKeys != NULL);
+	begin = end;
+      }
+      runTasks(tasks);
+      for (size_t t = 0; t < threadNum_; ++t){
+	all.append(tasks[t].frag);
+      }
+    }
+    level.swap(all.next);
+    all.next.clear();
+  }
+  
+  edges_.swap(all.edges);
+  if (terminalKeys){
+    terminalKeys->swap(all.terminalKeys);
+  }
+  finishBuild(all.loud, all.terminal, all.tail, &all.tails, isTailUX);
+}
+
+int Trie::merge(const Trie* inputs[], const size_t num, vector<vector<id_t> >* idMaps, 
+		const bool isTailUX){
+  vector<KeyCursor> cursors;
+  vector<string> keys(num);
+  vector<id_t> ids(num);
+  vector<bool> isActive(num);
+  for (size_t i = 0; i < num; ++i){
+    cursors.push_back(KeyCursor(*inputs[i]));
+  }
+  for (size_t i = 0; i < num; ++i){
+    isActive[i] = cursors[i].next(keys[i], ids[i]);
+  }
+  if (idMaps){
+    idMaps->resize(num);
+    for (size_t i = 0; i < num; ++i){
+      (*idMaps)[i].assign(inputs[i]->size(), 0);
+    }
+  }
+
+  // inputs are read until finish(), so this can be one of them
+  StreamBuilder builder(*this, isTailUX);
+  if (idMaps){
+    builder.trackIDs();
+  }
+  for (;;){
+    size_t minInput = num;
+    for (size_t i = 0; i < num; ++i){
+      if (isActive[i] && (minInput == num || keys[i] < keys[minInput])){
+	minInput = i;
+      }
+    }
+    if (minInput == num) break;
+
+    int err = builder.add(keys[minInput]);
+    if (err != 0) return err;
+    const string key = keys[minInput];
+    for (size_t i = 0; i < num; ++i){
+      if (isActive[i] && keys[i] == key){
+	if (idMaps){
+	  (*idMaps)[i][ids[i]] = builder.size() - 1; // replaced by the new ID later
+	}
+	isActive[i] = cursors[i].next(keys[i], ids[i]);
+      }
+    }
+  }
+
+  vector<id_t> newIDs;
+  int err = idMaps ? builder.finish(newIDs) : builder.finish();
+  if (err != 0) return err;
+  if (idMaps){
+    for (size_t i = 0; i < num; ++i){
+      vector<id_t>& idMap = (*idMaps)[i];
+      for (size_t j = 0; j < idMap.size(); ++j){
+	idMap[j] = newIDs[idMap[j]];
+      }
+    }
+  }
+  return 0;
+}
+
+// tails may be NULL if the caller has already built the tails
+void Trie::finishBuild(BitVec& loudBV, BitVec& terminalBV, BitVec& tailBV, 
+		       const vector<KeySlice>* tails, const bool isTailUX){
   if (keyNum_ > 0){
     isReady_ = true;
   }
-  
-  if (isTailUX){
-    buildTailUX();
+
+  if (tails && !isTailUX){
+    tailOffsets_.push_back(0);
+    for (size_t i = 0; i < tails->size(); ++i){
+      tails_.append((*tails)[i].str, (*tails)[i].len);
+      tailOffsets_.push_back(tails_.size());
+    }
+  }
+
+  // build the rank dictionaries while the tail is compressed in another thread
+  vector<RankDicTask> tasks(3);
+  tasks[0].rsDic = &loud_;
+  tasks[0].bitVec = &loudBV;
+  tasks[1].rsDic = &terminal_;
+  tasks[1].bitVec = &terminalBV;
+  tasks[2].rsDic = &tail_;
+  tasks[2].bitVec = &tailBV;
+  if (tails && isTailUX){
+    RankDicTask task;
+    task.trie  = this;
+    task.rsDic = NULL;
+    task.tails = tails;
+    tasks.push_back(task);
+  }
+  if (threadNum_ <= 1){
+    for (size_t i = 0; i < tasks.size(); ++i){
+      tasks[i].run();
+    }
+  } else {
+    runTasks(tasks);
+  }
+  if (useCountIndex_ && keyNum_ > 0){
+    buildDFSRanks();
   }
 }
+
+void Trie::setThreadNum(const size_t threadNum){
+  threadNum_ = (threadNum == 0) ? 1 : threadNum;
+}
+
+void Trie::setFilterBitsPerKey(const size_t bitsPerKey){
+  filterBitsPerKey_ = bitsPerKey;
+}
+
+void Trie::setCountIndex(const bool useCountIndex){
+  useCountIndex_ = useCountIndex;
+}
+
+void Trie::setTailLevel(const size_t tailLevel){
+  tailLevel_ = (tailLevel == 0) ? 1 : tailLevel;
+}
+
+void Trie::setVerify(const bool verify){
+  verify_ = verify;
+}
+
+void Trie::setLazy(const bool lazy){
+  lazy_ = lazy;
+}
+
+size_t Trie::tailLevelNum() const {
+  require(PART_ALL);
+  return vtailux_ ? vtailux_->tailLevelNum() + 1 : 0;
+}
   
 int Trie::save(const char* fn) const {
   ofstream ofs(fn, ios::binary);
@@ -152,6 +712,12 @@ int Trie::save(const char* fn) const {
 }
 
 int Trie::load(const char* fn){
+  if (lazy_){
+    int err = openLazy(fn);
+    if (err >= 0){
+      return err;
+    } // not an image
+  }
   ifstream ifs(fn, ios::binary);
   if (!ifs){
     return FILE_OPEN_ERROR;
@@ -159,83 +725,460 @@ int Trie::load(const char* fn){
   return load(ifs);
 }
   
-int Trie::save(std::ostream& os) const {
-  loud_.save(os);
-  terminal_.save(os);
-  tail_.save(os);
-  tailIDs_.save(os);
-  
-  os.write((const char*)&keyNum_, sizeof(keyNum_));
-  size_t edgesSize = edges_.size();
-  os.write((const char*)&edgesSize, sizeof(edgesSize));
-  os.write((const char*)&edges_[0], sizeof(edges_[0]) * edges_.size()); 
-  
-  int useUX = (vtailux_ != NULL);
-  os.write((const char*)&useUX, sizeof(useUX));
-  if (useUX){
+template <class T>
+static void addSection(ImageWriter& writer, const uint32_t id, const T& x, const uint32_t flags = 0){
+  StringBuf buf(writer.section(id, flags));
+  ostream os(&buf);
+  x.save(os);
+}
+
+template <class T>
+static bool viewRange(const char* begin, const char* end, T& x){
+  return begin && x.view(begin, end) && begin == end;
+}
+
+int Trie::addSections(ImageWriter& writer) const {
+  if (lazyImage_ && keyNum_ > 0 && !require(PART_ALL)){
+    return SAVE_ERROR;
+  }
+  const uint64_t keyNum = keyNum_;
+  writer.section(SECTION_META).assign((const char*)&keyNum, sizeof(keyNum));
+  addSection(writer, SECTION_LOUD,     loud_);
+  addSection(writer, SECTION_TERMINAL, terminal_);
+  addSection(writer, SECTION_TAIL,     tail_);
+  addSection(writer, SECTION_EDGES,    edges_);
+  if (!filter_.empty()){
+    addSection(writer, SECTION_FILTER, filter_, SECTION_OPTIONAL);
+  }
+  if (dfsRankLen_ > 0){
+    addSection(writer, SECTION_DFS_RANKS, dfsRanks_, SECTION_OPTIONAL);
+  }
+  if (vtailux_){
+    addSection(writer, SECTION_TAIL_IDS, tailIDs_);
     int err = 0;
-    if ((err = vtailux_->save(os)) != 0){
+    if ((err = vtailux_->saveToBuffer(writer.section(SECTION_NESTED))) != 0){
       return err;
     }
   } else {
-    size_t tailsNum  = vtails_.size();
-    os.write((const char*)&tailsNum,  sizeof(tailsNum));
-    for (size_t i = 0; i < vtails_.size(); ++i){
-      size_t tailSize = vtails_[i].size();
-      os.write((const char*)&tailSize,  sizeof(tailSize));
-      os.write((const char*)&vtails_[i][0], sizeof(vtails_[i][0]) * vtails_[i].size());
-    }
+    addSection(writer, SECTION_TAIL_OFFSETS, tailOffsets_);
+    addSection(writer, SECTION_TAILS,        tails_);
   }
-  
-  if (!os){
+  return 0;
+}
+
+int Trie::save(std::ostream& os) const {
+  ImageWriter writer(IMAGE_TRIE);
+  int err = 0;
+  if ((err = addSections(writer)) != 0){
+    return err;
+  }
+  if (!writer.write(os)){
     return SAVE_ERROR;
   }
   return 0;
 }
 
+int Trie::saveToBuffer(std::string& buf) const {
+  ImageWriter writer(IMAGE_TRIE);
+  int err = 0;
+  if ((err = addSections(writer)) != 0){
+    return err;
+  }
+  const size_t start = buf.size();
+  buf.resize(start + writer.size());
+  writer.write(&buf[start]);
+  return 0;
+}
+
+int Trie::loadFromBuffer(const void* ptr, const size_t size, size_t* usedSize){
+  clear();
+  const char* p = static_cast<const char*>(ptr);
+  if (size < ImageReader::headerSize() || !ImageReader::isImage(p)){
+    // saved before the image format
+    istringstream is(string(p, size));
+    int err = loadLegacy(is);
+    if (err == 0 && usedSize){
+      *usedSize = is.tellg() == std::streampos(-1) ? size : (size_t)is.tellg();
+    }
+    return err;
+  }
+
+  int err = 0;
+  uint64_t imageSize = 0;
+  if ((err = ImageReader::peekSize(p, IMAGE_TRIE, imageSize)) != 0){
+    return err;
+  }
+  if (imageSize > size){
+    return LOAD_ERROR;
+  }
+  // copied to an aligned buffer, which the sections point to
+  vector<uint64_t> image(alignedSize(imageSize) / sizeof(uint64_t));
+  memcpy(&image[0], p, imageSize);
+  if ((err = viewImage((const char*)&image[0], imageSize, verify_, usedSize)) != 0){
+    clear();
+    return err;
+  }
+  image_.swap(image); // the buffer does not move
+  return 0;
+}
+
 int Trie::load(std::istream& is){
   clear();
-  loud_.load(is);
-  terminal_.load(is);
-  tail_.load(is);
+  const std::streampos start = is.tellg();
+  if (start == std::streampos(-1)){
+    return LOAD_ERROR;
+  }
+  vector<uint64_t> image(alignedSize(ImageReader::headerSize()) / sizeof(uint64_t));
+  is.read((char*)&image[0], ImageReader::headerSize());
+  if (!is || !ImageReader::isImage((const char*)&image[0])){
+    // saved before the image format
+    is.clear();
+    is.seekg(start);
+    return loadLegacy(is);
+  }
+  
+  int err = 0;
+  uint64_t size = 0;
+  if ((err = ImageReader::peekSize((const char*)&image[0], IMAGE_TRIE, size)) != 0){
+    return err;
+  }
+  if (size < ImageReader::headerSize() || 
+      !hasBytesLeft(is, size - ImageReader::headerSize())){
+    return LOAD_ERROR;
+  }
+  image.resize(alignedSize(size) / sizeof(uint64_t));
+  is.read((char*)&image[0] + ImageReader::headerSize(), size - ImageReader::headerSize());
+  if (!is){
+    return LOAD_ERROR;
+  }
+  if ((err = viewImage((const char*)&image[0], size, verify_, NULL)) != 0){
+    clear();
+    return err;
+  }
+  image_.swap(image); // the buffer does not move
+  return 0;
+}
+
+// every length is checked against the bytes left in the stream before allocating, 
+// since any file without the image magic is read as the legacy format
+int Trie::loadLegacy(std::istream& is){
+  loud_.loadLegacy(is);
+  terminal_.loadLegacy(is);
+  tail_.loadLegacy(is);
   tailIDs_.load(is);
   
-  is.read((char*)&keyNum_, sizeof(keyNum_));
-  size_t edgesSize = 0;
-  is.read((char*)&edgesSize, sizeof(edgesSize));
-  edges_.resize(edgesSize);
-  is.read((char*)&edges_[0], sizeof(edges_[0]) * edges_.size());
+  uint64_t keyNum = 0;
+  uint64_t edgesSize = 0;
+  if (!readU64(is, keyNum) || !readU64(is, edgesSize) || !hasBytesLeft(is, edgesSize)){
+    return LOAD_ERROR;
+  }
+  keyNum_ = keyNum;
+  vector<uint8_t> edges(edgesSize);
+  if (edgesSize > 0){
+    is.read((char*)&edges[0], sizeof(edges[0]) * edges.size());
+  }
+  edges_.swap(edges);
+  // the legacy format has no filter
+
+  // nodes in the LOUDS, terminal and tail bits, and edges to non-root nodes are consistent
+  // an empty trie has only the super root
+  const uint64_t nodeNum = terminal_.size();
+  if (!is || tail_.size() != nodeNum || loud_.size() != (nodeNum > 0 ? nodeNum * 2 + 1 : 2) ||
+      edges_.size() + (nodeNum > 0) != nodeNum ||
+      (nodeNum > 0 ? terminal_.rank(nodeNum - 1, 1) : 0) != keyNum_){
+    return LOAD_ERROR;
+  }
+  const uint64_t tailNum = (nodeNum > 0) ? tail_.rank(nodeNum - 1, 1) : 0;
   
   int useUX = 0;
   is.read((char*)&useUX, sizeof(useUX));
+  if (!is || (useUX != 0 && useUX != 1)){
+    return LOAD_ERROR;
+  }
   if (useUX){
     vtailux_ = new Trie;
     int err = 0;
-    if ((err = vtailux_->load(is)) != 0){
+    if ((err = vtailux_->loadLegacy(is)) != 0){
       return err;
     }
-    size_t tailNum = vtailux_->size();
-    tailIDLen_ = lg2(tailNum); 
-    
+    tailIDLen_ = lg2(vtailux_->size()); 
+    if (tailIDs_.size() != tailIDLen_ * tailNum){
+      return LOAD_ERROR;
+    }
   } else {
-    size_t tailsNum  = 0;
-    is.read((char*)&tailsNum,  sizeof(tailsNum));
-    vtails_.resize(tailsNum);
-    for (size_t i = 0; i < tailsNum; ++i){
-      size_t tailSize = 0;
-      is.read((char*)&tailSize, sizeof(tailSize));
-      vtails_[i].resize(tailSize);
-      is.read((char*)&vtails_[i][0], sizeof(vtails_[i][0]) * vtails_[i].size());
+    uint64_t tailsNum = 0;
+    uint64_t left     = 0;
+    if (!readU64(is, tailsNum) || tailsNum != tailNum || !bytesLeft(is, left) ||
+	tailsNum > left / sizeof(uint64_t)){
+      return LOAD_ERROR;
     }
+    left -= tailsNum * sizeof(uint64_t);
+    vector<char> tails;
+    vector<uint64_t> tailOffsets(1, 0);
+    for (size_t i = 0; i < tailsNum && is; ++i){
+      uint64_t tailSize = 0;
+      if (!readU64(is, tailSize) || tailSize > left){
+	return LOAD_ERROR;
+      }
+      left -= tailSize;
+      tails.resize(tails.size() + tailSize);
+      if (tailSize > 0){
+	is.read(&tails[tailOffsets.back()], sizeof(tails[0]) * tailSize);
+      }
+      tailOffsets.push_back(tails.size());
+    }
+    tails_.swap(tails);
+    tailOffsets_.swap(tailOffsets);
   }
   
   if (!is){
     return LOAD_ERROR;
   }
-  isReady_ = true;
+  isReady_ = keyNum_ > 0;
+  return 0;
+}
+
+int Trie::view(const void* ptr, const size_t size, size_t* usedSize){
+  clear();
+  const char* begin = static_cast<const char*>(ptr);
+  if (!isLittleEndian()){
+    return VERSION_ERROR;
+  }
+  if ((size > 0 && !begin) || ((uintptr_t)begin % IMAGE_ALIGN) != 0){
+    return LOAD_ERROR;
+  }
+  int err = viewImage(begin, size, verify_, usedSize);
+  if (err != 0){
+    clear();
+    return err;
+  }
+  return 0;
+}
+
+int Trie::viewImage(const char* p, const size_t size, const bool verify, size_t* usedSize){
+  LazyImage* image = new LazyImage;
+  image->image     = p;
+  image->verify    = verify;
+  image->threadNum = threadNum_;
+  int err = 0;
+  if ((err = image->reader.open(p, size, IMAGE_TRIE, SECTION_NUM)) != 0){
+    delete image;
+    return err;
+  }
+  if (usedSize){
+    *usedSize = image->reader.size();
+  }
+  return openImage(image);
+}
+
+int Trie::openLazy(const char* fn){
+  clear();
+  LazyImage* image = new LazyImage;
+  image->verify    = verify_;
+  image->threadNum = threadNum_;
+  if ((image->fd = open(fn, O_RDONLY)) < 0){
+    delete image;
+    return FILE_OPEN_ERROR;
+  }
+  vector<uint64_t>& dir = image->directory;
+  dir.resize(alignedSize(ImageReader::headerSize()) / sizeof(uint64_t));
+  if (!preadAll(image->fd, (char*)&dir[0], ImageReader::headerSize(), 0) ||
+      !ImageReader::isImage((const char*)&dir[0])){
+    delete image;
+    return -1;
+  }
+  const size_t dirSize = ImageReader::directorySize((const char*)&dir[0]);
+  struct stat st;
+  int err = 0;
+  if (fstat(image->fd, &st) != 0){
+    err = FILE_READ_ERROR;
+  } else if (dirSize > (uint64_t)st.st_size){
+    err = LOAD_ERROR; // the section count is broken
+  } else if (dir.resize(alignedSize(dirSize) / sizeof(uint64_t)), 
+	     !preadAll(image->fd, (char*)&dir[0], dirSize, 0)){
+    err = FILE_READ_ERROR;
+  } else if (!isLittleEndian()){
+    err = VERSION_ERROR;
+  } else {
+    err = image->reader.open((const char*)&dir[0], st.st_size, IMAGE_TRIE, SECTION_NUM);
+  }
+  if (err != 0){
+    delete image;
+    return err;
+  }
+  if ((err = openImage(image)) != 0){
+    clear();
+  }
+  return err;
+}
+
+int Trie::openImage(LazyImage* image){
+  const uint32_t ids[] = {SECTION_META};
+  vector<const char*> begins;
+  vector<const char*> ends;
+  uint64_t keyNum = 0;
+  int err = image->fetch(ids, 1, begins, ends);
+  if (err == 0 && (!begins[0] || !viewU64(begins[0], ends[0], keyNum))){
+    err = LOAD_ERROR;
+  }
+  keyNum_ = keyNum; // used by loadParts()
+  if (err == 0 && !lazy_){
+    err = loadParts(*image, PART_ALL);
+  }
+  if (err != 0){
+    keyNum_ = 0;
+    delete image;
+    return err;
+  }
+  isReady_ = keyNum_ > 0; // queries on an empty trie find nothing
+  if (lazy_){
+    lazyImage_ = image;
+  } else {
+    delete image; // all sections are in memory
+  }
+  return 0;
+}
+
+int Trie::loadParts(LazyImage& image, const int parts){
+  vector<const char*> begins;
+  vector<const char*> ends;
+  int err = 0;
+  if (parts & PART_CORE){
+    const uint32_t ids[] = {SECTION_LOUD, SECTION_TERMINAL, SECTION_TAIL, SECTION_EDGES};
+    if ((err = image.fetch(ids, 4, begins, ends)) != 0){
+      return err;
+    }
+    if (!viewRange(begins[0], ends[0], loud_) ||
+	!viewRange(begins[1], ends[1], terminal_) ||
+	!viewRange(begins[2], ends[2], tail_) ||
+	!viewRange(begins[3], ends[3], edges_)){
+      return LOAD_ERROR;
+    }
+  }
+  if (parts & PART_FILTER){
+    const uint32_t ids[] = {SECTION_FILTER};
+    if ((err = image.fetch(ids, 1, begins, ends)) != 0){
+      return err;
+    }
+    if (begins[0] && !viewRange(begins[0], ends[0], filter_)){
+      return LOAD_ERROR;
+    }
+  }
+  if (parts & PART_RANKS){
+    const uint32_t ids[] = {SECTION_DFS_RANKS};
+    if ((err = image.fetch(ids, 1, begins, ends)) != 0){
+      return err;
+    }
+    if (begins[0]){
+      if (!viewRange(begins[0], ends[0], dfsRanks_)){
+	return LOAD_ERROR;
+      }
+      dfsRankLen_ = lg2(keyNum_);
+    }
+  }
+  if (parts & PART_TAILS){
+    const uint32_t ids[] = {SECTION_NESTED, SECTION_TAIL_IDS, SECTION_TAIL_OFFSETS, SECTION_TAILS};
+    if ((err = image.fetch(ids, 4, begins, ends)) != 0){
+      return err;
+    }
+    if (begins[0]){
+      // the nested trie is verified as a part of this image
+      Trie* nested = new Trie;
+      if ((err = nested->viewImage(begins[0], ends[0] - begins[0], false, NULL)) != 0){
+	delete nested;
+	return err;
+      }
+      vtailux_ = nested;
+      if (!viewRange(begins[1], ends[1], tailIDs_)){
+	return LOAD_ERROR;
+      }
+      tailIDLen_ = lg2(vtailux_->size()); 
+    } else if (!viewRange(begins[2], ends[2], tailOffsets_) ||
+	       !viewRange(begins[3], ends[3], tails_)){
+      return LOAD_ERROR;
+    }
+  }
+  return 0;
+}
+
+bool Trie::require(const int parts) const {
+  LazyImage* image = lazyImage_;
+  if (!image){
+    return isReady_;
+  }
+  if ((__atomic_load_n(&image->readyParts, __ATOMIC_ACQUIRE) & parts) != parts){
+    pthread_mutex_lock(&image->mutex);
+    const int missing = parts & ~image->readyParts;
+    if (missing){
+      // sections are filled in a const method as a cache. other threads do not touch them 
+      // until readyParts is set.
+      Trie* self = const_cast<Trie*>(this);
+      int err = self->loadParts(*image, missing);
+      if (err != 0 && image->err == 0){
+	__atomic_store_n(&image->err, err, __ATOMIC_RELEASE);
+      }
+      __atomic_store_n(&image->readyParts, image->readyParts | missing, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&image->mutex);
+  }
+  // isReady_ is not written here, and a failed load makes the trie empty for all threads
+  return isReady_ && __atomic_load_n(&image->err, __ATOMIC_ACQUIRE) == 0;
+}
+
+int Trie::map(const char* fn){
+  MMapFile* mmap = new MMapFile;
+  if (!mmap->open(fn)){
+    delete mmap;
+    clear();
+    return FILE_OPEN_ERROR;
+  }
+  if (mmap->size() < ImageReader::headerSize() || !ImageReader::isImage(mmap->data())){
+    // saved before the image format, which is read into memory
+    int err = loadFromBuffer(mmap->data(), mmap->size());
+    delete mmap;
+    return err;
+  }
+  int err = view(mmap->data(), mmap->size());
+  if (err != 0){
+    delete mmap;
+    return err;
+  }
+  mmap_ = mmap; // view() releases the previous mapping
   return 0;
 }
   
+id_t Trie::lookup(const char* str, const size_t len) const{
+  if (!isReady_ || !require(PART_FILTER)) return NOTFOUND;
+  if (!filter_.empty() && !filter_.mayContain(hash64(str, len))){
+    return NOTFOUND;
+  }
+  if (!require(PART_CORE | PART_TAILS)) return NOTFOUND;
+
+  uint64_t pos   = 2;
+  uint64_t zeros = 2;
+  for (size_t depth = 0; ; ++depth){
+    uint64_t ones = pos - zeros;
+    if (tail_.getBit(ones)){
+      bool tailEnd = false;
+      if (matchTail(tail_.rank(ones, 1) - 1, str + depth, len - depth, tailEnd) != len - depth ||
+	  !tailEnd){
+	return NOTFOUND;
+      }
+      return terminal_.rank(ones, 1) - 1;
+    }
+    if (depth == len){
+      if (!terminal_.getBit(ones)){
+	return NOTFOUND;
+      }
+      return terminal_.rank(ones, 1) - 1;
+    }
+    getChild((uint8_t)str[depth], pos, zeros);
+    if (pos == NOTFOUND){
+      return NOTFOUND;
+    }
+  }
+}
+
 id_t Trie::prefixSearch(const char* str, const size_t len, size_t& retLen) const{
   vector<id_t> retIDs;
   traverse(str, len, retLen, retIDs, 0xFFFFFFFF);
@@ -256,40 +1199,80 @@ size_t Trie::commonPrefixSearch(const char* str, const size_t len, vector<id_t>&
 size_t Trie::predictiveSearch(const char* str, const size_t len, vector<id_t>& retIDs, 
 			    const size_t limit) const{
   retIDs.clear();
-  if (!isReady_) return 0;
+  if (!isReady_ || !require(PART_CORE | PART_TAILS)) return 0;
   if (limit == 0) return 0;
   
-  uint64_t pos       = 2;
-  uint64_t zeros     = 2;
-  for (size_t i = 0; i < len; ++i){
-    uint64_t ones = pos - zeros;
-    
-    if (tail_.getBit(ones)){
-      uint64_t tailID = tail_.rank(ones, 1) - 1;
-      string tail = getTail(tailID);
-      for (size_t j = i; j < len; ++j){
-	if (str[j] != tail[j-i]){
-	  return 0;
-	}
-      }
-      retIDs.push_back(terminal_.rank(ones, 1) - 1);
-
-      return retIDs.size();
-    }
-    getChild((uint8_t)str[i], pos, zeros);
-    if (pos == NOTFOUND){
-      return 0;
-    }
+  uint64_t pos   = 0;
+  uint64_t zeros = 0;
+  if (!findPrefix(str, len, pos, zeros)){
+    return 0;
   }
-  
   // search all descendant nodes from curPos
   enumerateAll(pos, zeros, retIDs, limit);
   return retIDs.size();
 }
 
+bool Trie::prefixBound(const char* str, const size_t len, id_t& first, id_t& last) const {
+  if (!isReady_ || !require(PART_CORE | PART_TAILS)) return false;
+  uint64_t pos   = 0;
+  uint64_t zeros = 0;
+  if (!findPrefix(str, len, pos, zeros)){
+    return false;
+  }
+
+  // the first key is the node itself or in the subtree of the first child
+  uint64_t p = pos;
+  uint64_t z = zeros;
+  while (!terminal_.getBit(p - z)){
+    const uint64_t childPos = loud_.select(z, 1) + 1;
+    z = childPos - z + 1;
+    p = childPos;
+  }
+  first = terminal_.rank(p - z, 1) - 1;
+
+  // the last key is a leaf in the subtree of the last child
+  p = pos;
+  z = zeros;
+  for (;;){
+    uint64_t childNum = 0;
+    while (!loud_.getBit(p + childNum)) ++childNum;
+    if (childNum == 0) break;
+    const uint64_t childPos = loud_.select(z + childNum - 1, 1) + 1;
+    z = childPos - z - (childNum - 1) + 1;
+    p = childPos;
+  }
+  last = terminal_.rank(p - z, 1) - 1;
+  return true;
+}
+
+size_t Trie::countPrefix(const char* str, const size_t len) const {
+  if (!isReady_ || !require(PART_CORE | PART_TAILS | PART_RANKS)) return 0;
+  if (dfsRankLen_ > 0){
+    id_t first = 0;
+    id_t last  = 0;
+    if (!prefixBound(str, len, first, last)){
+      return 0;
+    }
+    return keyRank(last) - keyRank(first) + 1;
+  }
+  uint64_t pos   = 0;
+  uint64_t zeros = 0;
+  if (!findPrefix(str, len, pos, zeros)){
+    return 0;
+  }
+  return countAll(pos, zeros);
+}
+
+uint64_t Trie::keyRank(const id_t id) const {
+  if (!isReady_ || !require(PART_RANKS) || dfsRankLen_ == 0 || id >= keyNum_){
+    return NOTFOUND;
+  }
+  return dfsRanks_.getBits(dfsRankLen_ * id, dfsRankLen_);
+}
+
 void Trie::decodeKey(const id_t id, string& ret) const{
   ret.clear();
-  if (!isReady_) return;
+  if (!isReady_ || !require(PART_CORE | PART_TAILS)) return;
   
   uint64_t nodeID = terminal_.select(id+1, 1);
   
@@ -312,6 +1295,70 @@ string Trie::decodeKey(const id_t id) const {
   decodeKey(id, ret);
   return ret;
 }
+
+void Trie::decodeKeys(const id_t* ids, const size_t num, string& buf,
+		      vector<size_t>& offsets) const{
+  buf.clear();
+  offsets.clear();
+  offsets.push_back(0);
+  if (!isReady_ || !require(PART_CORE | PART_TAILS)) {
+    offsets.resize(num+1, 0);
+    return;
+  }
+
+  // decode keys in the order of IDs, so that a key shares its ancestors with the previous one.
+  // node IDs increase from the root along a path, and path[d] is the node at the depth d+1.
+  vector<pair<id_t, size_t> > order(num);
+  for (size_t i = 0; i < num; ++i){
+    order[i] = make_pair(ids[i], i);
+  }
+  sort(order.begin(), order.end());
+
+  string sorted;
+  vector<size_t> ranges(num * 2); // [ranges[2i], ranges[2i+1]) of sorted is the i-th key
+  string prefix;                  // the labels from the root to the previous node
+  vector<uint64_t> path;
+  vector<pair<uint64_t, uint8_t> > walked;
+  for (size_t i = 0; i < num; ++i){
+    const size_t k = order[i].second;
+    if (i > 0 && order[i].first == order[i-1].first){
+      ranges[k*2]   = ranges[order[i-1].second*2];
+      ranges[k*2+1] = ranges[order[i-1].second*2+1];
+      continue;
+    }
+    const uint64_t nodeID = terminal_.select(order[i].first+1, 1);
+    walked.clear();
+    uint64_t v = nodeID;
+    size_t depth = 0;
+    while (v != 0){
+      vector<uint64_t>::const_iterator it = lower_bound(path.begin(), path.end(), v);
+      if (it != path.end() && *it == v){
+	depth = it - path.begin() + 1;
+	break;
+      }
+      walked.push_back(make_pair(v, edges_[v-1]));
+      v = loud_.select(v+1, 0) - v - 1;
+    }
+    prefix.resize(depth);
+    path.resize(depth);
+    for (size_t j = walked.size(); j > 0; --j){
+      path.push_back(walked[j-1].first);
+      prefix += (char)walked[j-1].second;
+    }
+
+    ranges[k*2] = sorted.size();
+    sorted += prefix;
+    if (tail_.getBit(nodeID)){
+      sorted += getTail(tail_.rank(nodeID, 1) - 1);
+    }
+    ranges[k*2+1] = sorted.size();
+  }
+
+  for (size_t i = 0; i < num; ++i){
+    buf.append(sorted, ranges[i*2], ranges[i*2+1] - ranges[i*2]);
+    offsets.push_back(buf.size());
+  }
+}
   
 size_t Trie::size() const {
   return keyNum_;
@@ -321,14 +1368,23 @@ void Trie::clear() {
   loud_.clear();
   terminal_.clear();
   tail_.clear();
-  vtails_.clear();
+  tails_.clear();
+  tailOffsets_.clear();
   delete vtailux_;
   vtailux_ = NULL;
   edges_.clear();
+  filter_.clear();
+  dfsRanks_.clear();
+  dfsRankLen_ = 0;
   tailIDs_.clear();
   tailIDLen_ = 0;
   keyNum_ = 0;
   isReady_ = false;
+  delete mmap_;
+  mmap_ = NULL;
+  vector<uint64_t>().swap(image_);
+  delete lazyImage_;
+  lazyImage_ = NULL;
 }
   
 std::string Trie::what(const int error){
@@ -341,51 +1397,61 @@ std::string Trie::what(const int error){
     return string("file write error");
   case FILE_READ_ERROR:
     return string("file read error");
+  case SAVE_ERROR:
+    return string("save error");
+  case LOAD_ERROR:
+    return string("load error");
+  case ORDER_ERROR:
+    return string("keys are not sorted");
+  case VERSION_ERROR:
+    return string("unsupported format version or byte order");
+  case CHECKSUM_ERROR:
+    return string("checksum mismatch");
   default:
     return string("unknown error");
   }
 }
 
 size_t Trie::getAllocSize() const{
+  require(PART_ALL);
   size_t retSize = 0;
   if (vtailux_) {
     retSize += vtailux_->getAllocSize();
     retSize += tailIDs_.getAllocSize();
   } else {
-    size_t tailLenSum = 0;
-    for (size_t i = 0; i < vtails_.size(); ++i){
-      tailLenSum += vtails_[i].size();
-    }
-    retSize += tailLenSum + tailLenSum / 8; // length bit vector
+    retSize += tails_.size() + tailOffsets_.size() * sizeof(tailOffsets_[0]);
   }
   return retSize + loud_.getAllocSize() + terminal_.getAllocSize() + 
-    tail_.getAllocSize() + edges_.size();
+    tail_.getAllocSize() + edges_.size() + filter_.getAllocSize() + dfsRanks_.getAllocSize();
 }
   
 void Trie::allocStat(size_t allocSize, ostream& os) const{
+  require(PART_ALL);
   if (vtailux_) {
     vtailux_->allocStat(allocSize, os);
     size_t size = tailIDs_.getAllocSize();
     os << "tailIDs:\t" << size << "\t" << (float)size / allocSize << endl;
   } else {
-    size_t tailLenSum = 0;
-    for (size_t i = 0; i < vtails_.size(); ++i){
-      tailLenSum += vtails_[i].size();
-    }
+    size_t tailLenSum = tails_.size();
+    size_t offsetSize = tailOffsets_.size() * sizeof(tailOffsets_[0]);
     os << "   tails:\t" << tailLenSum << "\t" << (float)tailLenSum / allocSize << endl;
-    os << " tailLen:\t" << tailLenSum/8 << "\t" << (float)tailLenSum/8 / allocSize << endl;
+    os << " tailLen:\t" << offsetSize << "\t" << (float)offsetSize / allocSize << endl;
   }
   os << "    loud:\t" << loud_.getAllocSize() << "\t" << (float)loud_.getAllocSize() / allocSize << endl;
   os << "terminal:\t" << terminal_.getAllocSize() << "\t" << (float)terminal_.getAllocSize() / allocSize << endl;
   os << "    tail:\t" << tail_.getAllocSize() << "\t" << (float)tail_.getAllocSize() / allocSize << endl;
   os << "    edge:\t" << edges_.size() << "\t" << (float)edges_.size() / allocSize << endl;
+  if (!filter_.empty()){
+    os << "  filter:\t" << filter_.getAllocSize() << "\t" << (float)filter_.getAllocSize() / allocSize << endl;
+  }
+  if (dfsRankLen_ > 0){
+    os << "   ranks:\t" << dfsRanks_.getAllocSize() << "\t" << (float)dfsRanks_.getAllocSize() / allocSize << endl;
+  }
 }
   
 void Trie::stat(ostream & os) const {
-  size_t tailslen = 0;
-  for (size_t i = 0; i < vtails_.size(); ++i){
-    tailslen += vtails_[i].size();
-  }
+  require(PART_ALL);
+  size_t tailslen = tails_.size();
   
   os << "   keyNum\t" << keyNum_ << endl
      << "    loud:\t" << loud_.size()     << endl
@@ -393,35 +1459,73 @@ void Trie::stat(ostream & os) const {
      << "    edge:\t" << edges_.size()    << endl
      << " avgedge:\t" << (float)edges_.size() / keyNum_ << endl
      << "  vtails:\t" << tailslen << endl
-     << " tailnum:\t" << vtails_.size() << endl
+     << " tailnum:\t" << tailNum() << endl
      << " avgtail:\t" << (float)tailslen / keyNum_ << endl
-     << endl;
+     << "tailLevel:\t" << tailLevelNum() << endl;
+  if (!filter_.empty()){
+    os << "  filter:\t" << (float)filter_.getAllocSize() * 8 / keyNum_ << " bits/key, "
+       << filter_.hashNum() << " hashes" << endl
+       << "  filter fp:\t" << filter_.falsePositiveRate() << endl;
+  }
+  os << endl;
 }
 
   
-void Trie::buildTailUX(){
-  vector<string> origTails = vtails_;
+void Trie::buildTailUX(const vector<KeySlice>& tails){
+  // reversed tails are stored in one buffer
+  vector<size_t> offsets(tails.size() + 1, 0);
+  for (size_t i = 0; i < tails.size(); ++i){
+    offsets[i+1] = offsets[i] + tails[i].len;
+  }
+  string reversed(offsets.back(), '\0');
+  for (size_t i = 0; i < tails.size(); ++i){
+    reverse_copy(tails[i].str, tails[i].str + tails[i].len, reversed.begin() + offsets[i]);
+  }
+
   try {
     vtailux_ = new Trie;
   } catch (bad_alloc){
     isReady_ = false;
     return;
   }
-  for (size_t i = 0; i < vtails_.size(); ++i){
-    reverse(vtails_[i].begin(), vtails_[i].end());
+  vtailux_->setThreadNum(threadNum_);
+  vtailux_->setTailLevel(tailLevel_ - 1);
+  vector<id_t> ids;
+  vtailux_->build(reversed.c_str(), &offsets[0], tails.size(), ids, tailLevel_ > 1);
+  if (tailLevel_ > 1){
+    vtailux_->shrinkTails();
   }
-  vtailux_->build(vtails_, false);
   tailIDLen_ = lg2(vtailux_->size());
-  
-  for (size_t i = 0; i < origTails.size(); ++i){
-    size_t retLen = 0;
-    reverse(origTails[i].begin(), origTails[i].end());
-    id_t id = vtailux_->prefixSearch(origTails[i].c_str(), origTails[i].size(), retLen);
-    assert(id != NOTFOUND);
-    assert(retLen == origTails[i].size());
-    tailIDs_.push_back_with_len(id, tailIDLen_);
+  for (size_t i = 0; i < ids.size(); ++i){
+    tailIDs_.push_back_with_len(ids[i], tailIDLen_);
   }
-  vector<string>().swap(vtails_);
+}
+
+void Trie::shrinkTails(){
+  // go back to raw tails if the nested trie is not smaller than them
+  if (!vtailux_) return;
+  const size_t num = tailIDLen_ ? tailIDs_.size() / tailIDLen_ : 0;
+  vector<char> tails;
+  vector<uint64_t> tailOffsets(1, 0);
+  for (size_t i = 0; i < num; ++i){
+    string tail = getTail(i);
+    tails.insert(tails.end(), tail.begin(), tail.end());
+    tailOffsets.push_back(tails.size());
+  }
+  if (tails.size() + tailOffsets.size() * sizeof(tailOffsets[0]) > 
+      vtailux_->getAllocSize() + tailIDs_.getAllocSize()){
+    return;
+  }
+  tails_.swap(tails);
+  tailOffsets_.swap(tailOffsets);
+  delete vtailux_;
+  vtailux_ = NULL;
+  tailIDs_.clear();
+  tailIDLen_ = 0;
+}
+
+size_t Trie::tailNum() const {
+  return tailOffsets_.empty() ? 0 : tailOffsets_.size() - 1;
 }
 
 void Trie::getChild(const uint8_t c, uint64_t& pos, uint64_t& zeros) const {
@@ -456,7 +1560,7 @@ void Trie::getParent(uint8_t& c, uint64_t& pos, uint64_t& zeros) const {
 void Trie::traverse(const char* str, const size_t len, 
 		  size_t& lastLen, std::vector<id_t>& retIDs, const size_t limit) const{
   lastLen = 0;
-  if (!isReady_) return;
+  if (!isReady_ || !require(PART_CORE | PART_TAILS)) return;
   if (limit == 0) return;
   
   uint64_t pos   = 2;
@@ -484,6 +1588,24 @@ void Trie::traverse(const char* str, const size_t len,
 }
   
 
+// find the node whose subtree has the keys beginning with str, which may be a leaf with a tail
+bool Trie::findPrefix(const char* str, const size_t len, uint64_t& pos, uint64_t& zeros) const {
+  pos   = 2;
+  zeros = 2;
+  for (size_t i = 0; i < len; ++i){
+    uint64_t ones = pos - zeros;
+    if (tail_.getBit(ones)){
+      bool tailEnd = false;
+      return matchTail(tail_.rank(ones, 1) - 1, str + i, len - i, tailEnd) == len - i;
+    }
+    getChild((uint8_t)str[i], pos, zeros);
+    if (pos == NOTFOUND){
+      return false;
+    }
+  }
+  return true;
+}
+
 void Trie::enumerateAll(const uint64_t pos, const uint64_t zeros, vector<id_t>& retIDs, const size_t limit) const{
   const uint64_t ones = pos - zeros;
   if (terminal_.getBit(ones)){
@@ -498,21 +1620,104 @@ void Trie::enumerateAll(const uint64_t pos, const uint64_t zeros, vector<id_t>&
 }
   
 
+size_t Trie::countAll(const uint64_t pos, const uint64_t zeros) const{
+  size_t num = terminal_.getBit(pos - zeros);
+  for (uint64_t i = 0; loud_.getBit(pos + i) == 0; ++i){
+    uint64_t nextPos = loud_.select(zeros + i, 1)+1;
+    num += countAll(nextPos, nextPos - zeros - i + 1);
+  }
+  return num;
+}
+
+// dfsRanks_[id] is the number of keys before the key of id in the order of predictiveSearch()
+void Trie::buildDFSRanks(){
+  dfsRankLen_ = lg2(keyNum_);
+  vector<uint64_t> ranks(keyNum_);
+  vector<pair<uint64_t, uint64_t> > nodes; // (pos, zeros) to visit
+  nodes.push_back(make_pair(2, 2));
+  uint64_t rank = 0;
+  while (!nodes.empty()){
+    const uint64_t pos   = nodes.back().first;
+    const uint64_t zeros = nodes.back().second;
+    nodes.pop_back();
+    const uint64_t ones = pos - zeros;
+    if (terminal_.getBit(ones)){
+      ranks[terminal_.rank(ones, 1) - 1] = rank++;
+    }
+    uint64_t childNum = 0;
+    while (!loud_.getBit(pos + childNum)) ++childNum;
+    // push in the reverse order to visit the first child first
+    for (uint64_t i = childNum; i > 0; --i){
+      const uint64_t nextPos = loud_.select(zeros + i - 1, 1) + 1;
+      nodes.push_back(make_pair(nextPos, nextPos - zeros - (i - 1) + 1));
+    }
+  }
+  dfsRanks_.clear();
+  for (size_t i = 0; i < ranks.size(); ++i){
+    dfsRanks_.push_back_with_len(ranks[i], dfsRankLen_);
+  }
+}
 
 bool Trie::tailMatch(const char* str, const size_t len, const size_t depth,
 		   const uint64_t tailID, size_t& retLen) const{
-  string tail = getTail(tailID);
-  if (tail.size() > len-depth) {
+  bool tailEnd = false;
+  const size_t matchLen = matchTail(tailID, str + depth, len - depth, tailEnd);
+  if (!tailEnd){
     return false;
   }
-  
-  for (size_t i = 0; i < tail.size(); ++i){
-    if (str[i+depth] != tail[i]) {
-      return false;
+  retLen = matchLen;
+  return true;
+}
+
+// compare the i-th tail with str from the head without decoding the tail, and stop at 
+// the first mismatch. return the length of the match, and set tailEnd if the whole tail matched.
+size_t Trie::matchTail(const uint64_t i, const char* str, const size_t len, bool& tailEnd) const{
+  size_t m = 0;
+  tailEnd = false;
+  if (!vtailux_){
+    const char* tail = tails_.data() + tailOffsets_[i];
+    const size_t tailLen = tailOffsets_[i+1] - tailOffsets_[i];
+    const size_t n = min(tailLen, len);
+    if (memcmp(tail, str, n) == 0){
+      tailEnd = (n == tailLen);
+      return n;
     }
+    while (tail[m] == str[m]) ++m;
+    return m;
+  }
+
+  // the tail is the reversed tail of the node in vtailux_ followed by the labels
+  // from the node to the root
+  const Trie& t = *vtailux_;
+  const uint64_t nodeID = t.terminal_.select(tailIDs_.getBits(tailIDLen_ * i, tailIDLen_) + 1, 1);
+  if (t.tail_.getBit(nodeID)){
+    const uint64_t j = t.tail_.rank(nodeID, 1) - 1;
+    string nested; // only the tails of the deeper levels are decoded
+    const char* p = NULL;
+    size_t n = 0;
+    if (t.vtailux_){
+      nested = t.getTail(j);
+      p = nested.data();
+      n = nested.size();
+    } else {
+      p = t.tails_.data() + t.tailOffsets_[j];
+      n = t.tailOffsets_[j+1] - t.tailOffsets_[j];
+    }
+    for (; n > 0; --n, ++m){
+      if (m == len || str[m] != p[n-1]) return m;
+    }
+  }
+  uint64_t pos   = t.loud_.select(nodeID+1, 1) + 1;
+  uint64_t zeros = pos - nodeID;
+  for (;; ++m){
+    uint8_t c = 0;
+    t.getParent(c, pos, zeros);
+    if (pos == 0){
+      tailEnd = true;
+      return m;
+    }
+    if (m == len || str[m] != (char)c) return m;
   }
-  retLen = tail.size();
-  return true;
 }
   
 std::string Trie::getTail(const uint64_t i) const{
@@ -522,7 +1727,7 @@ std::string Trie::getTail(const uint64_t i) const{
     reverse(ret.begin(), ret.end());
     return ret;
   } else {
-    return vtails_[i];
+    return string(&tails_[tailOffsets_[i]], tailOffsets_[i+1] - tailOffsets_[i]);
   }
 }
 
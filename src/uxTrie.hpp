@@ -25,9 +25,15 @@
 #include <stdint.h>
 #include "bitVec.hpp"
 #include "rsDic.hpp"
+#include "bloomFilter.hpp"
+#include "uxArray.hpp"
 
 namespace ux{
 
+class MMapFile;
+class ImageWriter;
+struct LazyImage;
+
 typedef uint64_t id_t;
 
 enum {
@@ -36,6 +42,14 @@ enum {
 };
 
 
+/**
+ * A key given by a pointer and a length. The key itself is not copied.
+ */
+struct KeySlice {
+  const char* str;
+  size_t len;
+};
+
 /**
  * Succinct Trie Data structure
  */
@@ -64,7 +78,153 @@ public:
    * @param isTailUX use tail compression. 
    */
   void build(std::vector<std::string>& keyList, bool isTailUX = true);
+
+  /**
+   * Build a dictionary from keys stored in one buffer.
+   * Keys are not copied during the build; only their positions are sorted.
+   * @param buf The concatenation of the keys
+   * @param offsets The i-th key is buf[offsets[i], offsets[i+1]). offsets has keyNum+1 elements.
+   * @param keyNum The number of keys
+   * @param isTailUX use tail compression. 
+   */
+  void build(const char* buf, const size_t* offsets, size_t keyNum, bool isTailUX = true);
+
+  /**
+   * Build a dictionary from keys stored in one buffer, and return the ID of each key.
+   * Duplicated keys have the same ID.
+   * @param buf The concatenation of the keys
+   * @param offsets The i-th key is buf[offsets[i], offsets[i+1]). offsets has keyNum+1 elements.
+   * @param keyNum The number of keys
+   * @param ids ids[i] is the ID of the i-th key
+   * @param isTailUX use tail compression. 
+   */
+  void build(const char* buf, const size_t* offsets, size_t keyNum, 
+	     std::vector<id_t>& ids, bool isTailUX = true);
+
+  /**
+   * Build a dictionary where the children of each node are ordered by their frequencies,
+   * so that frequently visited children are found first in a traversal.
+   * The frequency of a node is the sum of the frequencies of the keys below it.
+   * Frequencies of duplicated keys are summed up.
+   * IDs are still valid for lookup() and decodeKey(), but predictiveSearch() 
+   * no longer returns keys in the lexicographic order.
+   * @param buf The concatenation of the keys
+   * @param offsets The i-th key is buf[offsets[i], offsets[i+1]). offsets has keyNum+1 elements.
+   * @param keyNum The number of keys
+   * @param freqs freqs[i] is the frequency of the i-th key
+   * @param ids ids[i] is the ID of the i-th key
+   * @param isTailUX use tail compression. 
+   */
+  void build(const char* buf, const size_t* offsets, size_t keyNum, const uint64_t* freqs,
+	     std::vector<id_t>& ids, bool isTailUX = true);
+
+  /**
+   * Build a dictionary from the keys of key-value pairs, and return the ID of each pair.
+   * The keys are copied into one buffer, and are given to build() with IDs.
+   * @param begin The first pair
+   * @param end The end of the pairs
+   * @param ids ids[i] is the ID of the key of the i-th pair
+   * @param isTailUX use tail compression. 
+   */
+  template <class PairIterator>
+  void buildKeys(PairIterator begin, PairIterator end, std::vector<id_t>& ids, 
+		 bool isTailUX = true){
+    std::string buf;
+    std::vector<size_t> offsets(1, 0);
+    for (PairIterator it = begin; it != end; ++it){
+      buf += it->first;
+      offsets.push_back(buf.size());
+    }
+    build(buf.c_str(), &offsets[0], offsets.size() - 1, ids, isTailUX);
+  }
+
+  /**
+   * Build a dictionary from the keys of key-value pairs, and arrange the values by key IDs.
+   * If a key appears more than once, the last value is used.
+   * @param begin The first pair
+   * @param end The end of the pairs
+   * @param values values[id] is the value of the key of id
+   * @param isTailUX use tail compression. 
+   */
+  template <class PairIterator, class V>
+  void buildKeyValues(PairIterator begin, PairIterator end, std::vector<V>& values, 
+		      bool isTailUX = true){
+    std::vector<id_t> ids;
+    buildKeys(begin, end, ids, isTailUX);
+    values.assign(size(), V());
+    size_t i = 0;
+    for (PairIterator it = begin; it != end; ++it, ++i){
+      values[ids[i]] = it->second;
+    }
+  }
+
+  /**
+   * Build a dictionary of all keys in the input dictionaries.
+   * Keys are enumerated from each input in the lexicographic order, and are given to
+   * StreamBuilder without sorting. This dictionary may be one of the inputs.
+   * @param inputs The input dictionaries
+   * @param num The number of inputs
+   * @param idMaps If not NULL, (*idMaps)[i][j] is set to the new ID of the key whose ID is j in inputs[i]
+   * @param isTailUX use tail compression. 
+   * @return 0 on success, or an error code
+   */
+  int merge(const Trie* inputs[], size_t num, std::vector<std::vector<id_t> >* idMaps = NULL,
+	    bool isTailUX = true);
+
+  /**
+   * Use a Bloom filter to reject missing keys in lookup() before the traversal.
+   * The filter is built in the following build() and is saved with the dictionary.
+   * @param bitsPerKey The number of filter bits per key, or 0 to disable the filter
+   */
+  void setFilterBitsPerKey(size_t bitsPerKey);
+
+  /**
+   * Keep the rank of each key in the order of predictiveSearch() so that countPrefix()
+   * answers without enumerating keys. The ranks are built in the following build() 
+   * with lg2(keyNum) bits per key, and are saved with the dictionary.
+   * @param useCountIndex true to build the ranks, false not to build them (default)
+   */
+  void setCountIndex(bool useCountIndex);
+
+  /**
+   * Use multiple threads in the following build().
+   * The result is identical to the one built by a single thread.
+   * @param threadNum The number of threads
+   */
+  void setThreadNum(size_t threadNum);
+
+  /**
+   * Set the number of nested tries used for tail compression in the following build().
+   * The tails of the i-th nested trie are compressed by the (i+1)-th one,
+   * unless the (i+1)-th trie is not smaller than the raw tails.
+   * @param tailLevel The maximum number of nested tries (default 1)
+   */
+  void setTailLevel(size_t tailLevel);
+
+  /**
+   * Return the number of nested tries used for tail compression
+   * @return The number of nested tries, or 0 if tails are not compressed
+   */
+  size_t tailLevelNum() const;
   
+  /**
+   * Check the checksums of the saved image in the following load(), view() and map().
+   * The check reads the whole image with the threads given by setThreadNum().
+   * @param verify true to check (default), false to skip the check
+   */
+  void setVerify(bool verify);
+
+  /**
+   * Read sections of the saved image at their first use in the following 
+   * load(const char*), view() and map(). Only the header and the section directory are read
+   * at the open. Sections are read by pread() (load) or used in place (view and map), 
+   * and are verified at their first use. It is safe to query from multiple threads.
+   * A lookup rejected by the Bloom filter reads only the filter.
+   * If a section is found broken at its first use, the dictionary becomes empty.
+   * @param lazy true to read sections lazily, false to read all at the open (default)
+   */
+  void setLazy(bool lazy);
+
   /**
    * Save the dictionary in a file
    * @param indexName The file name
@@ -93,6 +253,54 @@ public:
    */
   int load(std::istream& is);
 
+  /**
+   * Append the image of the dictionary to a buffer. 
+   * The image is contiguous and position independent, and is the same as the one by save().
+   * @param buf The image is appended to buf
+   * @return 0 on success, or an error code
+   */
+  int saveToBuffer(std::string& buf) const;
+
+  /**
+   * Load the dictionary from an image in memory with one copy.
+   * The image may be unaligned, and need not outlive the dictionary. 
+   * Use view() to avoid the copy.
+   * @param ptr The beginning of the image
+   * @param size The size of the image in bytes
+   * @param usedSize If not NULL, set to the size of the image used by the dictionary
+   * @return 0 on success, or an error code
+   */
+  int loadFromBuffer(const void* ptr, size_t size, size_t* usedSize = NULL);
+
+  /**
+   * Use a saved image in memory without copying it. 
+   * The image must be aligned to 8 bytes, and must outlive the dictionary.
+   * The dictionary is read only; a following build() or load() replaces the image.
+   * Only images saved on a little endian machine can be used.
+   * @param ptr The beginning of the image
+   * @param size The size of the image in bytes
+   * @param usedSize If not NULL, set to the size of the image used by the dictionary
+   * @return 0 on success, or an error code
+   */
+  int view(const void* ptr, size_t size, size_t* usedSize = NULL);
+
+  /**
+   * Map a saved file into memory, and use it without reading the whole file.
+   * Pages are shared with other processes that map the same file.
+   * A file saved before the image format is read into memory instead.
+   * @param indexName The file name
+   * @return 0 on success, or an error code
+   */
+  int map(const char* indexName);
+
+  /**
+   * Return the ID of the key that exactly matches the query
+   * @param str the query
+   * @param len the length of the query
+   * @return The ID of the matched key or NOTFOUND if no key is matched
+   */
+  id_t lookup(const char* str, size_t len) const;
+
   /**
    * Return the longest key that matches the prefix of the query in the dictionary
    * @param str the query
@@ -124,6 +332,37 @@ public:
   size_t predictiveSearch(const char* str, size_t len, std::vector<id_t>& retIDs, 
 			  size_t limit = LIMIT_DEFAULT) const;
   
+  /**
+   * Return the first and the last keys whose prefixes match the query in the order of 
+   * predictiveSearch(), which is the lexicographic order unless the trie is built with 
+   * frequencies. The keys under the query are contiguous in this order.
+   * @param str the query
+   * @param len the length of the query
+   * @param first The ID of the first key
+   * @param last The ID of the last key
+   * @return true if any key matches, false otherwise
+   */
+  bool prefixBound(const char* str, size_t len, id_t& first, id_t& last) const;
+
+  /**
+   * Return the number of keys whose prefixes match the query.
+   * It takes time proportional to the depth of the trie if the dictionary is built with setCountIndex(true),
+   * and counts all matched keys otherwise.
+   * @param str the query
+   * @param len the length of the query
+   * @return The number of matched keys
+   */
+  size_t countPrefix(const char* str, size_t len) const;
+
+  /**
+   * Return the position of the key in the order of predictiveSearch() in O(1).
+   * The dictionary must be built with setCountIndex(true).
+   * @param id The ID of the key
+   * @return The number of keys before the key, or NOTFOUND if the ranks are not kept 
+   * or such ID does not exist
+   */
+  uint64_t keyRank(id_t id) const;
+
   /**
    * Return the key for the given ID
    * @param id The ID of the key
@@ -137,7 +376,19 @@ public:
    * @return The key for the given ID or empty if such ID does not exist
    */ 
   std::string decodeKey(id_t id) const;
-  
+
+  /**
+   * Return the keys for the given IDs at once.
+   * Keys are decoded in the order of IDs, and the ancestors shared with the previous key
+   * are not decoded again. The same ID is decoded once.
+   * @param ids The IDs of the keys
+   * @param num The number of IDs
+   * @param buf The concatenation of the decoded keys
+   * @param offsets The i-th key is buf[offsets[i], offsets[i+1]). offsets has num+1 elements.
+   */
+  void decodeKeys(const id_t* ids, size_t num, std::string& buf,
+		  std::vector<size_t>& offsets) const;
+
   /**
    * Return the number of keys in the dictionary
    * @return the number of keys in the dictionary
@@ -176,29 +427,65 @@ public:
   static std::string what(int error);
 
 private:
-  void buildTailUX();
+  friend struct RankDicTask;
+  friend class StreamBuilder;
+  friend class KeyCursor;
+  void buildIndexed(const char* buf, const size_t* offsets, size_t keyNum, const uint64_t* freqs,
+		    std::vector<id_t>& ids, bool isTailUX);
+  void buildFromSorted(const std::vector<KeySlice>& keys, const std::vector<uint32_t>& lcps,
+		       const std::vector<uint64_t>& freqSums, bool isTailUX, 
+		       std::vector<size_t>* terminalKeys);
+  void finishBuild(BitVec& loudBV, BitVec& terminalBV, BitVec& tailBV, 
+		   const std::vector<KeySlice>* tails, bool isTailUX);
+  void buildTailUX(const std::vector<KeySlice>& tails);
+  void shrinkTails();
+  int addSections(ImageWriter& writer) const;
+  int loadLegacy(std::istream& is);
+  int viewImage(const char* p, size_t size, bool verify, size_t* usedSize);
+  int openLazy(const char* indexName);
+  int openImage(LazyImage* image);
+  int loadParts(LazyImage& image, int parts);
+  bool require(int parts) const;
+  size_t tailNum() const;
   bool isLeaf(uint64_t pos) const;
   void getChild(uint8_t c, uint64_t& pos, uint64_t& zeros) const;
   void getParent(uint8_t& c, uint64_t& pos, uint64_t& zeros) const;
   void traverse(const char* str, size_t len, size_t& retLen, std::vector<id_t>& retIDs, 
 		size_t limit) const;
 
+  bool findPrefix(const char* str, size_t len, uint64_t& pos, uint64_t& zeros) const;
   void enumerateAll(uint64_t pos, uint64_t zeros, std::vector<id_t>& retIDs, size_t limit) const;
+  size_t countAll(uint64_t pos, uint64_t zeros) const;
+  void buildDFSRanks();
   bool tailMatch(const char* str, size_t len, size_t depth,
 		 uint64_t tailID, size_t& retLen) const;
+  size_t matchTail(uint64_t i, const char* str, size_t len, bool& tailEnd) const;
   std::string getTail(uint64_t i) const;
 
   RSDic loud_;
   RSDic terminal_;
   RSDic tail_;
 
-  std::vector<std::string> vtails_;
+  Array<char> tails_;
+  Array<uint64_t> tailOffsets_;
   Trie* vtailux_;
-  std::vector<uint8_t> edges_;
+  Array<uint8_t> edges_;
+  BloomFilter filter_;
+  size_t filterBitsPerKey_;
+  bool useCountIndex_;
+  BitVec dfsRanks_;
+  size_t dfsRankLen_;
+  size_t threadNum_;
+  size_t tailLevel_;
   BitVec tailIDs_;
   size_t tailIDLen_;
   size_t keyNum_;
   bool isReady_;
+  bool verify_;
+  bool lazy_;
+  MMapFile* mmap_;
+  std::vector<uint64_t> image_;
+  LazyImage* lazyImage_;
 
 public:
   /** 
@@ -210,7 +497,10 @@ public:
     FILE_WRITE_ERROR = 2,
     FILE_READ_ERROR  = 3,
     SAVE_ERROR       = 4,
-    LOAD_ERROR       = 5
+    LOAD_ERROR       = 5,
+    ORDER_ERROR      = 6,
+    VERSION_ERROR    = 7,
+    CHECKSUM_ERROR   = 8
   };
 };
 
@@ -17,13 +17,14 @@
  *      software without specific prior written permission.
  */
 
+#include <cstring>
 #include "uxUtil.hpp"
 
 namespace ux{
 
 uint64_t lg2(const uint64_t x){
   uint64_t ret = 0;
-  while (x >> ret){
+  while (ret < 64 && (x >> ret)){ // x >> 64 is undefined
     ++ret;
   }
   return ret;
@@ -88,5 +89,113 @@ uint64_t getBitNum(uint64_t oneNum, uint64_t num, uint8_t bit){
    else     return num - oneNum;
 }
 
+uint64_t hash64(const char* str, uint64_t len){
+  const uint64_t m = 0xc6a4a7935bd1e995LLU;
+  const int r = 47;
+  uint64_t h = 0x8445d61a4e774912LLU ^ (len * m);
+
+  const unsigned char* p = (const unsigned char*)str;
+  for (; len >= 8; len -= 8, p += 8){
+    uint64_t k = 0;
+    for (int i = 7; i >= 0; --i){
+      k = (k << 8) | p[i];
+    }
+    k *= m;
+    k ^= k >> r;
+    k *= m;
+    h ^= k;
+    h *= m;
+  }
+  if (len > 0){
+    uint64_t k = 0;
+    for (int i = (int)len - 1; i >= 0; --i){
+      k = (k << 8) | p[i];
+    }
+    h ^= k;
+    h *= m;
+  }
+  h ^= h >> r;
+  h *= m;
+  h ^= h >> r;
+  return h;
+}
+
+static const uint64_t PRIME64_1 = 0x9E3779B185EBCA87ULL;
+static const uint64_t PRIME64_2 = 0xC2B2AE3D27D4EB4FULL;
+static const uint64_t PRIME64_3 = 0x165667B19E3779F9ULL;
+static const uint64_t PRIME64_4 = 0x85EBCA77C2B2AE63ULL;
+static const uint64_t PRIME64_5 = 0x27D4EB2F165667C5ULL;
+
+static inline uint64_t rotl64(const uint64_t x, const int r){
+  return (x << r) | (x >> (64 - r));
 }
 
+static inline uint64_t read64(const char* p){
+  uint64_t x;
+  memcpy(&x, p, sizeof(x)); // little endian
+  return x;
+}
+
+static inline uint64_t read32(const char* p){
+  uint32_t x;
+  memcpy(&x, p, sizeof(x));
+  return x;
+}
+
+static inline uint64_t xxRound(uint64_t acc, const uint64_t input){
+  acc += input * PRIME64_2;
+  acc  = rotl64(acc, 31);
+  return acc * PRIME64_1;
+}
+
+static inline uint64_t xxMerge(uint64_t acc, const uint64_t val){
+  acc ^= xxRound(0, val);
+  return acc * PRIME64_1 + PRIME64_4;
+}
+
+// XXH64
+uint64_t checksum64(const char* p, const size_t len, const uint64_t seed){
+  const char* end = p + len;
+  uint64_t h = 0;
+  if (len >= 32){
+    uint64_t v1 = seed + PRIME64_1 + PRIME64_2;
+    uint64_t v2 = seed + PRIME64_2;
+    uint64_t v3 = seed;
+    uint64_t v4 = seed - PRIME64_1;
+    for (; p + 32 <= end; p += 32){
+      v1 = xxRound(v1, read64(p));
+      v2 = xxRound(v2, read64(p + 8));
+      v3 = xxRound(v3, read64(p + 16));
+      v4 = xxRound(v4, read64(p + 24));
+    }
+    h = rotl64(v1, 1) + rotl64(v2, 7) + rotl64(v3, 12) + rotl64(v4, 18);
+    h = xxMerge(h, v1);
+    h = xxMerge(h, v2);
+    h = xxMerge(h, v3);
+    h = xxMerge(h, v4);
+  } else {
+    h = seed + PRIME64_5;
+  }
+  h += len;
+  for (; p + 8 <= end; p += 8){
+    h ^= xxRound(0, read64(p));
+    h  = rotl64(h, 27) * PRIME64_1 + PRIME64_4;
+  }
+  if (p + 4 <= end){
+    h ^= read32(p) * PRIME64_1;
+    h  = rotl64(h, 23) * PRIME64_2 + PRIME64_3;
+    p += 4;
+  }
+  for (; p < end; ++p){
+    h ^= (uint8_t)*p * PRIME64_5;
+    h  = rotl64(h, 11) * PRIME64_1;
+  }
+  h ^= h >> 33;
+  h *= PRIME64_2;
+  h ^= h >> 29;
+  h *= PRIME64_3;
+  h ^= h >> 32;
+  return h;
+}
+
+}
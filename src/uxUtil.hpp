@@ -21,6 +21,7 @@
 #define UX_UTIL_HPP__
 
 #include <stdint.h>
+#include <cstddef>
 
 namespace ux {
   uint64_t lg2(uint64_t x);
@@ -29,6 +30,8 @@ namespace ux {
   uint64_t popCountMasked(uint64_t x, uint64_t pos);
   uint64_t selectBlock(uint64_t pos, uint64_t x, uint8_t b);
   uint64_t getBitNum(uint64_t oneNum, uint64_t num, uint8_t bit);
+  uint64_t hash64(const char* str, uint64_t len);
+  uint64_t checksum64(const char* str, size_t len, uint64_t seed = 0);
 }
 
 #endif // UX_UTIL_HPP__